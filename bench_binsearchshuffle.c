@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <math.h>
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_internal.h"	// SHUFFLE_NEON
+
+// Compares the search variants and layouts for increasing array sizes, from
+// the L1 cache to many times the last level cache, with uniform, Zipfian and
+// sequential lookups that hit or miss, and the build and unshuffle time of
+// each layout.
+// usage: bench_binsearchshuffle [options]
+//	-min <log2>		smallest array, default 10 (4 KB)
+//	-max <log2>		largest array, default 24 (64 MB)
+//	-lookups <n>	lookups per measurement, default 200000
+//	-hit <percent>	hit ratio of the lookups, default runs 100 and 50
+//	-dist <name>	uniform, zipf or sequential, default runs all
+//	-csv / -json	machine readable output, default is a table
+// Each row is one measurement: what was measured, the variant, the array size,
+// the lookups, ns per operation and operations per second (lookups or values).
+// A search variant that finds a different number of values than the regular
+// binary search is reported on stderr.
+
+#define FORMAT_TABLE 0
+#define FORMAT_CSV 1
+#define FORMAT_JSON 2
+
+static double Seconds(clock_t start)
+{
+	return (double)(clock()-start) / CLOCKS_PER_SEC;
+}
+
+static volatile int s_sink;	// results are stored here so the searches are not optimized away
+
+static unsigned int s_seed = 1;
+static unsigned int Random()
+{
+	// xorshift, rand() is only 15 bits on some platforms
+	s_seed ^= s_seed<<13;
+	s_seed ^= s_seed>>17;
+	s_seed ^= s_seed<<5;
+	return s_seed;
+}
+
+static double RandomUnit()
+{
+	return (Random() + 0.5) / 4294967296.0;
+}
+
+// Zipfian rank with exponent 0.99 from the inverse of the continuous
+// distribution, ranks are scattered over the array so the hot values are not
+// all next to each other.
+static int ZipfIndex(int count)
+{
+	const double s = 0.99;
+	double range = pow((double)count+1, 1.0-s) - 1.0;
+	int rank = (int)pow(RandomUnit()*range + 1.0, 1.0/(1.0-s)) - 1;
+	if (rank>=count)
+		rank = count-1;
+	return (int)(((unsigned long long)rank * 2654435761u) % (unsigned int)count);
+}
+
+static int s_format = FORMAT_TABLE;
+static int s_rows = 0;
+
+static void Report(const char *kind, const char *variant, int count, const char *dist, int hit, double seconds, int ops)
+{
+	double ns = seconds * 1e9 / ops;
+	double per_second = seconds>0 ? ops / seconds : 0;
+	if (s_format==FORMAT_CSV) {
+		if (!s_rows)
+			printf("kind,variant,count,distribution,hit_percent,ns_per_op,ops_per_second\n");
+		printf("%s,%s,%d,%s,%d,%.2f,%.0f\n", kind, variant, count, dist, hit, ns, per_second);
+	} else if (s_format==FORMAT_JSON) {
+		printf("%s\n  {\"kind\": \"%s\", \"variant\": \"%s\", \"count\": %d, \"distribution\": \"%s\", \"hit_percent\": %d, \"ns_per_op\": %.2f, \"ops_per_second\": %.0f}",
+			s_rows ? "," : "[", kind, variant, count, dist, hit, ns, per_second);
+	} else {
+		if (!s_rows)
+			printf("%-8s %-12s %10s %-10s %4s %10s %14s\n", "kind", "variant", "count", "lookups", "hit", "ns/op", "ops/s");
+		printf("%-8s %-12s %10d %-10s %4d %10.2f %14.0f\n", kind, variant, count, dist, hit, ns, per_second);
+	}
+	s_rows++;
+}
+
+// times 'reps' runs of a build, the array may be rebuilt from its own output as only the time matters
+#define TIME_BUILD(kind, variant, build) do { \
+		start = clock(); \
+		for (int r = 0; r<reps; r++) \
+			build; \
+		Report(kind, variant, count, "-", 0, Seconds(start), count*reps); \
+	} while (0)
+
+static int Regular(int value, const int *sorted_array, int count) { return RegularBinarySearch(value, (int*)sorted_array, count); }
+static int Shuffled(int value, const int *shuffled_array, int count) { return ShuffledBinarySearch(value, (int*)shuffled_array, count); }
+
+#define LAYOUT_SORTED 0
+#define LAYOUT_SHUFFLED 1
+#define LAYOUT_BLOCK 2
+#define LAYOUT_EYTZINGER 3
+#define LAYOUT_HYBRID 4
+#define LAYOUTS 5
+
+typedef struct {
+	const char *name;
+	ShuffledSearchFunc search;	// NULL for the batch search
+	int layout;
+} SearchVariant;
+
+int main(int argc, char **argv)
+{
+	int min_log2 = 10, max_log2 = 24;
+	int lookups = 200000;
+	int only_hit = -1;
+	const char *only_dist = NULL;
+	for (int a = 1; a<argc; a++) {
+		if (!strcmp(argv[a], "-min") && a+1<argc)
+			min_log2 = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-max") && a+1<argc)
+			max_log2 = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-lookups") && a+1<argc)
+			lookups = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-hit") && a+1<argc)
+			only_hit = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-dist") && a+1<argc)
+			only_dist = argv[++a];
+		else if (!strcmp(argv[a], "-csv"))
+			s_format = FORMAT_CSV;
+		else if (!strcmp(argv[a], "-json"))
+			s_format = FORMAT_JSON;
+		else {
+			printf("usage: bench_binsearchshuffle [-min log2] [-max log2] [-lookups n] [-hit percent] [-dist uniform|zipf|sequential] [-csv|-json]\n");
+			return 1;
+		}
+	}
+	if (min_log2<1 || max_log2>30 || min_log2>max_log2 || lookups<1) {
+		printf("sizes must be 2^1 to 2^30 values and lookups at least 1\n");
+		return 1;
+	}
+
+	SearchVariant variants[16];
+	int nvariants = 0;
+	variants[nvariants].name = "regular"; variants[nvariants].search = Regular; variants[nvariants++].layout = LAYOUT_SORTED;
+	variants[nvariants].name = "shuffled"; variants[nvariants].search = Shuffled; variants[nvariants++].layout = LAYOUT_SHUFFLED;
+	variants[nvariants].name = "branchless"; variants[nvariants].search = ShuffledBinarySearchBranchless; variants[nvariants++].layout = LAYOUT_SHUFFLED;
+#if defined(SHUFFLE_NEON)
+	variants[nvariants].name = "neon"; variants[nvariants].search = ShuffledBinarySearchNEON; variants[nvariants++].layout = LAYOUT_SHUFFLED;
+#endif
+	variants[nvariants].name = "fast"; variants[nvariants].search = ShuffledBinarySearchFast; variants[nvariants++].layout = LAYOUT_SHUFFLED;
+	variants[nvariants].name = "batch"; variants[nvariants].search = NULL; variants[nvariants++].layout = LAYOUT_SHUFFLED;
+	variants[nvariants].name = "block"; variants[nvariants].search = BlockShuffledBinarySearch; variants[nvariants++].layout = LAYOUT_BLOCK;
+	variants[nvariants].name = "eytzinger"; variants[nvariants].search = EytzingerBinarySearch; variants[nvariants++].layout = LAYOUT_EYTZINGER;
+	variants[nvariants].name = "hybrid"; variants[nvariants].search = HybridShuffledBinarySearch; variants[nvariants++].layout = LAYOUT_HYBRID;
+
+	static const char *dists[3] = { "uniform", "zipf", "sequential" };
+	static const int hits[2] = { 100, 50 };
+
+	int max_count = 1<<max_log2;
+	int *arrays[LAYOUTS];
+	int ok = 1;
+	for (int l = 0; l<LAYOUTS; l++)
+		ok &= (arrays[l] = (int*)malloc((l==LAYOUT_BLOCK ? BlockShuffledArraySize(max_count) : max_count) * sizeof(int)))!=NULL;
+	int *scratch = (int*)malloc(max_count * sizeof(int));
+	int *values = (int*)malloc(lookups * sizeof(int));
+	int *indices = (int*)malloc(lookups * sizeof(int));
+	uint64_t *wide = (uint64_t*)malloc(max_count * sizeof(uint64_t));	// sorted values for the packed array
+	ShuffledPacked packed;
+	memset(&packed, 0, sizeof(packed));
+	ShuffledRadix radix;
+	radix.table = NULL;
+	if (!ok || !scratch || !values || !indices || !wide) {
+		printf("Not enough memory for 2^%d values\n", max_log2);
+		return 1;
+	}
+	int *sorted = arrays[LAYOUT_SORTED];
+
+	for (int log2 = min_log2; log2<=max_log2; log2++) {
+		int count = 1<<log2;
+		// values are even so odd values miss
+		for (int i = 0; i<count; i++)
+			sorted[i] = i*2;
+
+		// builds, each layout is built from the sorted array, small arrays are built
+		// several times for about 'lookups' values in total
+		int reps = count<lookups ? lookups/count : 1;
+		clock_t start;
+		memcpy(arrays[LAYOUT_SHUFFLED], sorted, count * sizeof(int));
+		TIME_BUILD("build", "shuffle", ShuffleSortedArray(arrays[LAYOUT_SHUFFLED], count));
+		TIME_BUILD("build", "shuffle-copy", ShuffleSortedArrayCopy(scratch, sorted, count));
+		TIME_BUILD("unshuffle", "shuffle", SortShuffledArray(scratch, count));
+		ShuffleSortedArrayCopy(arrays[LAYOUT_SHUFFLED], sorted, count);
+		TIME_BUILD("unshuffle", "shuffle-copy", SortShuffledArrayCopy(scratch, arrays[LAYOUT_SHUFFLED], count));
+
+		// scrambled input for the build from unsorted values, restored before each build
+		int *unsorted = arrays[LAYOUT_HYBRID];
+		for (int i = 0; i<count; i++)
+			unsorted[i] = sorted[(int)(((unsigned long long)i * 2654435761u) % (unsigned int)count)];
+		double build_seconds = 0;
+		for (int r = 0; r<reps; r++) {
+			memcpy(arrays[LAYOUT_EYTZINGER], unsorted, count * sizeof(int));
+			start = clock();
+			BuildShuffledArrayScratch(arrays[LAYOUT_EYTZINGER], count, scratch, 0);
+			build_seconds += Seconds(start);
+		}
+		Report("build", "radix-build", count, "-", 0, build_seconds, count*reps);
+
+		TIME_BUILD("build", "block", BlockShuffleSortedArray(arrays[LAYOUT_BLOCK], sorted, count));
+		memcpy(arrays[LAYOUT_EYTZINGER], sorted, count * sizeof(int));
+		TIME_BUILD("build", "eytzinger", EytzingerShuffleSortedArray(arrays[LAYOUT_EYTZINGER], count));
+		TIME_BUILD("unshuffle", "eytzinger", EytzingerSortShuffledArray(arrays[LAYOUT_EYTZINGER], count));
+		memcpy(arrays[LAYOUT_EYTZINGER], sorted, count * sizeof(int));
+		EytzingerShuffleSortedArray(arrays[LAYOUT_EYTZINGER], count);
+		memcpy(arrays[LAYOUT_HYBRID], sorted, count * sizeof(int));
+		TIME_BUILD("build", "hybrid", HybridShuffleSortedArray(arrays[LAYOUT_HYBRID], count));
+		TIME_BUILD("unshuffle", "hybrid", HybridSortShuffledArray(arrays[LAYOUT_HYBRID], count));
+		memcpy(arrays[LAYOUT_HYBRID], sorted, count * sizeof(int));
+		HybridShuffleSortedArray(arrays[LAYOUT_HYBRID], count);
+		for (int i = 0; i<count; i++)
+			wide[i] = (uint64_t)sorted[i];
+		TIME_BUILD("build", "packed", { ShuffledPackedFree(&packed); ShuffledPackedBuild(&packed, wide, count); });
+		TIME_BUILD("build", "radix-entry", { ShuffledRadixFree(&radix); ShuffledRadixInit(&radix, arrays[LAYOUT_SHUFFLED], count, 0); });
+
+		for (int d = 0; d<3; d++) {
+			if (only_dist && strcmp(only_dist, dists[d]))
+				continue;
+			for (int h = 0; h<2; h++) {
+				int hit = only_hit>=0 ? only_hit : hits[h];
+				if (only_hit>=0 && h)
+					break;
+				s_seed = 1;
+				for (int i = 0; i<lookups; i++) {
+					int index = d==0 ? (int)(Random() % (unsigned int)count) : (d==1 ? ZipfIndex(count) : i % count);
+					values[i] = index*2 + ((int)(Random() % 100)>=hit);	// odd misses
+				}
+				int expected = -1;
+				for (int v = 0; v<nvariants; v++) {
+					const int *array = arrays[variants[v].layout];
+					int found = 0;
+					start = clock();
+					if (variants[v].search) {
+						ShuffledSearchFunc search = variants[v].search;
+						for (int i = 0; i<lookups; i++)
+							found += search(values[i], array, count)>=0;
+					} else {
+						ShuffledBinarySearchBatch(values, lookups, array, count, indices);
+						for (int i = 0; i<lookups; i++)
+							found += indices[i]>=0;
+					}
+					double seconds = Seconds(start);
+					s_sink = found;
+					if (expected<0)
+						expected = found;
+					else if (found!=expected)
+						fprintf(stderr, "%s found %d values, regular found %d (count %d, %s)\n", variants[v].name, found, expected, count, dists[d]);
+					Report("search", variants[v].name, count, dists[d], hit, seconds, lookups);
+				}
+				// the packed array holds the same values as uint64_t
+				int found = 0;
+				start = clock();
+				for (int i = 0; i<lookups; i++)
+					found += ShuffledPackedSearch((uint64_t)values[i], &packed)>=0;
+				double seconds = Seconds(start);
+				s_sink = found;
+				if (found!=expected)
+					fprintf(stderr, "packed found %d values, regular found %d (count %d, %s)\n", found, expected, count, dists[d]);
+				Report("search", "packed", count, dists[d], hit, seconds, lookups);
+				// the shuffled array entered through the radix table
+				found = 0;
+				start = clock();
+				for (int i = 0; i<lookups; i++)
+					found += ShuffledRadixSearch(values[i], &radix, arrays[LAYOUT_SHUFFLED], count)>=0;
+				seconds = Seconds(start);
+				s_sink = found;
+				if (found!=expected)
+					fprintf(stderr, "radix-entry found %d values, regular found %d (count %d, %s)\n", found, expected, count, dists[d]);
+				Report("search", "radix-entry", count, dists[d], hit, seconds, lookups);
+			}
+		}
+	}
+	if (s_format==FORMAT_JSON)
+		printf("%s]\n", s_rows ? "\n" : "[");
+
+	ShuffledPackedFree(&packed);
+	ShuffledRadixFree(&radix);
+	free(wide);
+	free(indices);
+	free(values);
+	free(scratch);
+	for (int l = 0; l<LAYOUTS; l++)
+		free(arrays[l]);
+	return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_coro.hpp"
+
+// Compares the plain ShuffledBinarySearch loop with coroutine searches on the
+// round robin executor for increasing array sizes. The lookups are split over
+// 'width' request coroutines that each search their values one after the
+// other, so 'width' searches are in flight at a time, and the batch search is
+// there as the best case of interleaving without coroutines.
+// usage: bench_binsearchshuffle_coro [options]
+//	-min <log2>		smallest array, default 10 (4 KB)
+//	-max <log2>		largest array, default 24 (64 MB)
+//	-lookups <n>	lookups per measurement, default 1000000
+//	-width <n>		requests in flight, default runs 8, 32, 128 and 512
+// Needs C++20, compile it with the library sources compiled as C.
+
+static double Seconds(clock_t start)
+{
+	return (double)(clock()-start) / CLOCKS_PER_SEC;
+}
+
+static unsigned int s_seed = 1;
+static unsigned int Random()
+{
+	s_seed ^= s_seed<<13;
+	s_seed ^= s_seed>>17;
+	s_seed ^= s_seed<<5;
+	return s_seed;
+}
+
+static void Report(const char *variant, int count, int width, double seconds, int lookups)
+{
+	static int rows = 0;
+	if (!rows++)
+		printf("%-10s %10s %6s %10s %14s\n", "variant", "count", "width", "ns/op", "ops/s");
+	printf("%-10s %10d %6d %10.2f %14.0f\n", variant, count, width, seconds*1e9/lookups, seconds>0 ? lookups/seconds : 0);
+}
+
+static shuffle::task<void> Request(shuffle::round_robin_executor &executor, const int *shuffled, int count, const int *values, int nvalues, int stride, int *out)
+{
+	for (int i = 0; i<nvalues; i += stride)
+		out[i] = co_await shuffle::shuffled_search(executor, values[i], shuffled, count);
+}
+
+int main(int argc, char **argv)
+{
+	int min_log2 = 10, max_log2 = 24;
+	int lookups = 1000000;
+	int only_width = 0;
+	for (int a = 1; a<argc; a++) {
+		if (!strcmp(argv[a], "-min") && a+1<argc)
+			min_log2 = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-max") && a+1<argc)
+			max_log2 = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-lookups") && a+1<argc)
+			lookups = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-width") && a+1<argc)
+			only_width = atoi(argv[++a]);
+		else {
+			printf("usage: bench_binsearchshuffle_coro [-min log2] [-max log2] [-lookups n] [-width n]\n");
+			return 1;
+		}
+	}
+	if (min_log2<1 || max_log2>30 || min_log2>max_log2 || lookups<1 || only_width<0) {
+		printf("sizes must be 2^1 to 2^30 values and lookups at least 1\n");
+		return 1;
+	}
+	static const int widths[4] = { 8, 32, 128, 512 };
+
+	std::vector<int> shuffled((std::size_t)1<<max_log2), values(lookups), expected(lookups), found(lookups);
+	for (int log2 = min_log2; log2<=max_log2; log2++) {
+		int count = 1<<log2;
+		// even values so half the lookups miss
+		for (int i = 0; i<count; i++)
+			shuffled[i] = i*2;
+		ShuffleSortedArray(shuffled.data(), count);
+		for (int i = 0; i<lookups; i++)
+			values[i] = (int)(Random() % (2u*count));
+
+		clock_t start = clock();
+		for (int i = 0; i<lookups; i++)
+			expected[i] = ShuffledBinarySearch(values[i], shuffled.data(), count);
+		Report("plain", count, 1, Seconds(start), lookups);
+
+		start = clock();
+		ShuffledBinarySearchBatch(values.data(), lookups, shuffled.data(), count, found.data());
+		Report("batch", count, 0, Seconds(start), lookups);
+
+		for (int w = 0; w<4; w++) {
+			int width = only_width ? only_width : widths[w];
+			if (only_width && w)
+				break;
+			shuffle::round_robin_executor executor;
+			start = clock();
+			for (int r = 0; r<width && r<lookups; r++)
+				executor.spawn(Request(executor, shuffled.data(), count, values.data()+r, lookups-r, width, found.data()+r));
+			executor.run();
+			Report("coroutine", count, width, Seconds(start), lookups);
+			if (!std::equal(expected.begin(), expected.end(), found.begin()))
+				fprintf(stderr, "coroutine searches found other indices than ShuffledBinarySearch (count %d, width %d)\n", count, width);
+		}
+	}
+	return 0;
+}
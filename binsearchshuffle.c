@@ -119,6 +119,8 @@ that.
 - int InsertShuffledArrayValue(int value, int *shuffled_array, int count)
 	Inserts a value into a shuffled array, checks for duplicate, returns
 	new count.
+- int InsertShuffledArrayValueMulti(int value, int *shuffled_array, int count)
+	Inserts a value after the values equal to it, returns new count.
 
 Initially the idea was to just use qsort or something on the shuffled array but
 the difference in performance between shuffling an array and sorting it is just
@@ -129,6 +131,13 @@ for the array to grow. Check the return value from Remove and Insert since it
 is valid that the count does not change (Removing a value that doesn't exist or
 Inserting a duplicate value would result in 'count' not changing).
 
+Repeated values
+
+The layout works the same with repeated values, but ShuffledBinarySearch
+returns any one of the equal values. ShuffledEqualRange returns the linear
+range of all of them and ShuffledCount the number. RemoveShuffledArrayValue
+removes one of them.
+
 Test code
 
 There is a bit of trivial test code that creates randomized arrays, sorts and
@@ -143,10 +152,14 @@ or even a shuffled binary search.
 
 #include <string.h>
 #include "binsearchshuffle.h"
+#include "binsearchshuffle_internal.h"
+#include "binsearchshuffle_stats.h"
 
 #define MAX_SHUFFLE_COUNT_LOG2 64
 void ShuffleSortedArray(int *array, int count)
 {
+	SHUFFLE_STATS_ENTER(SHUFFLE_STATS_SHUFFLE);
+	SHUFFLE_STATS_COUNTER(moved);
 	// each halfing splits the array in two, but only the upper half needs to go on the stack
 	// the lower half is the next step of iteration
 	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
@@ -219,6 +232,7 @@ void ShuffleSortedArray(int *array, int count)
 				// count > 8, rotate right first half elements, push second half of elements on the stack
 				tmp = array[first+count/2];
 				memmove(&array[first+1], &array[first], sizeof(array[0]) * (count/2));
+				SHUFFLE_STATS_ADD(moved, sizeof(array[0]) * (count/2));
 				array[first] = tmp;
 				first++;
 				aStack[stk].first = first+count/2;
@@ -228,16 +242,21 @@ void ShuffleSortedArray(int *array, int count)
 				break;
 		}
 	}
+	SHUFFLE_STATS_LEAVE(0, moved);
 }
 
 int ShuffledBinarySearch(int value, int *shuffled_array, int count)
 {
+	SHUFFLE_STATS_ENTER(SHUFFLE_STATS_SEARCH);
+	SHUFFLE_STATS_COUNTER(steps);
 	int index = 0;
 	while (count) {
 		int read = shuffled_array[index];
-		if (value==read)
+		SHUFFLE_STATS_ADD(steps, 1);
+		if (value==read) {
+			SHUFFLE_STATS_LEAVE(steps, 0);
 			return index;		// index into shuffled array where value is found
-		else if (value>read) {
+		} else if (value>read) {
 			index += count/2+1;
 			count = (count-1)/2;
 		} else {
@@ -245,6 +264,7 @@ int ShuffledBinarySearch(int value, int *shuffled_array, int count)
 			count /= 2;
 		}
 	}
+	SHUFFLE_STATS_LEAVE(steps, 0);
 	return -1;	// index not found
 }
 
@@ -272,9 +292,145 @@ int DeshuffleIndex(int index, int count)
 	return d;
 }
 
+// Lower and upper bound search the same way as ShuffledBinarySearch but do not
+// stop at a match. The linear index of the first value in the current block is
+// kept, stepping into the upper half skips the lower half and the current value.
+int ShuffledLowerBound(int value, const int *shuffled_array, int count)
+{
+	int index = 0;
+	int first = 0;		// linear index of the first value in the current block
+	while (count) {
+		if (shuffled_array[index]<value) {
+			first += count/2+1;
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	return first;	// linear index of the first value not less than 'value'
+}
+
+int ShuffledUpperBound(int value, const int *shuffled_array, int count)
+{
+	int index = 0;
+	int first = 0;
+	while (count) {
+		if (shuffled_array[index]<=value) {
+			first += count/2+1;
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	return first;	// linear index of the first value greater than 'value'
+}
+
+int ShuffledRange(int min_value, int max_value, const int *shuffled_array, int count, int *first, int *end)
+{
+	*first = ShuffledLowerBound(min_value, shuffled_array, count);
+	*end = max_value<min_value ? *first : ShuffledUpperBound(max_value, shuffled_array, count);
+	return *end - *first;
+}
+
+// The search is the same as ShuffledBinarySearch until it reads an equal value,
+// then the equal values before it are in its lower half and the ones after it in
+// its upper half, and both halves are shuffled arrays of their own.
+int ShuffledEqualRange(int value, const int *shuffled_array, int count, int *first, int *end)
+{
+	int index = 0;
+	int block_first = 0;
+	while (count) {
+		int read = shuffled_array[index];
+		if (read<value) {
+			block_first += count/2+1;
+			index += count/2+1;
+			count = (count-1)/2;
+		} else if (read>value) {
+			index++;
+			count /= 2;
+		} else {
+			*first = block_first + ShuffledLowerBound(value, shuffled_array+index+1, count/2);
+			*end = block_first+count/2+1 + ShuffledUpperBound(value, shuffled_array+index+count/2+1, (count-1)/2);
+			return *end - *first;
+		}
+	}
+	*first = *end = block_first;
+	return 0;
+}
+
+int ShuffledCount(int value, const int *shuffled_array, int count)
+{
+	int first, end;
+	return ShuffledEqualRange(value, shuffled_array, count, &first, &end);
+}
+
+// The iterator is an in-order walk of the tree. The stack holds the blocks
+// whose middle value is still to come, the top of the stack is the next value.
+static void ShuffledIteratorPushLower(ShuffledIterator *it, int index, int count)
+{
+	while (count) {
+		it->stack[it->stk].index = index;
+		it->stack[it->stk].count = count;
+		it->stk++;
+		index++;
+		count /= 2;
+	}
+}
+
+void ShuffledIteratorBegin(ShuffledIterator *it, const int *shuffled_array, int count, int first, int end)
+{
+	it->shuffled_array = shuffled_array;
+	it->stk = 0;
+	if (first<0)
+		first = 0;
+	if (end>count)
+		end = count;
+	it->left = end>first ? end-first : 0;
+
+	// find the block with the linear index 'first' as the middle value, on the
+	// way down the blocks that are stepped into the lower half of are pushed
+	int index = 0;
+	int block_first = 0;
+	while (count && it->left) {
+		int middle = block_first + count/2;
+		if (first<=middle) {
+			it->stack[it->stk].index = index;
+			it->stack[it->stk].count = count;
+			it->stk++;
+			if (first==middle)
+				break;
+			index++;
+			count /= 2;
+		} else {
+			block_first = middle+1;
+			index += count/2+1;
+			count = (count-1)/2;
+		}
+	}
+}
+
+int ShuffledIteratorNext(ShuffledIterator *it)
+{
+	if (!it->left || !it->stk)
+		return -1;	// end of range
+	it->left--;
+	it->stk--;
+	int index = it->stack[it->stk].index;
+	int count = it->stack[it->stk].count;
+	// next is the smallest value of the upper half
+	ShuffledIteratorPushLower(it, index + count/2+1, (count-1)/2);
+	return index;
+}
+
 // Reverse ShuffleSortedArray
 void SortShuffledArray(int *array, int count)
 {
+	SHUFFLE_STATS_ENTER(SHUFFLE_STATS_SORT);
+	SHUFFLE_STATS_COUNTER(moved);
 	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
 	int stk = 0;
 
@@ -331,6 +487,7 @@ void SortShuffledArray(int *array, int count)
 				// count >= 8, rotate left first half elements, push second half of elements on the stack
 				tmp = array[first];
 				memmove(&array[first], &array[first+1], sizeof(array[0]) * (count/2));
+				SHUFFLE_STATS_ADD(moved, sizeof(array[0]) * (count/2));
 				array[first+count/2] = tmp;
 				first;
 				aStack[stk].first = first+1+count/2;
@@ -340,6 +497,124 @@ void SortShuffledArray(int *array, int count)
 				break;
 		}
 	}
+	SHUFFLE_STATS_LEAVE(0, moved);
+}
+
+// Shuffle and sort with a second array. The shuffled array is the pre-order of
+// the tree so it can be written from the start to the end while reading the
+// middle value of each block from the sorted array, only the upper halves of
+// the blocks need to go on the stack. Each value is moved once so this is O(n)
+// and is limited by memory bandwidth rather than by moving the lower halves at
+// each level like ShuffleSortedArray. Blocks of up to SHUFFLE_COPY_LEAF values
+// are copied with a table of the shuffled order instead of walking them.
+// Note that memmove is very fast so ShuffleSortedArray is about as fast while
+// the array fits in the last level cache, this is for larger arrays.
+#define SHUFFLE_COPY_LEAF 16
+static const unsigned char s_leaf_order[SHUFFLE_COPY_LEAF+1][SHUFFLE_COPY_LEAF] = {
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 2, 1, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 2, 1, 0, 4, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 3, 1, 0, 2, 5, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 3, 1, 0, 2, 5, 4, 6, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 4, 2, 1, 0, 3, 6, 5, 7, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 4, 2, 1, 0, 3, 7, 6, 5, 8, 0, 0, 0, 0, 0, 0, 0 },
+	{ 5, 2, 1, 0, 4, 3, 8, 7, 6, 9, 0, 0, 0, 0, 0, 0 },
+	{ 5, 2, 1, 0, 4, 3, 8, 7, 6, 10, 9, 0, 0, 0, 0, 0 },
+	{ 6, 3, 1, 0, 2, 5, 4, 9, 8, 7, 11, 10, 0, 0, 0, 0 },
+	{ 6, 3, 1, 0, 2, 5, 4, 10, 8, 7, 9, 12, 11, 0, 0, 0 },
+	{ 7, 3, 1, 0, 2, 5, 4, 6, 11, 9, 8, 10, 13, 12, 0, 0 },
+	{ 7, 3, 1, 0, 2, 5, 4, 6, 11, 9, 8, 10, 13, 12, 14, 0 },
+	{ 8, 4, 2, 1, 0, 3, 6, 5, 7, 12, 10, 9, 11, 14, 13, 15 },
+};
+
+void ShuffleSortedArrayCopy(int *shuffled_array, const int *sorted_array, int count)
+{
+	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int first = 0;		// current block in sorted_array
+	int index = 0;		// next shuffled index
+
+	while (count || stk) {
+		if (!count) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+		}
+		if (count<=2*SHUFFLE_COPY_LEAF+1) {	// middle value and two blocks from the table
+			int lower = count/2, upper = (count-1)/2;
+			const unsigned char *order = s_leaf_order[lower];
+			SHUFFLE_PREFETCH(sorted_array+first+512);	// the blocks are read in order, stay ahead
+			shuffled_array[index++] = sorted_array[first+lower];
+			for (int i = 0; i<lower; i++)
+				shuffled_array[index+i] = sorted_array[first+order[i]];
+			index += lower;
+			first += lower+1;
+			order = s_leaf_order[upper];
+			for (int i = 0; i<upper; i++)
+				shuffled_array[index+i] = sorted_array[first+order[i]];
+			index += upper;
+			count = 0;
+		} else {
+			shuffled_array[index++] = sorted_array[first+count/2];
+			aStack[stk].first = first+count/2+1;
+			aStack[stk].count = (count-1)/2;
+			stk++;
+			count /= 2;
+		}
+	}
+}
+
+void SortShuffledArrayCopy(int *sorted_array, const int *shuffled_array, int count)
+{
+	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int first = 0;
+	int index = 0;
+
+	while (count || stk) {
+		if (!count) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+		}
+		if (count<=2*SHUFFLE_COPY_LEAF+1) {
+			int lower = count/2, upper = (count-1)/2;
+			const unsigned char *order = s_leaf_order[lower];
+			sorted_array[first+lower] = shuffled_array[index++];
+			for (int i = 0; i<lower; i++)
+				sorted_array[first+order[i]] = shuffled_array[index+i];
+			index += lower;
+			first += lower+1;
+			order = s_leaf_order[upper];
+			for (int i = 0; i<upper; i++)
+				sorted_array[first+order[i]] = shuffled_array[index+i];
+			index += upper;
+			count = 0;
+		} else {
+			sorted_array[first+count/2] = shuffled_array[index++];
+			aStack[stk].first = first+count/2+1;
+			aStack[stk].count = (count-1)/2;
+			stk++;
+			count /= 2;
+		}
+	}
+}
+
+// same as ShuffleSortedArray and SortShuffledArray but O(n), scratch must be
+// room for 'count' ints.
+void ShuffleSortedArrayScratch(int *array, int count, int *scratch)
+{
+	memcpy(scratch, array, count * sizeof(int));
+	ShuffleSortedArrayCopy(array, scratch, count);
+}
+
+void SortShuffledArrayScratch(int *array, int count, int *scratch)
+{
+	memcpy(scratch, array, count * sizeof(int));
+	SortShuffledArrayCopy(array, scratch, count);
 }
 
 // Removes a value from a shuffled array by first detecting the value,
@@ -394,6 +669,198 @@ int InsertShuffledArrayValue(int value, int *shuffled_array, int count)
 	return count;
 }
 
+// Inserts a value after the values equal to it, the same as
+// InsertShuffledArrayValue without the check for a duplicate. Caller is
+// responsible for making sure there is room for one more int. Returns new count.
+int InsertShuffledArrayValueMulti(int value, int *shuffled_array, int count)
+{
+	int index = ShuffledUpperBound(value, shuffled_array, count);
+	SortShuffledArray(shuffled_array, count);
+	memmove(shuffled_array+index+1, shuffled_array+index, (count-index) * sizeof(int));
+	shuffled_array[index] = value;
+	count++;
+	ShuffleSortedArray(shuffled_array, count);
+	return count;
+}
+
+// 64-bit counts. Blocks are split with 64-bit arithmetic until they have at most
+// SHUFFLE_MAX_INT_COUNT values and then the int versions do the rest of the
+// block, so an array of 2^32 values takes one or two 64-bit steps and the int
+// functions are used as they are for smaller arrays.
+#ifndef SHUFFLE_MAX_INT_COUNT
+#define SHUFFLE_MAX_INT_COUNT 0x7fffffff
+#endif
+
+void ShuffleSortedArray64(int *array, int64_t count)
+{
+	struct { int64_t first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int64_t first = 0;
+
+	for (;;) {
+		if (count<=SHUFFLE_MAX_INT_COUNT) {
+			ShuffleSortedArray(array+first, (int)count);
+			if (!stk)
+				break;
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			continue;
+		}
+		int tmp = array[first+count/2];
+		memmove(&array[first+1], &array[first], sizeof(array[0]) * (size_t)(count/2));
+		array[first] = tmp;
+		first++;
+		aStack[stk].first = first+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count /= 2;
+	}
+}
+
+void SortShuffledArray64(int *array, int64_t count)
+{
+	struct { int64_t first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int64_t first = 0;
+
+	for (;;) {
+		if (count<=SHUFFLE_MAX_INT_COUNT) {
+			SortShuffledArray(array+first, (int)count);
+			if (!stk)
+				break;
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			continue;
+		}
+		int tmp = array[first];
+		memmove(&array[first], &array[first+1], sizeof(array[0]) * (size_t)(count/2));
+		array[first+count/2] = tmp;
+		aStack[stk].first = first+1+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count /= 2;
+	}
+}
+
+int64_t ShuffledBinarySearch64(int value, const int *shuffled_array, int64_t count)
+{
+	int64_t index = 0;
+	while (count>SHUFFLE_MAX_INT_COUNT) {
+		int read = shuffled_array[index];
+		if (value==read)
+			return index;
+		else if (value>read) {
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	int found = ShuffledBinarySearchFast(value, shuffled_array+index, (int)count);
+	return found<0 ? -1 : index+found;
+}
+
+int64_t DeshuffleIndex64(int64_t index, int64_t count)
+{
+	if (index<0 || index>=count)
+		return -1;
+	int64_t first = 0;	// linear index of the first value in the block
+	while (count>SHUFFLE_MAX_INT_COUNT) {
+		if (!index)
+			return first+count/2;
+		if (index>count/2) {
+			index -= count/2+1;
+			first += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index--;
+			count /= 2;
+		}
+	}
+	return first + DeshuffleIndex((int)index, (int)count);
+}
+
+// Applies a sorted batch of removes and then a sorted batch of inserts with one
+// unshuffle, one merge pass and one reshuffle. Removes that are not in the array
+// and inserts that already are (or repeat) are skipped, with 'multi' every insert
+// is added after the equal values and each remove takes out one equal value. The
+// array needs room for count+ninserts ints. With scratch (room for count+ninserts
+// ints) the unshuffle and reshuffle are the O(n) copies and the merge is forward
+// into the array, without it the merge is in-place: removes are compacted forward
+// and inserts are merged backward from the end. Returns new count.
+static int BulkUpdate(int *shuffled_array, int count, const int *inserts, int ninserts, const int *removes, int nremoves, int *scratch, int multi)
+{
+	int *sorted = scratch ? scratch : shuffled_array;
+	if (scratch)
+		SortShuffledArrayCopy(scratch, shuffled_array, count);
+	else
+		SortShuffledArray(shuffled_array, count);
+
+	int kept = 0;
+	for (int i = 0, r = 0; i<count; i++) {
+		while (r<nremoves && removes[r]<sorted[i])
+			r++;
+		if (r==nremoves || removes[r]!=sorted[i])
+			sorted[kept++] = sorted[i];
+		else if (multi)
+			r++;
+	}
+
+	if (scratch) {
+		int n = 0, i = 0, j = 0;
+		while (i<kept || j<ninserts) {
+			if (!multi && j && j<ninserts && inserts[j]==inserts[j-1])
+				j++;
+			else if (j==ninserts || (i<kept && (multi ? sorted[i]<=inserts[j] : sorted[i]<inserts[j])))
+				shuffled_array[n++] = sorted[i++];
+			else if (!multi && i<kept && sorted[i]==inserts[j])
+				j++;
+			else
+				shuffled_array[n++] = inserts[j++];
+		}
+		ShuffleSortedArrayScratch(shuffled_array, n, scratch);
+		return n;
+	}
+
+	// count the new values to know where the backward merge ends
+	int added = multi ? ninserts : 0;
+	for (int i = 0, j = 0; !multi && j<ninserts; j++) {
+		if (j && inserts[j]==inserts[j-1])
+			continue;
+		while (i<kept && sorted[i]<inserts[j])
+			i++;
+		if (i==kept || sorted[i]!=inserts[j])
+			added++;
+	}
+	int k = kept+added-1;
+	for (int i = kept-1, j = ninserts-1; j>=0;) {
+		if (!multi && j+1<ninserts && inserts[j]==inserts[j+1])
+			j--;
+		else if (i>=0 && sorted[i]>inserts[j])
+			sorted[k--] = sorted[i--];
+		else if (!multi && i>=0 && sorted[i]==inserts[j])
+			j--;
+		else
+			sorted[k--] = inserts[j--];
+	}
+	count = kept+added;
+	ShuffleSortedArray(shuffled_array, count);
+	return count;
+}
+
+int ShuffledArrayBulkUpdate(int *shuffled_array, int count, const int *inserts, int ninserts, const int *removes, int nremoves, int *scratch)
+{
+	return BulkUpdate(shuffled_array, count, inserts, ninserts, removes, nremoves, scratch, 0);
+}
+
+int ShuffledArrayBulkUpdateMulti(int *shuffled_array, int count, const int *inserts, int ninserts, const int *removes, int nremoves, int *scratch)
+{
+	return BulkUpdate(shuffled_array, count, inserts, ninserts, removes, nremoves, scratch, 1);
+}
+
 int RegularBinarySearch(int value, int *sorted_array, int end)
 {
     int first = 0;
@@ -411,5 +878,297 @@ int RegularBinarySearch(int value, int *sorted_array, int end)
     return -1;	// index not found
 }
 
+// Key types other than int, see binsearchshuffle_type.h
+#define SHUFFLE_KEY int32_t
+#define SHUFFLE_NAME(name) name##_i32
+#include "binsearchshuffle_type.h"
+
+#define SHUFFLE_KEY uint32_t
+#define SHUFFLE_NAME(name) name##_u32
+#include "binsearchshuffle_type.h"
+
+#define SHUFFLE_KEY int64_t
+#define SHUFFLE_NAME(name) name##_i64
+#include "binsearchshuffle_type.h"
+
+#define SHUFFLE_KEY uint64_t
+#define SHUFFLE_NAME(name) name##_u64
+#include "binsearchshuffle_type.h"
+
+#define SHUFFLE_KEY float
+#define SHUFFLE_NAME(name) name##_f32
+#include "binsearchshuffle_type.h"
+
+#define SHUFFLE_KEY double
+#define SHUFFLE_NAME(name) name##_f64
+#include "binsearchshuffle_type.h"
+
+// Any element size, elements are moved as bytes so every count is handled by
+// rotating the lower half of each block instead of the small count swaps above.
+static void SwapElements(unsigned char *a, unsigned char *b, size_t size)
+{
+	unsigned char tmp[64];
+	while (size) {
+		size_t n = size<sizeof(tmp) ? size : sizeof(tmp);
+		memcpy(tmp, a, n);
+		memcpy(a, b, n);
+		memcpy(b, tmp, n);
+		a += n;
+		b += n;
+		size -= n;
+	}
+}
+
+// move the last of 'count' elements to the front (right) or the first to the back (left)
+static void RotateElements(unsigned char *array, size_t count, size_t size, int right)
+{
+	unsigned char tmp[64];
+	if (size<=sizeof(tmp)) {
+		if (right) {
+			memcpy(tmp, array + size * (count-1), size);
+			memmove(array + size, array, size * (count-1));
+			memcpy(array, tmp, size);
+		} else {
+			memcpy(tmp, array, size);
+			memmove(array, array + size, size * (count-1));
+			memcpy(array + size * (count-1), tmp, size);
+		}
+	} else if (right) {	// large elements are bubbled one swap at a time
+		for (size_t i = count-1; i>0; i--)
+			SwapElements(array + size * (i-1), array + size * i, size);
+	} else {
+		for (size_t i = 1; i<count; i++)
+			SwapElements(array + size * (i-1), array + size * i, size);
+	}
+}
+
+void ShuffleSortedArrayGeneric(void *array, int count, size_t size)
+{
+	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int first = 0;
+	unsigned char *bytes = (unsigned char*)array;
+
+	while (count>1 || stk) {
+		if (count<=1) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			if (count<=1)
+				continue;
+		}
+		// rotate right first half elements + the middle, push second half on the stack
+		RotateElements(bytes + size * first, count/2+1, size, 1);
+		first++;
+		aStack[stk].first = first+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count = count/2;
+	}
+}
+
+int ShuffledBinarySearchGeneric(const void *value, const void *shuffled_array, int count, size_t size, ShuffleCompareFunc compare)
+{
+	const unsigned char *bytes = (const unsigned char*)shuffled_array;
+	int index = 0;
+	while (count) {
+		int order = compare(value, bytes + size * index);
+		if (!order)
+			return index;
+		else if (order>0) {
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	return -1;
+}
+
+void SortShuffledArrayGeneric(void *array, int count, size_t size)
+{
+	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int first = 0;
+	unsigned char *bytes = (unsigned char*)array;
+
+	while (count>1 || stk) {
+		if (count<=1) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			if (count<=1)
+				continue;
+		}
+		// rotate left first half elements + the first, push second half on the stack
+		RotateElements(bytes + size * first, count/2+1, size, 0);
+		aStack[stk].first = first+1+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count = count/2;
+	}
+}
+
+int RemoveShuffledArrayValueGeneric(const void *value, void *shuffled_array, int count, size_t size, ShuffleCompareFunc compare)
+{
+	int index = ShuffledBinarySearchGeneric(value, shuffled_array, count, size, compare);
+	if (index>=0) {
+		unsigned char *bytes = (unsigned char*)shuffled_array;
+		SortShuffledArrayGeneric(shuffled_array, count, size);
+		int deshuf = DeshuffleIndex(index, count);
+		if (deshuf<(count-1))
+			memmove(bytes + size * deshuf, bytes + size * (deshuf+1), size * (count-1-deshuf));
+		count--;
+		ShuffleSortedArrayGeneric(shuffled_array, count, size);
+	}
+	return count;
+}
 
+int InsertShuffledArrayValueGeneric(const void *value, void *shuffled_array, int count, size_t size, ShuffleCompareFunc compare)
+{
+	int found = ShuffledBinarySearchGeneric(value, shuffled_array, count, size, compare);
+	if (found<0) {
+		unsigned char *bytes = (unsigned char*)shuffled_array;
+		SortShuffledArrayGeneric(shuffled_array, count, size);
+		int first = 0;
+		int end = count;
+		while (end!=first) {	// first value greater than 'value' is the insertion slot
+			int index = (first+end)/2;
+			if (compare(bytes + size * index, value)<0)
+				first = index+1;
+			else
+				end = index;
+		}
+		if (first<count)
+			memmove(bytes + size * (first+1), bytes + size * first, size * (count-first));
+		memcpy(bytes + size * first, value, size);
+		count++;
+		ShuffleSortedArrayGeneric(shuffled_array, count, size);
+	}
+	return count;
+}
+
+// Keys and values in one walk of the blocks, each rotation is done for the keys
+// and then for each value array, so the values are not moved more than the
+// keys and no index has to be deshuffled when looking up a value. The
+// rotations move O(n log n) bytes of each array, the Copy and Scratch versions
+// below write each key and value once.
+static void ShuffleKeysValues(int *keys, int count, void **values, const size_t *sizes, int arrays, int shuffle)
+{
+	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int first = 0;
+
+	while (count>1 || stk) {
+		if (count<=1) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			if (count<=1)
+				continue;
+		}
+		RotateElements((unsigned char*)(keys + first), count/2+1, sizeof(int), shuffle);
+		for (int a = 0; a<arrays; a++)
+			RotateElements((unsigned char*)values[a] + sizes[a] * first, count/2+1, sizes[a], shuffle);
+		if (shuffle)	// lower half after the middle value
+			first++;
+		aStack[stk].first = shuffle ? first+count/2 : first+1+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count = count/2;
+	}
+}
 
+void ShuffleSortedArrayValues(int *keys, int count, void **values, const size_t *sizes, int arrays)
+{
+	ShuffleKeysValues(keys, count, values, sizes, arrays, 1);
+}
+
+void SortShuffledArrayValues(int *keys, int count, void **values, const size_t *sizes, int arrays)
+{
+	ShuffleKeysValues(keys, count, values, sizes, arrays, 0);
+}
+
+// The same walk as ShuffleSortedArrayCopy for elements of any size, writes
+// each element once instead of rotating it at every level.
+static void CopyShuffleElements(unsigned char *to, const unsigned char *from, int count, size_t size, int shuffle)
+{
+	struct { int first, count; } aStack[MAX_SHUFFLE_COUNT_LOG2];
+	int stk = 0;
+	int first = 0;		// current block in sorted order
+	size_t index = 0;	// next shuffled index
+
+#define COPY_ELEMENT(sorted, shuffled) (shuffle ? \
+	memcpy(to + size * (shuffled), from + size * (sorted), size) : \
+	memcpy(to + size * (sorted), from + size * (shuffled), size))
+	while (count || stk) {
+		if (!count) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+		}
+		if (count<=2*SHUFFLE_COPY_LEAF+1) {
+			int lower = count/2, upper = (count-1)/2;
+			const unsigned char *order = s_leaf_order[lower];
+			COPY_ELEMENT((size_t)first+lower, index++);
+			for (int i = 0; i<lower; i++)
+				COPY_ELEMENT((size_t)first+order[i], index+i);
+			index += lower;
+			first += lower+1;
+			order = s_leaf_order[upper];
+			for (int i = 0; i<upper; i++)
+				COPY_ELEMENT((size_t)first+order[i], index+i);
+			index += upper;
+			count = 0;
+		} else {
+			COPY_ELEMENT((size_t)first+count/2, index++);
+			aStack[stk].first = first+count/2+1;
+			aStack[stk].count = (count-1)/2;
+			stk++;
+			count /= 2;
+		}
+	}
+#undef COPY_ELEMENT
+}
+
+void ShuffleSortedArrayValuesCopy(int *shuffled_keys, void **shuffled_values, const int *sorted_keys, const void **sorted_values, int count, const size_t *sizes, int arrays)
+{
+	ShuffleSortedArrayCopy(shuffled_keys, sorted_keys, count);
+	for (int a = 0; a<arrays; a++)
+		CopyShuffleElements((unsigned char*)shuffled_values[a], (const unsigned char*)sorted_values[a], count, sizes[a], 1);
+}
+
+void SortShuffledArrayValuesCopy(int *sorted_keys, void **sorted_values, const int *shuffled_keys, const void **shuffled_values, int count, const size_t *sizes, int arrays)
+{
+	SortShuffledArrayCopy(sorted_keys, shuffled_keys, count);
+	for (int a = 0; a<arrays; a++)
+		CopyShuffleElements((unsigned char*)sorted_values[a], (const unsigned char*)shuffled_values[a], count, sizes[a], 0);
+}
+
+// same as ShuffleSortedArrayValues and SortShuffledArrayValues but O(n), scratch
+// is int aligned with room for count*max(sizeof(int), largest size) bytes, the
+// keys go through it as ints before the values.
+void ShuffleSortedArrayValuesScratch(int *keys, int count, void **values, const size_t *sizes, int arrays, void *scratch)
+{
+	ShuffleSortedArrayScratch(keys, count, (int*)scratch);
+	for (int a = 0; a<arrays; a++) {
+		memcpy(scratch, values[a], sizes[a] * count);
+		CopyShuffleElements((unsigned char*)values[a], (const unsigned char*)scratch, count, sizes[a], 1);
+	}
+}
+
+void SortShuffledArrayValuesScratch(int *keys, int count, void **values, const size_t *sizes, int arrays, void *scratch)
+{
+	SortShuffledArrayScratch(keys, count, (int*)scratch);
+	for (int a = 0; a<arrays; a++) {
+		memcpy(scratch, values[a], sizes[a] * count);
+		CopyShuffleElements((unsigned char*)values[a], (const unsigned char*)scratch, count, sizes[a], 0);
+	}
+}
+
+void *ShuffledLookupValue(int key, const int *shuffled_keys, int count, const void *values, size_t size)
+{
+	int index = ShuffledBinarySearchFast(key, shuffled_keys, count);
+	return index>=0 ? (unsigned char*)values + size * index : NULL;
+}
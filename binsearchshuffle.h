@@ -1,15 +1,204 @@
 ﻿#ifndef __BINSHUFFLE_H__
 #define __BINSHUFFLE_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void ShuffleSortedArray(int *array, int count); // shuffle a sorted array
 int ShuffledBinarySearch(int value, int *shuffled_array, int count); // find the index of a value in a shuffled array
 int DeshuffleIndex(int index, int count); // convert a shuffled index into a linear index
 
+// linear indices of the first value not less and the first value greater than 'value' ('count' if none)
+int ShuffledLowerBound(int value, const int *shuffled_array, int count);
+int ShuffledUpperBound(int value, const int *shuffled_array, int count);
+// linear range [first, end) of the values from min_value to max_value, returns the number of values
+int ShuffledRange(int min_value, int max_value, const int *shuffled_array, int count, int *first, int *end);
+// arrays with repeated values, linear range [first, end) of the values equal to 'value', returns the number of values
+int ShuffledEqualRange(int value, const int *shuffled_array, int count, int *first, int *end);
+int ShuffledCount(int value, const int *shuffled_array, int count); // number of values equal to 'value'
+
+// walk the linear range [first, end) of a shuffled array in sorted order
+#define SHUFFLED_ITERATOR_DEPTH 32
+typedef struct ShuffledIterator {
+	const int *shuffled_array;
+	int left;	// values left in the range
+	int stk;
+	struct { int index, count; } stack[SHUFFLED_ITERATOR_DEPTH];
+} ShuffledIterator;
+void ShuffledIteratorBegin(ShuffledIterator *it, const int *shuffled_array, int count, int first, int end);
+int ShuffledIteratorNext(ShuffledIterator *it); // shuffled index of the next value, -1 at the end
+
 void SortShuffledArray(int *array, int count); // sort a shuffled array
+// 64-bit counts and indices for arrays of more than 2^31 values, the int versions do most of the work
+void ShuffleSortedArray64(int *array, int64_t count);
+int64_t ShuffledBinarySearch64(int value, const int *shuffled_array, int64_t count); // -1 if not found
+int64_t DeshuffleIndex64(int64_t index, int64_t count);
+void SortShuffledArray64(int *array, int64_t count);
+// O(n) shuffle and sort with a second array for large arrays
+void ShuffleSortedArrayCopy(int *shuffled_array, const int *sorted_array, int count); // shuffle into another array
+void SortShuffledArrayCopy(int *sorted_array, const int *shuffled_array, int count); // sort into another array
+void ShuffleSortedArrayScratch(int *array, int count, int *scratch); // scratch is room for 'count' ints
+void SortShuffledArrayScratch(int *array, int count, int *scratch);
+// multithreaded shuffle and sort, see binsearchshuffle_parallel.h
+// range partitioned shards on NUMA nodes, see binsearchshuffle_shard.h
+// search and shuffle counters with SHUFFLE_STATS, see binsearchshuffle_stats.h
+// arrays in huge page arena buffers, see binsearchshuffle_arena.h
+// sort and shuffle unsorted values with a radix sort, see binsearchshuffle_build.c
+#define SHUFFLE_BUILD_UNIQUE 1	// remove duplicate keys
+int BuildShuffledArray(int *unsorted, int count); // returns 'count'
+int BuildShuffledArrayScratch(int *unsorted, int count, int *scratch, int flags); // returns the number of keys left
+
 int RemoveShuffledArrayValue(int value, int *shuffled_array, int count); // returns updated 'count'
 int InsertShuffledArrayValue(int value, int *shuffled_array, int count); // returns updated 'count'
+int InsertShuffledArrayValueMulti(int value, int *shuffled_array, int count); // keeps duplicates, inserts after the equal values
+// sorted batches of removes then inserts with one merge, room for count+ninserts, scratch NULL or room for count+ninserts
+int ShuffledArrayBulkUpdate(int *shuffled_array, int count, const int *inserts, int ninserts, const int *removes, int nremoves, int *scratch); // returns updated 'count'
+int ShuffledArrayBulkUpdateMulti(int *shuffled_array, int count, const int *inserts, int ninserts, const int *removes, int nremoves, int *scratch); // keeps duplicates, a remove takes out one value
+
+// search variants without branches, see binsearchshuffle_simd.c
+typedef int (*ShuffledSearchFunc)(int value, const int *shuffled_array, int count);
+int ShuffledBinarySearchBranchless(int value, const int *shuffled_array, int count); // conditional moves instead of branches
+int ShuffledBinarySearchNEON(int value, const int *shuffled_array, int count); // 2 levels per step on ARM, the branchless search elsewhere
+int ShuffledBinarySearchFast(int value, const int *shuffled_array, int count); // NEON on ARM, ShuffledBinarySearch on other CPUs
+ShuffledSearchFunc ShuffledBinarySearchBest(void); // the function ShuffledBinarySearchFast calls
+
+// index conversion without branches, see binsearchshuffle_index.c
+int DeshuffleIndexBranchless(int index, int count); // same as DeshuffleIndex
+int ShuffleIndex(int linear, int count); // convert a linear index into a shuffled index (-1 if out of range)
+void DeshuffleIndices(const int *indices, int nindices, int count, int *out_linear); // DeshuffleIndex of each index
+void ShuffleIndices(const int *linear, int nindices, int count, int *out_indices); // ShuffleIndex of each index
+
+// radix table on the top bits of the values to start a search below the root, see binsearchshuffle_radix.c
+typedef struct ShuffledRadix {
+	int *table;		// shuffled index and count of the block each bucket starts at
+	int bits;		// 2^bits buckets
+	int shift;		// bucket of a value is (value-min)>>shift
+	int min, max;	// smallest and largest value
+} ShuffledRadix;
+int ShuffledRadixInit(ShuffledRadix *radix, const int *shuffled_array, int count, int bits); // bits 0 = from count, 0 if out of memory
+void ShuffledRadixFree(ShuffledRadix *radix);
+int ShuffledRadixSearch(int value, const ShuffledRadix *radix, const int *shuffled_array, int count); // same as ShuffledBinarySearch
+
+// search for many values at once with the memory reads overlapped, see binsearchshuffle_batch.c
+void ShuffledBinarySearchBatch(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices); // shuffled indices
+void ShuffledBinarySearchBatchDeshuffled(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices); // linear indices
+
+// B-tree layout with one cache line per node, see binsearchshuffle_block.c
+int BlockShuffledArraySize(int count); // number of ints in the block array for 'count' values, 0 if more than INT_MAX
+void BlockShuffleSortedArray(int *block_array, const int *sorted_array, int count); // build a block array from a sorted array
+int BlockShuffledBinarySearch(int value, const int *block_array, int count); // find the index of a value in a block array
+int BlockDeshuffleIndex(int index, int count); // convert a block array index into a linear index
+void BlockSortShuffledArray(int *sorted_array, const int *block_array, int count); // write the sorted values of a block array
+
+// breadth first (Eytzinger) layout, see binsearchshuffle_eytzinger.c
+void EytzingerShuffleSortedArray(int *array, int count); // reorder a sorted array in-place
+int EytzingerBinarySearch(int value, const int *eytzinger_array, int count); // find the index of a value
+int EytzingerDeshuffleIndex(int index, int count); // convert an Eytzinger index into a linear index
+void EytzingerSortShuffledArray(int *array, int count); // sort an Eytzinger array in-place
+
+// shuffled top levels with sorted leaves of up to SHUFFLE_HYBRID_LEAF values, see binsearchshuffle_hybrid.c
+void HybridShuffleSortedArray(int *array, int count); // shuffle a sorted array
+int HybridShuffledBinarySearch(int value, const int *hybrid_array, int count); // find the index of a value
+int HybridDeshuffleIndex(int index, int count); // convert a hybrid index into a linear index
+void HybridSortShuffledArray(int *array, int count); // sort a hybrid array
+
+// shuffled array with small sorted arrays of inserts and removes merged later, see binsearchshuffle_delta.c
+typedef struct ShuffledDelta {
+	int *shuffled_array;
+	int count;		// values in shuffled_array (including removed values)
+	int capacity;	// room in shuffled_array
+	int *inserts;	// sorted values not in shuffled_array
+	int ninserts;
+	int *removes;	// sorted values in shuffled_array that are removed
+	int nremoves;
+	int max_delta;	// merge when ninserts+nremoves reaches this
+	int *scratch;	// NULL or room for 'capacity' ints
+} ShuffledDelta;
+void ShuffledDeltaInit(ShuffledDelta *delta, int *shuffled_array, int count, int capacity, int *delta_buffer, int max_delta, int *scratch); // delta_buffer has room for 2*max_delta ints
+int ShuffledDeltaInsert(ShuffledDelta *delta, int value); // 1 inserted, 0 already there, -1 no room
+int ShuffledDeltaRemove(ShuffledDelta *delta, int value); // 1 removed, 0 not there
+int ShuffledDeltaContains(const ShuffledDelta *delta, int value); // 1 if value is in the array or the delta
+int ShuffledDeltaCount(const ShuffledDelta *delta); // number of values
+void ShuffledDeltaMerge(ShuffledDelta *delta); // merge the delta into the shuffled array
+
+// shuffled array with gaps for inserts that owns its buffers, see binsearchshuffle_gapped.c
+typedef struct ShuffledGapped {
+	int *slots;			// 'capacity' slots in the shuffled layout, a gap holds the value before it
+	uint32_t *gaps;		// bit per slot, set for gaps
+	int *scratch;		// values of a subtree while it is spread out
+	int capacity;
+	int count;			// values that are not gaps
+} ShuffledGapped;
+int ShuffledGappedInit(ShuffledGapped *gapped, const int *sorted_array, int count); // 0 if out of memory
+void ShuffledGappedFree(ShuffledGapped *gapped);
+int ShuffledGappedSearch(int value, const ShuffledGapped *gapped); // slot index of a value, -1 if not found
+int ShuffledGappedInsert(ShuffledGapped *gapped, int value); // 1 inserted, 0 already there, -1 out of memory
+int ShuffledGappedRemove(ShuffledGapped *gapped, int value); // 1 removed, 0 not there
+
+// uint64_t values in the hybrid layout with leaves of small offsets from a base, see binsearchshuffle_packed.c
+#define SHUFFLE_PACKED_LINE 64		// bytes per leaf
+#define SHUFFLE_PACKED_DEPTHS 34	// depths of a tree of up to INT_MAX values
+typedef struct ShuffledPacked {
+	uint64_t *top;			// middle values of the blocks larger than a leaf in shuffled order
+	unsigned char *leaves;	// SHUFFLE_PACKED_LINE bytes per leaf in sorted order
+	void *memory;
+	int count;
+	int leaf_max;			// values per leaf
+	int ntop;
+	int nleaves;
+	int nlines;				// lines of the leaves and of the leaves split for wider offsets
+	int depths;
+	int hi[SHUFFLE_PACKED_DEPTHS];				// the larger block size at each depth, the other one is hi-1
+	int tops[SHUFFLE_PACKED_DEPTHS][2];			// middle values in a block of size hi and hi-1
+	int leaf_counts[SHUFFLE_PACKED_DEPTHS][2];	// leaves in a block of size hi and hi-1
+} ShuffledPacked;
+int ShuffledPackedBuild(ShuffledPacked *packed, const uint64_t *sorted_array, int count); // sorted unique values, 0 if out of memory
+void ShuffledPackedFree(ShuffledPacked *packed);
+int ShuffledPackedSearch(uint64_t value, const ShuffledPacked *packed); // linear index of a value, -1 if not found
+void ShuffledPackedUnpack(const ShuffledPacked *packed, uint64_t *sorted_array); // all values in sorted order
+size_t ShuffledPackedBytes(const ShuffledPacked *packed); // bytes of the top and the leaves
+
+// the same functions for other key types, see binsearchshuffle_type.h
+#define SHUFFLE_DECLARE_TYPE(type, suffix) \
+	void ShuffleSortedArray##suffix(type *array, int count); \
+	int ShuffledBinarySearch##suffix(type value, const type *shuffled_array, int count); \
+	void SortShuffledArray##suffix(type *array, int count); \
+	int RemoveShuffledArrayValue##suffix(type value, type *shuffled_array, int count); \
+	int InsertShuffledArrayValue##suffix(type value, type *shuffled_array, int count);
+
+SHUFFLE_DECLARE_TYPE(int32_t, _i32)
+SHUFFLE_DECLARE_TYPE(uint32_t, _u32)
+SHUFFLE_DECLARE_TYPE(int64_t, _i64)
+SHUFFLE_DECLARE_TYPE(uint64_t, _u64)
+SHUFFLE_DECLARE_TYPE(float, _f32)
+SHUFFLE_DECLARE_TYPE(double, _f64)
+
+// any element size with a qsort style compare function
+typedef int (*ShuffleCompareFunc)(const void *a, const void *b);
+void ShuffleSortedArrayGeneric(void *array, int count, size_t size);
+int ShuffledBinarySearchGeneric(const void *value, const void *shuffled_array, int count, size_t size, ShuffleCompareFunc compare);
+void SortShuffledArrayGeneric(void *array, int count, size_t size);
+int RemoveShuffledArrayValueGeneric(const void *value, void *shuffled_array, int count, size_t size, ShuffleCompareFunc compare);
+int InsertShuffledArrayValueGeneric(const void *value, void *shuffled_array, int count, size_t size, ShuffleCompareFunc compare);
+
+// keys with values in separate arrays, values[a] has 'count' elements of sizes[a] bytes
+void ShuffleSortedArrayValues(int *keys, int count, void **values, const size_t *sizes, int arrays); // shuffle keys and values the same way
+void SortShuffledArrayValues(int *keys, int count, void **values, const size_t *sizes, int arrays); // sort keys and values the same way
+void ShuffleSortedArrayValuesCopy(int *shuffled_keys, void **shuffled_values, const int *sorted_keys, const void **sorted_values, int count, const size_t *sizes, int arrays); // O(n) into other arrays
+void SortShuffledArrayValuesCopy(int *sorted_keys, void **sorted_values, const int *shuffled_keys, const void **shuffled_values, int count, const size_t *sizes, int arrays); // O(n) into other arrays
+void ShuffleSortedArrayValuesScratch(int *keys, int count, void **values, const size_t *sizes, int arrays, void *scratch); // O(n), scratch is int aligned with count*max(sizeof(int), largest size) bytes
+void SortShuffledArrayValuesScratch(int *keys, int count, void **values, const size_t *sizes, int arrays, void *scratch); // O(n), scratch is int aligned with count*max(sizeof(int), largest size) bytes
+void *ShuffledLookupValue(int key, const int *shuffled_keys, int count, const void *values, size_t size); // value of a key, NULL if not found
 
 // for comparison with a sorted binary search
 int RegularBinarySearch(int value, int *sorted_array, int count);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,629 @@
+#ifndef __BINSHUFFLE_HPP__
+#define __BINSHUFFLE_HPP__
+
+// C++ interface, C++17
+//
+// ShuffledTable<T, N> is shuffled at compile time from a sorted std::array, for
+// tables with a size known at build time like enum maps or protocol fields. The
+// search is unrolled into one compare per level with the block offsets as
+// constants, so there is no loop and no setup at startup:
+//
+//	constexpr shuffle::ShuffledTable<int, 5> table({ 2, 3, 5, 7, 11 });
+//	static_assert(table.Contains(7), "");
+//	int linear = table.FindLinear(value);	// index in the sorted array, -1 if not found
+//
+// T needs a constexpr operator< and operator==. Tables of more than a few
+// thousand values take long to compile, use ShuffleSortedArray for those.
+//
+// shuffled_set<K> and shuffled_map<K, V> keep unique keys in one shuffled
+// vector, for read heavy code that would use std::set or std::map:
+//
+//	shuffle::shuffled_map<std::string, int, std::less<>> ports({ { "http", 80 }, { "ssh", 22 } });
+//	auto it = ports.find("ssh");	// std::string_view or const char* without a temporary key
+//
+// Iterators walk the keys in sorted order and are random access, ++ and -- step
+// through the layout in amortized O(1) like ShuffledIterator and a jump converts
+// the linear index with ShuffleIndex. Inserts and erases unshuffle and
+// reshuffle the vector like InsertShuffledArrayValue, so build the container
+// from a range or insert ranges at once. An insert only reallocates when the
+// size passes the capacity given to reserve. The map's value_type is
+// std::pair<K, V> rather than std::pair<const K, V> since the values are moved
+// around, do not change a key through an iterator. The containers call the C
+// functions and need the library linked, ShuffledTable does not.
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "binsearchshuffle.h"
+
+namespace shuffle {
+
+// DeshuffleIndex as a constant expression
+constexpr int DeshuffleIndex(int index, int count)
+{
+	if (index<0 || index>=count)
+		return -1;
+	int first = 0;	// linear index of the first value in the block
+	for (;;) {
+		if (!index)
+			return first+count/2;
+		if (index>count/2) {
+			index -= count/2+1;
+			first += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index--;
+			count /= 2;
+		}
+	}
+}
+
+template<typename T, std::size_t N>
+class ShuffledTable {
+public:
+	static_assert(N<=0x7fffffff, "shuffled indices are ints");
+
+	constexpr explicit ShuffledTable(const std::array<T, N> &sorted) : values_(Shuffle(sorted)) {}
+
+	// shuffled index of a value, -1 if not found
+	constexpr int Find(const T &value) const { return SearchBlock<0, 0, N, false>(value); }
+	// sorted index of a value, -1 if not found, the same as DeshuffleIndex(Find(value), N) without the loop
+	constexpr int FindLinear(const T &value) const { return SearchBlock<0, 0, N, true>(value); }
+	constexpr bool Contains(const T &value) const { return Find(value)>=0; }
+
+	constexpr const T &operator[](std::size_t index) const { return values_[index]; }	// shuffled order
+	constexpr const T *data() const { return values_.data(); }
+	static constexpr std::size_t size() { return N; }
+
+private:
+	// one compare of the block at Index with Count values that start at First in
+	// the sorted array, the next block is a constant
+	template<std::size_t Index, std::size_t First, std::size_t Count, bool Linear>
+	constexpr int SearchBlock(const T &value) const
+	{
+		if constexpr (Count==0)
+			return -1;
+		else {
+			const T &read = values_[Index];
+			if (value==read)
+				return Linear ? (int)(First+Count/2) : (int)Index;
+			return read<value ? SearchBlock<Index+Count/2+1, First+Count/2+1, (Count-1)/2, Linear>(value) :
+				SearchBlock<Index+1, First, Count/2, Linear>(value);
+		}
+	}
+
+	// the same order as ShuffleSortedArrayCopy, the upper halves go on a stack
+	static constexpr std::array<T, N> Shuffle(const std::array<T, N> &sorted)
+	{
+		std::array<T, N> shuffled{};
+		std::size_t stack_first[64] = {}, stack_count[64] = {};
+		std::size_t stk = 0, first = 0, count = N, out = 0;
+		while (count || stk) {
+			if (!count) {
+				stk--;
+				first = stack_first[stk];
+				count = stack_count[stk];
+				continue;
+			}
+			shuffled[out++] = sorted[first+count/2];
+			if ((count-1)/2) {
+				stack_first[stk] = first+count/2+1;
+				stack_count[stk] = (count-1)/2;
+				stk++;
+			}
+			count /= 2;
+		}
+		for (std::size_t i = 1; i<N; i++)
+			assert(!(sorted[i]<sorted[i-1]) && "ShuffledTable needs a sorted array");
+		return shuffled;
+	}
+
+	std::array<T, N> values_;
+};
+
+template<typename T, std::size_t N>
+constexpr ShuffledTable<T, N> MakeShuffledTable(const std::array<T, N> &sorted) { return ShuffledTable<T, N>(sorted); }
+
+namespace detail {
+
+// ShuffleSortedArray and SortShuffledArray for any type, the middle value of a
+// block is rotated to the front or back and the upper halves go on a stack
+template<typename It>
+void ShuffleSorted(It first, std::ptrdiff_t count)
+{
+	struct { It first; std::ptrdiff_t count; } stack[64];
+	int stk = 0;
+	while (count>1 || stk) {
+		if (count<=1) {
+			stk--;
+			first = stack[stk].first;
+			count = stack[stk].count;
+			continue;
+		}
+		std::rotate(first, first+count/2, first+count/2+1);
+		++first;
+		stack[stk].first = first+count/2;
+		stack[stk].count = (count-1)/2;
+		stk++;
+		count /= 2;
+	}
+}
+
+template<typename It>
+void SortShuffled(It first, std::ptrdiff_t count)
+{
+	struct { It first; std::ptrdiff_t count; } stack[64];
+	int stk = 0;
+	while (count>1 || stk) {
+		if (count<=1) {
+			stk--;
+			first = stack[stk].first;
+			count = stack[stk].count;
+			continue;
+		}
+		std::rotate(first, first+1, first+count/2+1);
+		stack[stk].first = first+count/2+1;
+		stack[stk].count = (count-1)/2;
+		stk++;
+		count /= 2;
+	}
+}
+
+struct KeyOfValue { template<typename T> const T &operator()(const T &value) const { return value; } };
+struct KeyOfPair { template<typename P> const typename P::first_type &operator()(const P &pair) const { return pair.first; } };
+
+template<typename Compare, typename = void> struct IsTransparent : std::false_type {};
+template<typename Compare> struct IsTransparent<Compare, std::void_t<typename Compare::is_transparent>> : std::true_type {};
+
+// sorted order iterator over a shuffled array, keeps the linear and the shuffled
+// index, the count of the block the value is the middle of and the way down to
+// it, 2 bits per level, so a step to the parent block is a subtraction and ++
+// and -- walk the tree without a stack
+template<typename Value, bool Const>
+class SortedIterator {
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using value_type = Value;
+	using difference_type = std::ptrdiff_t;
+	using pointer = std::conditional_t<Const, const Value*, Value*>;
+	using reference = std::conditional_t<Const, const Value&, Value&>;
+
+	SortedIterator() = default;
+	SortedIterator(pointer values, int count, int linear) : values_(values), count_(count) { Seek(linear); }
+	// the way down is found on the first step
+	SortedIterator(pointer values, int count, int linear, int index) : values_(values), count_(count), linear_(linear), index_(index) {}
+	template<bool C, typename = std::enable_if_t<Const && !C>>
+	SortedIterator(const SortedIterator<Value, C> &other) : values_(other.values_), count_(other.count_), linear_(other.linear_), index_(other.index_),
+		block_(other.block_), depth_(other.depth_), path_(other.path_) {}
+
+	reference operator*() const { return values_[index_]; }
+	pointer operator->() const { return values_+index_; }
+	reference operator[](difference_type n) const { return *(*this+n); }
+
+	int linear() const { return linear_; }	// index in sorted order
+	int index() const { return index_; }	// index in the shuffled array, -1 at the end
+
+	SortedIterator &operator+=(difference_type n)
+	{
+		if (n==1)
+			return ++*this;
+		if (n==-1)
+			return --*this;
+		Seek(linear_+(int)n);
+		return *this;
+	}
+	SortedIterator &operator-=(difference_type n) { return *this += -n; }
+	// the next value is the smallest one of the right block, or the parent of the first left block on the way up
+	SortedIterator &operator++()
+	{
+		if (depth_<0 || index_<0)
+			Seek(linear_+1);
+		else if ((block_-1)/2) {
+			linear_++;
+			Down(true);
+			while (block_/2)
+				Down(false);
+		} else {
+			linear_++;
+			for (;;) {
+				if (!depth_) {
+					Seek(count_);	// it was the last value
+					break;
+				}
+				if (!Up())
+					break;
+			}
+		}
+		return *this;
+	}
+	SortedIterator &operator--()
+	{
+		if (depth_<0 || index_<0)
+			Seek(linear_-1);
+		else if (block_/2) {
+			linear_--;
+			Down(false);
+			while ((block_-1)/2)
+				Down(true);
+		} else {
+			linear_--;
+			for (;;) {
+				if (!depth_) {
+					Seek(-1);
+					break;
+				}
+				if (Up())
+					break;
+			}
+		}
+		return *this;
+	}
+	SortedIterator operator++(int) { SortedIterator it = *this; ++*this; return it; }
+	SortedIterator operator--(int) { SortedIterator it = *this; --*this; return it; }
+	SortedIterator operator+(difference_type n) const { SortedIterator it = *this; return it += n; }
+	SortedIterator operator-(difference_type n) const { SortedIterator it = *this; return it += -n; }
+	friend SortedIterator operator+(difference_type n, const SortedIterator &it) { return it+n; }
+	difference_type operator-(const SortedIterator &other) const { return linear_-other.linear_; }
+
+	bool operator==(const SortedIterator &other) const { return linear_==other.linear_; }
+	bool operator!=(const SortedIterator &other) const { return linear_!=other.linear_; }
+	bool operator<(const SortedIterator &other) const { return linear_<other.linear_; }
+	bool operator>(const SortedIterator &other) const { return linear_>other.linear_; }
+	bool operator<=(const SortedIterator &other) const { return linear_<=other.linear_; }
+	bool operator>=(const SortedIterator &other) const { return linear_>=other.linear_; }
+
+private:
+	template<typename, bool> friend class SortedIterator;
+
+	// finds the block of a linear index from the top, O(log n)
+	void Seek(int linear)
+	{
+		linear_ = linear;
+		index_ = 0;
+		block_ = count_;
+		depth_ = 0;
+		path_ = 0;
+		if (linear<0 || linear>=count_) {
+			index_ = -1;
+			return;
+		}
+		int first = 0;
+		while (linear!=first+block_/2) {
+			if (linear>first+block_/2) {
+				first += block_/2+1;
+				Down(true);
+			} else
+				Down(false);
+		}
+	}
+
+	// the 2 bits of a level are whether it went right and the rest of the parent count
+	void Down(bool right)
+	{
+		int child = right ? (block_-1)/2 : block_/2;
+		path_ |= (std::uint64_t)((right ? 1 : 0) | (block_-2*child-(right ? 1 : 0))<<1) << (2*depth_);
+		depth_++;
+		index_ += right ? block_/2+1 : 1;
+		block_ = child;
+	}
+
+	// to the parent block, true if this was its right block
+	bool Up()
+	{
+		depth_--;
+		int bits = (int)(path_>>(2*depth_)) & 3;
+		path_ &= ~((std::uint64_t)3<<(2*depth_));
+		bool right = bits & 1;
+		block_ = 2*block_ + (right ? 1 : 0) + (bits>>1);
+		index_ -= right ? block_/2+1 : 1;
+		return right;
+	}
+
+	pointer values_ = nullptr;
+	int count_ = 0;
+	int linear_ = 0;
+	int index_ = -1;
+	int block_ = 0;			// values in the block of index_
+	int depth_ = -1;		// levels in path_, -1 until the way down is known
+	std::uint64_t path_ = 0;
+};
+
+// unique keys in a vector in the shuffled layout, shared by shuffled_set and shuffled_map
+template<typename Value, typename Key, typename KeyOf, typename Compare, typename Allocator, bool MutableValues>
+class ShuffledContainer {
+public:
+	using key_type = Key;
+	using value_type = Value;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using key_compare = Compare;
+	using allocator_type = Allocator;
+	using reference = value_type&;
+	using const_reference = const value_type&;
+	using const_iterator = SortedIterator<Value, true>;
+	using iterator = std::conditional_t<MutableValues, SortedIterator<Value, false>, const_iterator>;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	ShuffledContainer() = default;
+	explicit ShuffledContainer(const Compare &comp, const Allocator &alloc = Allocator()) : values_(alloc), comp_(comp) {}
+	explicit ShuffledContainer(const Allocator &alloc) : values_(alloc) {}
+	template<typename InputIt>
+	ShuffledContainer(InputIt first, InputIt last, const Compare &comp = Compare(), const Allocator &alloc = Allocator()) : values_(first, last, alloc), comp_(comp) { Build(); }
+	ShuffledContainer(std::initializer_list<value_type> init, const Compare &comp = Compare(), const Allocator &alloc = Allocator()) : ShuffledContainer(init.begin(), init.end(), comp, alloc) {}
+	ShuffledContainer &operator=(std::initializer_list<value_type> init) { values_.assign(init.begin(), init.end()); Build(); return *this; }
+
+	iterator begin() { return iterator(values_.data(), Count(), 0); }
+	iterator end() { return iterator(values_.data(), Count(), Count(), -1); }
+	const_iterator begin() const { return const_iterator(values_.data(), Count(), 0); }
+	const_iterator end() const { return const_iterator(values_.data(), Count(), Count(), -1); }
+	const_iterator cbegin() const { return begin(); }
+	const_iterator cend() const { return end(); }
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+	bool empty() const { return values_.empty(); }
+	size_type size() const { return values_.size(); }
+	size_type max_size() const { return std::min<size_type>(INT_MAX, values_.max_size()); }
+	size_type capacity() const { return values_.capacity(); }
+	void reserve(size_type count) { values_.reserve(count); }	// no reallocation until the size passes 'count'
+	void shrink_to_fit() { values_.shrink_to_fit(); }
+	void clear() { values_.clear(); }
+
+	const value_type *data() const { return values_.data(); }	// shuffled order
+	key_compare key_comp() const { return comp_; }
+	allocator_type get_allocator() const { return values_.get_allocator(); }
+
+	// lookups, the templates take any type the comparator is transparent for
+	iterator find(const Key &key) { return Find<iterator>(values_.data(), key); }
+	const_iterator find(const Key &key) const { return Find<const_iterator>(values_.data(), key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	iterator find(const K &key) { return Find<iterator>(values_.data(), key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	const_iterator find(const K &key) const { return Find<const_iterator>(values_.data(), key); }
+
+	bool contains(const Key &key) const { return find(key)!=end(); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	bool contains(const K &key) const { return find(key)!=end(); }
+	size_type count(const Key &key) const { return contains(key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	size_type count(const K &key) const { auto range = equal_range(key); return (size_type)(range.second-range.first); }
+
+	iterator lower_bound(const Key &key) { return Bound<iterator, false>(values_.data(), key); }
+	const_iterator lower_bound(const Key &key) const { return Bound<const_iterator, false>(values_.data(), key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	iterator lower_bound(const K &key) { return Bound<iterator, false>(values_.data(), key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	const_iterator lower_bound(const K &key) const { return Bound<const_iterator, false>(values_.data(), key); }
+
+	iterator upper_bound(const Key &key) { return Bound<iterator, true>(values_.data(), key); }
+	const_iterator upper_bound(const Key &key) const { return Bound<const_iterator, true>(values_.data(), key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	iterator upper_bound(const K &key) { return Bound<iterator, true>(values_.data(), key); }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	const_iterator upper_bound(const K &key) const { return Bound<const_iterator, true>(values_.data(), key); }
+
+	std::pair<iterator, iterator> equal_range(const Key &key) { return { lower_bound(key), upper_bound(key) }; }
+	std::pair<const_iterator, const_iterator> equal_range(const Key &key) const { return { lower_bound(key), upper_bound(key) }; }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	std::pair<iterator, iterator> equal_range(const K &key) { return { lower_bound(key), upper_bound(key) }; }
+	template<typename K, typename C = Compare, typename = std::enable_if_t<IsTransparent<C>::value>>
+	std::pair<const_iterator, const_iterator> equal_range(const K &key) const { return { lower_bound(key), upper_bound(key) }; }
+
+	// updates, each one is O(n log n) moves like InsertShuffledArrayValue
+	std::pair<iterator, bool> insert(const value_type &value) { return Insert(value_type(value)); }
+	std::pair<iterator, bool> insert(value_type &&value) { return Insert(std::move(value)); }
+	template<typename... Args>
+	std::pair<iterator, bool> emplace(Args&&... args) { return Insert(value_type(std::forward<Args>(args)...)); }
+	// the new values are copied, sorted and checked against the container before it
+	// is unshuffled, so an exception from a copy or an allocation leaves it as it was
+	template<typename InputIt>
+	void insert(InputIt first, InputIt last)
+	{
+		std::vector<Value, Allocator> added(first, last, values_.get_allocator());
+		auto less = [this](const Value &a, const Value &b) { return Less(a, b); };
+		std::stable_sort(added.begin(), added.end(), less);
+		added.erase(std::unique(added.begin(), added.end(), [this](const Value &a, const Value &b) { return !Less(a, b); }), added.end());
+		added.erase(std::remove_if(added.begin(), added.end(), [this](const Value &value) { return contains(KeyOf()(value)); }), added.end());
+		if (added.empty())
+			return;
+		values_.reserve(values_.size()+added.size());
+		auto sorted = (std::ptrdiff_t)values_.size();
+		Unshuffle();
+		values_.insert(values_.end(), std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+		std::inplace_merge(values_.begin(), values_.begin()+sorted, values_.end(), less);
+		assert(values_.size()<=INT_MAX);
+		Shuffle();
+	}
+	void insert(std::initializer_list<value_type> init) { insert(init.begin(), init.end()); }
+
+	iterator erase(const_iterator pos) { return erase(pos, pos+1); }
+	iterator erase(const_iterator first, const_iterator last)
+	{
+		int linear = first.linear();
+		if (first!=last) {
+			Unshuffle();
+			values_.erase(values_.begin()+linear, values_.begin()+last.linear());
+			Shuffle();
+		}
+		return iterator(values_.data(), Count(), linear);
+	}
+	size_type erase(const Key &key)
+	{
+		const_iterator it = find(key);
+		if (it==cend())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+	void swap(ShuffledContainer &other) noexcept { values_.swap(other.values_); std::swap(comp_, other.comp_); }
+	friend void swap(ShuffledContainer &a, ShuffledContainer &b) noexcept { a.swap(b); }
+	friend bool operator==(const ShuffledContainer &a, const ShuffledContainer &b) { return a.values_==b.values_; }
+	friend bool operator!=(const ShuffledContainer &a, const ShuffledContainer &b) { return a.values_!=b.values_; }
+
+protected:
+	int Count() const { return (int)values_.size(); }
+	bool Less(const Value &a, const Value &b) const { return comp_(KeyOf()(a), KeyOf()(b)); }
+
+	// the search of ShuffledBinarySearch with the comparator
+	template<typename It, typename Pointer, typename K>
+	It Find(Pointer values, const K &key) const
+	{
+		int count = Count(), index = 0, first = 0;
+		while (count) {
+			const Key &read = KeyOf()(values[index]);
+			if (comp_(key, read)) {
+				index++;
+				count /= 2;
+			} else if (comp_(read, key)) {
+				index += count/2+1;
+				first += count/2+1;
+				count = (count-1)/2;
+			} else
+				return It(values, Count(), first+count/2, index);
+		}
+		return It(values, Count(), Count(), -1);
+	}
+
+	// first key not less than (Upper false) or greater than (Upper true) 'key', like ShuffledLowerBound
+	template<typename It, bool Upper, typename Pointer, typename K>
+	It Bound(Pointer values, const K &key) const
+	{
+		int count = Count(), index = 0, first = 0;
+		int found = Count(), found_index = -1;
+		while (count) {
+			const Key &read = KeyOf()(values[index]);
+			if (Upper ? comp_(key, read) : !comp_(read, key)) {
+				found = first+count/2;
+				found_index = index;
+				index++;
+				count /= 2;
+			} else {
+				index += count/2+1;
+				first += count/2+1;
+				count = (count-1)/2;
+			}
+		}
+		return It(values, Count(), found, found_index);
+	}
+
+	void Shuffle()
+	{
+		if constexpr (std::is_same_v<Value, int>)
+			ShuffleSortedArray(values_.data(), Count());
+		else
+			ShuffleSorted(values_.begin(), (std::ptrdiff_t)values_.size());
+	}
+	void Unshuffle()
+	{
+		if constexpr (std::is_same_v<Value, int>)
+			SortShuffledArray(values_.data(), Count());
+		else
+			SortShuffled(values_.begin(), (std::ptrdiff_t)values_.size());
+	}
+
+	// values_ is new values in any order, the first of equal values is kept
+	void Build()
+	{
+		auto less = [this](const Value &a, const Value &b) { return Less(a, b); };
+		std::stable_sort(values_.begin(), values_.end(), less);
+		values_.erase(std::unique(values_.begin(), values_.end(), [this](const Value &a, const Value &b) { return !Less(a, b); }), values_.end());
+		assert(values_.size()<=INT_MAX);
+		Shuffle();
+	}
+
+	std::pair<iterator, bool> Insert(value_type &&value)
+	{
+		iterator it = Bound<iterator, false>(values_.data(), KeyOf()(value));
+		if (it!=end() && !comp_(KeyOf()(value), KeyOf()(*it)))
+			return { it, false };
+		int linear = it.linear();
+		if (values_.size()==values_.capacity())
+			values_.reserve(values_.size()*2+1);	// grow before the vector is unshuffled
+		Unshuffle();
+		values_.insert(values_.begin()+linear, std::move(value));
+		Shuffle();
+		return { iterator(values_.data(), Count(), linear), true };
+	}
+
+	std::vector<Value, Allocator> values_;
+	Compare comp_ = Compare();
+};
+
+}	// namespace detail
+
+// a set of unique keys in the shuffled layout, the iterators are const like std::set
+template<typename Key, typename Compare = std::less<Key>, typename Allocator = std::allocator<Key>>
+class shuffled_set : public detail::ShuffledContainer<Key, Key, detail::KeyOfValue, Compare, Allocator, false> {
+	using Base = detail::ShuffledContainer<Key, Key, detail::KeyOfValue, Compare, Allocator, false>;
+public:
+	using Base::Base;
+	using Base::operator=;
+	shuffled_set() = default;
+};
+
+// a map of unique keys in the shuffled layout, value_type is std::pair<Key, T>
+template<typename Key, typename T, typename Compare = std::less<Key>, typename Allocator = std::allocator<std::pair<Key, T>>>
+class shuffled_map : public detail::ShuffledContainer<std::pair<Key, T>, Key, detail::KeyOfPair, Compare, Allocator, true> {
+	using Base = detail::ShuffledContainer<std::pair<Key, T>, Key, detail::KeyOfPair, Compare, Allocator, true>;
+public:
+	using mapped_type = T;
+	using typename Base::iterator;
+	using typename Base::const_iterator;
+	using Base::Base;
+	using Base::operator=;
+	shuffled_map() = default;
+
+	T &at(const Key &key)
+	{
+		iterator it = this->find(key);
+		if (it==this->end())
+			throw std::out_of_range("shuffled_map::at");
+		return it->second;
+	}
+	const T &at(const Key &key) const
+	{
+		const_iterator it = this->find(key);
+		if (it==this->end())
+			throw std::out_of_range("shuffled_map::at");
+		return it->second;
+	}
+	T &operator[](const Key &key) { return try_emplace(key).first->second; }
+	T &operator[](Key &&key) { return try_emplace(std::move(key)).first->second; }
+
+	// the value is only constructed when the key is not there
+	template<typename K, typename... Args>
+	std::pair<iterator, bool> try_emplace(K &&key, Args&&... args)
+	{
+		iterator it = this->find(key);
+		if (it!=this->end())
+			return { it, false };
+		return this->Insert(std::pair<Key, T>(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...)));
+	}
+	template<typename M>
+	std::pair<iterator, bool> insert_or_assign(const Key &key, M &&value)
+	{
+		auto result = try_emplace(key, std::forward<M>(value));
+		if (!result.second)
+			result.first->second = std::forward<M>(value);
+		return result;
+	}
+};
+
+}	// namespace shuffle
+
+#endif
@@ -0,0 +1,365 @@
+/*
+Shuffled Arrays in a Huge Page Arena
+
+The shuffled array functions work on buffers the caller owns, and
+InsertShuffledArrayValue needs room for one more value. With many tables that
+are rebuilt every so often the buffers come and go in all sizes, which
+fragments the heap, and lookups in tables spread over many 4 KB pages miss the
+data TLB. The arena maps memory 2 MB at a time, aligned so each chunk can be
+one huge page, and hands out cache line aligned buffers in power of two sizes.
+A released buffer is kept for the next buffer of the same size, so rebuilding
+a table reuses the buffers of the last rebuild instead of going back to the OS.
+
+- int ShuffleArenaInit(ShuffleArena *arena, int flags) / void ShuffleArenaFree(ShuffleArena *arena)
+- void *ShuffleArenaAlloc(ShuffleArena *arena, size_t bytes, size_t *capacity)
+	- buffer of at least 'bytes' bytes, the size class is returned in 'capacity'
+- void ShuffleArenaRelease(ShuffleArena *arena, void *buffer, size_t capacity)
+
+A ShuffledHandle owns a shuffled array in an arena:
+
+- int ShuffledHandleInit(ShuffledHandle *handle, ShuffleArena *arena, const int *sorted_array, int count)
+- void ShuffledHandleFree(ShuffledHandle *handle)
+- int ShuffledHandleSearch(const ShuffledHandle *handle, int value)
+- int ShuffledHandleInsert(ShuffledHandle *handle, int value) / int ShuffledHandleRemove(ShuffledHandle *handle, int value)
+	- InsertShuffledArrayValue and RemoveShuffledArrayValue, the buffer doubles when it is full
+- int ShuffledHandleReserve(ShuffledHandle *handle, int capacity)
+- int ShuffledHandleRebuild(ShuffledHandle *handle, const int *unsorted, int count)
+	- builds into a new buffer with a scratch buffer from the arena, both come back for the next rebuild
+
+Huge pages
+
+On Linux each chunk is aligned to 2 MB and marked with MADV_HUGEPAGE so
+transparent huge pages can back it. With SHUFFLE_ARENA_HUGETLB the arena first
+tries MAP_HUGETLB pages, which only works if huge pages were reserved
+(vm.nr_hugepages), and on Windows large pages which need the lock pages in
+memory privilege. Either way the arena falls back to normal pages.
+
+Buffers of up to 1 MB are cut from the chunks, larger buffers are mapped on
+their own rounded up to 2 MB and reused if a later buffer is between half and
+all of the size. The arena takes a lock for alloc and release, a handle
+belongs to one thread at a time.
+*/
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle_arena.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION ShuffleLock;
+#define LOCK_INIT(l) InitializeCriticalSection(l)
+#define LOCK_DESTROY(l) DeleteCriticalSection(l)
+#define LOCK(l) EnterCriticalSection(l)
+#define UNLOCK(l) LeaveCriticalSection(l)
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+typedef pthread_mutex_t ShuffleLock;
+#define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+#define MIN_CLASS_BYTES SHUFFLE_ARENA_ALIGN
+#define MAX_CLASS_BYTES ((size_t)MIN_CLASS_BYTES<<(SHUFFLE_ARENA_CLASSES-1))
+
+// at the start of each chunk and each large buffer, one cache line so the buffers stay aligned
+typedef struct MapHeader {
+	struct MapHeader *next;
+	size_t size;		// bytes mapped
+	int released;		// large buffer that can be reused
+	int huge;			// mapped with reserved huge pages
+	char pad[SHUFFLE_ARENA_ALIGN-2*sizeof(void*)-2*sizeof(int)];
+} MapHeader;
+
+// 'size' is a multiple of SHUFFLE_ARENA_CHUNK, the mapping is aligned to SHUFFLE_ARENA_CHUNK where the OS allows it
+static MapHeader *Map(size_t size, int flags)
+{
+	MapHeader *header = NULL;
+	int huge = 0;
+#ifdef _WIN32
+	SIZE_T large = GetLargePageMinimum();
+	if ((flags & SHUFFLE_ARENA_HUGETLB) && large && !(size % large)) {
+		header = (MapHeader*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		huge = header!=NULL;
+	}
+	if (!header)
+		header = (MapHeader*)VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+#ifdef MAP_HUGETLB
+	if (flags & SHUFFLE_ARENA_HUGETLB) {
+		void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (map!=MAP_FAILED) {
+			header = (MapHeader*)map;
+			huge = 1;
+		}
+	}
+#endif
+	if (!header) {
+		// map one chunk more and unmap the ends so the rest is aligned
+		void *map = mmap(NULL, size+SHUFFLE_ARENA_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map==MAP_FAILED)
+			return NULL;
+		unsigned char *start = (unsigned char*)map;
+		unsigned char *aligned = (unsigned char*)(((uintptr_t)start + SHUFFLE_ARENA_CHUNK-1) & ~(uintptr_t)(SHUFFLE_ARENA_CHUNK-1));
+		if (aligned>start)
+			munmap(start, aligned-start);
+		if (aligned+size<start+size+SHUFFLE_ARENA_CHUNK)
+			munmap(aligned+size, start+size+SHUFFLE_ARENA_CHUNK-(aligned+size));
+		header = (MapHeader*)aligned;
+#ifdef MADV_HUGEPAGE
+		if (!(flags & SHUFFLE_ARENA_NO_THP))
+			madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	}
+#endif
+	if (header) {
+		header->next = NULL;
+		header->size = size;
+		header->released = 0;
+		header->huge = huge;
+	}
+	return header;
+}
+
+static void Unmap(MapHeader *header)
+{
+#ifdef _WIN32
+	VirtualFree(header, 0, MEM_RELEASE);
+#else
+	munmap(header, header->size);
+#endif
+}
+
+static int SizeClass(size_t bytes)
+{
+	int size_class = 0;
+	while (((size_t)MIN_CLASS_BYTES<<size_class)<bytes)
+		size_class++;
+	return size_class;
+}
+
+int ShuffleArenaInit(ShuffleArena *arena, int flags)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->flags = flags;
+	arena->lock = malloc(sizeof(ShuffleLock));
+	if (!arena->lock)
+		return 0;
+	LOCK_INIT((ShuffleLock*)arena->lock);
+	return 1;
+}
+
+void ShuffleArenaFree(ShuffleArena *arena)
+{
+	for (MapHeader *list = (MapHeader*)arena->chunks; list;) {
+		MapHeader *next = list->next;
+		Unmap(list);
+		list = next;
+	}
+	for (MapHeader *list = (MapHeader*)arena->large; list;) {
+		MapHeader *next = list->next;
+		Unmap(list);
+		list = next;
+	}
+	if (arena->lock) {
+		LOCK_DESTROY((ShuffleLock*)arena->lock);
+		free(arena->lock);
+	}
+	memset(arena, 0, sizeof(*arena));
+}
+
+// a buffer of a large size, the lock is held
+static void *AllocLarge(ShuffleArena *arena, size_t bytes, size_t *capacity)
+{
+	for (MapHeader *large = (MapHeader*)arena->large; large; large = large->next) {
+		size_t size = large->size-sizeof(MapHeader);
+		if (large->released && size>=bytes && size/2<=bytes) {
+			large->released = 0;
+			*capacity = size;
+			return large+1;
+		}
+	}
+	size_t size = (bytes+sizeof(MapHeader)+SHUFFLE_ARENA_CHUNK-1) & ~(size_t)(SHUFFLE_ARENA_CHUNK-1);
+	MapHeader *large = Map(size, arena->flags);
+	if (!large)
+		return NULL;
+	large->next = (MapHeader*)arena->large;
+	arena->large = large;
+	arena->mapped += size;
+	arena->huge_chunks += large->huge;
+	*capacity = size-sizeof(MapHeader);
+	return large+1;
+}
+
+void *ShuffleArenaAlloc(ShuffleArena *arena, size_t bytes, size_t *capacity)
+{
+	void *buffer = NULL;
+	LOCK((ShuffleLock*)arena->lock);
+	if (bytes>MAX_CLASS_BYTES)
+		buffer = AllocLarge(arena, bytes, capacity);
+	else {
+		int size_class = SizeClass(bytes);
+		size_t size = (size_t)MIN_CLASS_BYTES<<size_class;
+		if (arena->free_lists[size_class]) {
+			buffer = arena->free_lists[size_class];
+			arena->free_lists[size_class] = *(void**)buffer;
+		} else {
+			if ((size_t)(arena->end-arena->next)<size) {
+				MapHeader *chunk = Map(SHUFFLE_ARENA_CHUNK, arena->flags);
+				if (chunk) {
+					// the rest of the last chunk goes to the free lists
+					while ((size_t)(arena->end-arena->next)>=MIN_CLASS_BYTES) {
+						int rest_class = SizeClass((size_t)(arena->end-arena->next)+1)-1;
+						if (rest_class>=SHUFFLE_ARENA_CLASSES)
+							rest_class = SHUFFLE_ARENA_CLASSES-1;
+						*(void**)arena->next = arena->free_lists[rest_class];
+						arena->free_lists[rest_class] = arena->next;
+						arena->next += (size_t)MIN_CLASS_BYTES<<rest_class;
+					}
+					chunk->next = (MapHeader*)arena->chunks;
+					arena->chunks = chunk;
+					arena->mapped += SHUFFLE_ARENA_CHUNK;
+					arena->huge_chunks += chunk->huge;
+					arena->next = (unsigned char*)(chunk+1);
+					arena->end = (unsigned char*)chunk + SHUFFLE_ARENA_CHUNK;
+				}
+			}
+			if ((size_t)(arena->end-arena->next)>=size) {
+				buffer = arena->next;
+				arena->next += size;
+			}
+		}
+		*capacity = size;
+	}
+	if (buffer)
+		arena->used += *capacity;
+	UNLOCK((ShuffleLock*)arena->lock);
+	return buffer;
+}
+
+void ShuffleArenaRelease(ShuffleArena *arena, void *buffer, size_t capacity)
+{
+	if (!buffer)
+		return;
+	LOCK((ShuffleLock*)arena->lock);
+	if (capacity>MAX_CLASS_BYTES)
+		((MapHeader*)buffer-1)->released = 1;
+	else {
+		int size_class = SizeClass(capacity);
+		*(void**)buffer = arena->free_lists[size_class];
+		arena->free_lists[size_class] = buffer;
+	}
+	arena->used -= capacity;
+	UNLOCK((ShuffleLock*)arena->lock);
+}
+
+static int *AllocInts(ShuffleArena *arena, int count, int *capacity)
+{
+	size_t bytes = 0;
+	int *values = (int*)ShuffleArenaAlloc(arena, (count>0 ? (size_t)count : 1) * sizeof(int), &bytes);
+	size_t ints = bytes/sizeof(int);
+	*capacity = ints>0x7fffffff ? 0x7fffffff : (int)ints;
+	return values;
+}
+
+static void ReleaseInts(ShuffleArena *arena, int *values, int capacity)
+{
+	if (values)	// the capacity of a large buffer can be more than an int count
+		ShuffleArenaRelease(arena, values, (size_t)capacity>MAX_CLASS_BYTES/sizeof(int) ?
+			((MapHeader*)values-1)->size-sizeof(MapHeader) : (size_t)capacity*sizeof(int));
+}
+
+int ShuffledHandleInit(ShuffledHandle *handle, ShuffleArena *arena, const int *sorted_array, int count)
+{
+	handle->arena = arena;
+	handle->count = 0;
+	handle->values = AllocInts(arena, count+1, &handle->capacity);	// room for an insert
+	if (!handle->values) {
+		handle->capacity = 0;
+		return 0;
+	}
+	if (count)
+		memcpy(handle->values, sorted_array, count * sizeof(int));
+	ShuffleSortedArray(handle->values, count);
+	handle->count = count;
+	return 1;
+}
+
+void ShuffledHandleFree(ShuffledHandle *handle)
+{
+	ReleaseInts(handle->arena, handle->values, handle->capacity);
+	handle->values = NULL;
+	handle->count = 0;
+	handle->capacity = 0;
+}
+
+int ShuffledHandleSearch(const ShuffledHandle *handle, int value)
+{
+	return ShuffledBinarySearchFast(value, handle->values, handle->count);
+}
+
+int ShuffledHandleReserve(ShuffledHandle *handle, int capacity)
+{
+	if (capacity<=handle->capacity)
+		return 1;
+	int new_capacity;
+	int *values = AllocInts(handle->arena, capacity, &new_capacity);
+	if (!values)
+		return 0;
+	if (handle->count)
+		memcpy(values, handle->values, handle->count * sizeof(int));
+	ReleaseInts(handle->arena, handle->values, handle->capacity);
+	handle->values = values;
+	handle->capacity = new_capacity;
+	return 1;
+}
+
+int ShuffledHandleInsert(ShuffledHandle *handle, int value)
+{
+	if (ShuffledBinarySearchFast(value, handle->values, handle->count)>=0)
+		return 0;
+	// InsertShuffledArrayValue needs room for one more value
+	if (handle->count+1>handle->capacity &&
+		!ShuffledHandleReserve(handle, handle->capacity<0x40000000 ? handle->capacity*2 : 0x7fffffff))
+		return -1;
+	handle->count = InsertShuffledArrayValue(value, handle->values, handle->count);
+	return 1;
+}
+
+int ShuffledHandleRemove(ShuffledHandle *handle, int value)
+{
+	int count = RemoveShuffledArrayValue(value, handle->values, handle->count);
+	if (count==handle->count)
+		return 0;
+	handle->count = count;
+	return 1;
+}
+
+int ShuffledHandleRebuild(ShuffledHandle *handle, const int *unsorted, int count)
+{
+	int capacity, scratch_capacity;
+	int *values = AllocInts(handle->arena, count+1, &capacity);
+	int *scratch = AllocInts(handle->arena, count, &scratch_capacity);
+	if (!values || !scratch) {
+		ReleaseInts(handle->arena, values, capacity);
+		ReleaseInts(handle->arena, scratch, scratch_capacity);
+		return -1;
+	}
+	if (count)
+		memcpy(values, unsorted, count * sizeof(int));
+	count = BuildShuffledArrayScratch(values, count, scratch, SHUFFLE_BUILD_UNIQUE);
+	ReleaseInts(handle->arena, scratch, scratch_capacity);
+	ReleaseInts(handle->arena, handle->values, handle->capacity);
+	handle->values = values;
+	handle->capacity = capacity;
+	handle->count = count;
+	return count;
+}
@@ -0,0 +1,58 @@
+#ifndef __BINSHUFFLE_ARENA_H__
+#define __BINSHUFFLE_ARENA_H__
+
+#include "binsearchshuffle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shuffled arrays that own their buffers, allocated from an arena of huge pages, see binsearchshuffle_arena.c
+
+#define SHUFFLE_ARENA_CHUNK (2<<20)		// bytes the arena maps at a time, one huge page
+#define SHUFFLE_ARENA_ALIGN 64			// every buffer starts on a cache line
+#define SHUFFLE_ARENA_CLASSES 15		// buffer sizes 64 bytes to 1 MB, larger buffers are mapped on their own
+
+// init flags
+#define SHUFFLE_ARENA_HUGETLB 1		// try reserved huge pages first (Linux MAP_HUGETLB, Windows large pages)
+#define SHUFFLE_ARENA_NO_THP 2		// do not ask for transparent huge pages
+
+typedef struct ShuffleArena {
+	void *chunks;		// mapped chunks
+	void *large;		// buffers larger than the largest class, mapped on their own
+	unsigned char *next, *end;	// unused part of the last chunk
+	void *free_lists[SHUFFLE_ARENA_CLASSES];	// released buffers of each class
+	void *lock;			// the arena can be used from many threads
+	size_t mapped;		// bytes mapped
+	size_t used;		// bytes in buffers not released
+	int flags;
+	int huge_chunks;	// chunks that got reserved huge pages
+} ShuffleArena;
+
+int ShuffleArenaInit(ShuffleArena *arena, int flags); // 0 if out of memory
+void ShuffleArenaFree(ShuffleArena *arena); // unmaps all buffers, released or not
+
+void *ShuffleArenaAlloc(ShuffleArena *arena, size_t bytes, size_t *capacity); // 'capacity' bytes that can be used, NULL if out of memory
+void ShuffleArenaRelease(ShuffleArena *arena, void *buffer, size_t capacity); // keeps the buffer for the next alloc of the same size
+
+// a shuffled array of unique values in an arena buffer with room to grow
+typedef struct ShuffledHandle {
+	ShuffleArena *arena;
+	int *values;		// 'count' shuffled values
+	int count;
+	int capacity;		// ints in 'values'
+} ShuffledHandle;
+
+int ShuffledHandleInit(ShuffledHandle *handle, ShuffleArena *arena, const int *sorted_array, int count); // 0 if out of memory
+void ShuffledHandleFree(ShuffledHandle *handle);
+int ShuffledHandleSearch(const ShuffledHandle *handle, int value); // index of value, -1 if not found
+int ShuffledHandleInsert(ShuffledHandle *handle, int value); // 1 inserted, 0 already there, -1 out of memory
+int ShuffledHandleRemove(ShuffledHandle *handle, int value); // 1 removed, 0 not there
+int ShuffledHandleReserve(ShuffledHandle *handle, int capacity); // 0 if out of memory
+int ShuffledHandleRebuild(ShuffledHandle *handle, const int *unsorted, int count); // new values with BuildShuffledArrayScratch, returns the number of unique values or -1
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+/*
+Shuffled Binary Search for many values at once
+
+Searching one value at a time waits for one cache miss at a time once the
+array is larger than the caches. The batch search keeps a group of searches in
+flight and moves each of them one level at a time, prefetching the next node
+of a search and then moving on to the next search in the group before reading
+it. By the time a search is back to its node the read has had the time of the
+other searches in the group to arrive. A search that is done is replaced by
+the next value right away so the group stays full (asynchronous memory access
+chaining).
+
+- void ShuffledBinarySearchBatch(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices)
+	out_indices[i] is ShuffledBinarySearch(values[i], shuffled_array, count)
+- void ShuffledBinarySearchBatchDeshuffled(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices)
+	out_indices[i] is the linear index of values[i] (-1 if not found), same
+	as DeshuffleIndex of the shuffled index. The linear index is tracked
+	while searching: stepping to the right child skips the lower half and
+	the current node in the linear array, stepping to the left child does
+	not move the start of the block.
+
+SHUFFLE_BATCH_GROUP is the number of searches in flight, it can be set at
+compile time. Around 16 covers the memory latency on most current CPUs.
+*/
+
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_internal.h"
+
+#ifndef SHUFFLE_BATCH_GROUP
+#define SHUFFLE_BATCH_GROUP 16
+#endif
+
+static void ShuffledBinarySearchGroup(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices, int linear)
+{
+	struct { int index, count, first, value; } lane[SHUFFLE_BATCH_GROUP];
+	int next = 0;		// next value to start searching for
+	int active = 0;		// lanes with a search in progress
+
+	for (int l = 0; l<SHUFFLE_BATCH_GROUP; l++) {
+		lane[l].value = next<nvalues ? next++ : -1;
+		lane[l].index = 0;
+		lane[l].count = count;
+		lane[l].first = 0;
+		if (lane[l].value>=0)
+			active++;
+	}
+
+	while (active) {
+		for (int l = 0; l<SHUFFLE_BATCH_GROUP; l++) {
+			if (lane[l].value<0)
+				continue;
+			int index = lane[l].index;
+			int left = lane[l].count;
+			int result = -2;	// -2 = keep searching
+			if (!left)
+				result = -1;
+			else {
+				int read = shuffled_array[index];
+				int value = values[lane[l].value];
+				if (value==read)
+					result = linear ? lane[l].first + left/2 : index;
+				else if (value>read) {
+					lane[l].first += left/2+1;
+					lane[l].index = index + left/2+1;
+					lane[l].count = (left-1)/2;
+				} else {
+					lane[l].index = index+1;
+					lane[l].count = left/2;
+				}
+			}
+			if (result==-2)
+				SHUFFLE_PREFETCH(shuffled_array + lane[l].index);
+			else {
+				out_indices[lane[l].value] = result;
+				lane[l].index = 0;
+				lane[l].count = count;
+				lane[l].first = 0;
+				if (next<nvalues)
+					lane[l].value = next++;
+				else {
+					lane[l].value = -1;
+					active--;
+				}
+			}
+		}
+	}
+}
+
+void ShuffledBinarySearchBatch(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices)
+{
+	ShuffledBinarySearchGroup(values, nvalues, shuffled_array, count, out_indices, 0);
+}
+
+void ShuffledBinarySearchBatchDeshuffled(const int *values, int nvalues, const int *shuffled_array, int count, int *out_indices)
+{
+	ShuffledBinarySearchGroup(values, nvalues, shuffled_array, count, out_indices, 1);
+}
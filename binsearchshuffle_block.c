@@ -0,0 +1,178 @@
+/*
+Block Shuffled Binary Search
+
+The shuffled array keeps the lower half of each block next to its middle value
+but the upper half is count/2+1 values away, once the array is larger than the
+caches each step to the right is another cache miss. The block layout instead
+packs SHUFFLE_BLOCK_KEYS sorted values into each node of a B-tree with
+SHUFFLE_BLOCK_KEYS+1 children per node. With 16 ints a node is one 64 byte
+cache line so each level of the search reads one cache line and there are
+log17(n) levels instead of log2(n).
+
+Nodes are stored breadth first without pointers, the children of node k are
+nodes k*(SHUFFLE_BLOCK_KEYS+1)+1 to k*(SHUFFLE_BLOCK_KEYS+1)+SHUFFLE_BLOCK_KEYS+1.
+The last values are padded with INT_MAX so every node is full, the block array
+is BlockShuffledArraySize(count) ints. Allocate it 64 byte aligned so each
+node is one cache line.
+
+- int BlockShuffledArraySize(int count)
+	- number of ints needed for the block array of 'count' values, 0 when that
+	  is more than INT_MAX
+- void BlockShuffleSortedArray(int *block_array, const int *sorted_array, int count)
+	- builds the block array from a sorted array (not in place)
+- int BlockShuffledBinarySearch(int value, const int *block_array, int count)
+	- finds the index of a value in the block array (-1 if not found)
+- int BlockDeshuffleIndex(int index, int count)
+	- converts an index in the block array into a linear index, -1 for padding
+- void BlockSortShuffledArray(int *sorted_array, const int *block_array, int count)
+	- writes the sorted values of a block array
+
+Each node is searched by counting the keys less than the value which has no
+branches and is vectorized by the compiler, the count is also the child to
+continue in.
+
+SHUFFLE_BLOCK_KEYS can be set at compile time, 16 fills a 64 byte cache line
+with ints. Nodes are packed SHUFFLE_BLOCK_KEYS ints apart so keep it a power of
+two, with 15 keys most nodes would be split over two cache lines.
+*/
+
+#include <limits.h>
+#include "binsearchshuffle.h"
+
+#ifndef SHUFFLE_BLOCK_KEYS
+#define SHUFFLE_BLOCK_KEYS 16
+#endif
+
+#define BLOCK_CHILDREN (SHUFFLE_BLOCK_KEYS+1)
+#define MAX_BLOCK_DEPTH 32
+
+int BlockShuffledArraySize(int count)
+{
+	if (count<=0)
+		return 0;
+	int nodes = count/SHUFFLE_BLOCK_KEYS + (count%SHUFFLE_BLOCK_KEYS!=0);
+	return nodes<=INT_MAX/SHUFFLE_BLOCK_KEYS ? nodes*SHUFFLE_BLOCK_KEYS : 0;	// 0 if the padded array has more than INT_MAX ints
+}
+
+// in-order walk of the nodes, each node has SHUFFLE_BLOCK_KEYS keys and
+// SHUFFLE_BLOCK_KEYS+1 children so it is visited in 2*SHUFFLE_BLOCK_KEYS+1 steps,
+// even steps visit a child and odd steps are a key.
+void BlockShuffleSortedArray(int *block_array, const int *sorted_array, int count)
+{
+	struct { int node, step; } aStack[MAX_BLOCK_DEPTH];
+	int nodes = BlockShuffledArraySize(count) / SHUFFLE_BLOCK_KEYS;
+	int stk = 0;
+	int linear = 0;
+
+	if (!nodes)
+		return;
+	aStack[stk].node = 0;
+	aStack[stk].step = 0;
+	stk++;
+	while (stk) {
+		int node = aStack[stk-1].node;
+		int step = aStack[stk-1].step++;
+		if (step>2*SHUFFLE_BLOCK_KEYS)
+			stk--;
+		else if (step&1) {
+			block_array[node*SHUFFLE_BLOCK_KEYS + step/2] = linear<count ? sorted_array[linear] : INT_MAX;
+			linear++;
+		} else {
+			long long child = (long long)node*BLOCK_CHILDREN + step/2 + 1;
+			if (child<nodes) {
+				aStack[stk].node = (int)child;
+				aStack[stk].step = 0;
+				stk++;
+			}
+		}
+	}
+}
+
+void BlockSortShuffledArray(int *sorted_array, const int *block_array, int count)
+{
+	struct { int node, step; } aStack[MAX_BLOCK_DEPTH];
+	int nodes = BlockShuffledArraySize(count) / SHUFFLE_BLOCK_KEYS;
+	int stk = 0;
+	int linear = 0;
+
+	if (!nodes)
+		return;
+	aStack[stk].node = 0;
+	aStack[stk].step = 0;
+	stk++;
+	while (stk && linear<count) {
+		int node = aStack[stk-1].node;
+		int step = aStack[stk-1].step++;
+		if (step>2*SHUFFLE_BLOCK_KEYS)
+			stk--;
+		else if (step&1)
+			sorted_array[linear++] = block_array[node*SHUFFLE_BLOCK_KEYS + step/2];
+		else {
+			long long child = (long long)node*BLOCK_CHILDREN + step/2 + 1;
+			if (child<nodes) {
+				aStack[stk].node = (int)child;
+				aStack[stk].step = 0;
+				stk++;
+			}
+		}
+	}
+}
+
+int BlockShuffledBinarySearch(int value, const int *block_array, int count)
+{
+	int nodes = BlockShuffledArraySize(count) / SHUFFLE_BLOCK_KEYS;
+	long long node = 0;
+	while (node<nodes) {
+		const int *keys = block_array + node*SHUFFLE_BLOCK_KEYS;
+		int less = 0;
+		for (int i = 0; i<SHUFFLE_BLOCK_KEYS; i++)
+			less += keys[i]<value;
+		if (less<SHUFFLE_BLOCK_KEYS && keys[less]==value) {
+			int index = (int)(node*SHUFFLE_BLOCK_KEYS) + less;
+			// padding is INT_MAX too, a real INT_MAX is always before the padding
+			if (value!=INT_MAX || BlockDeshuffleIndex(index, count)>=0)
+				return index;
+		}
+		node = node*BLOCK_CHILDREN + less + 1;
+	}
+	return -1;	// index not found
+}
+
+// number of nodes in the subtrees of the consecutive nodes first to last
+static long long BlockSubtreeNodes(long long first, long long last, long long nodes)
+{
+	long long total = 0;
+	while (first<nodes) {
+		if (last>=nodes)
+			last = nodes-1;
+		total += last-first+1;
+		first = first*BLOCK_CHILDREN + 1;
+		last = last*BLOCK_CHILDREN + BLOCK_CHILDREN;
+	}
+	return total;
+}
+
+// The linear index is the number of keys before the key in the in-order walk:
+// the keys in the children to the left of the key and the keys to the left in
+// the node, and then the same for each parent up to the root.
+int BlockDeshuffleIndex(int index, int count)
+{
+	long long nodes = BlockShuffledArraySize(count) / SHUFFLE_BLOCK_KEYS;
+	if (index<0 || index>=nodes*SHUFFLE_BLOCK_KEYS)
+		return -1;
+
+	long long node = index / SHUFFLE_BLOCK_KEYS;
+	long long key = index % SHUFFLE_BLOCK_KEYS;
+	long long first_child = node*BLOCK_CHILDREN + 1;
+	long long linear = key + SHUFFLE_BLOCK_KEYS * BlockSubtreeNodes(first_child, first_child+key, nodes);
+	while (node) {
+		long long parent = (node-1) / BLOCK_CHILDREN;
+		long long child = (node-1) % BLOCK_CHILDREN;	// node is this child of the parent
+		first_child = parent*BLOCK_CHILDREN + 1;
+		if (child)
+			linear += SHUFFLE_BLOCK_KEYS * BlockSubtreeNodes(first_child, first_child+child-1, nodes);
+		linear += child;
+		node = parent;
+	}
+	return linear<count ? (int)linear : -1;
+}
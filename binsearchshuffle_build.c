@@ -0,0 +1,119 @@
+/*
+Build a Shuffled Array from Unsorted Values
+
+Sorting with qsort and then calling ShuffleSortedArray is a comparison sort
+with a function call per compare followed by the shuffle. This sorts with a
+radix sort instead, three passes over 11, 11 and 10 bits of the keys between
+the array and a scratch buffer, and the sorted values end up in the scratch
+buffer so the shuffle is ShuffleSortedArrayCopy back into the array. Duplicate
+keys can be removed on the way.
+
+- int BuildShuffledArray(int *unsorted, int count)
+	- sorts and shuffles the values, returns 'count', allocates the scratch buffer
+- int BuildShuffledArrayScratch(int *unsorted, int count, int *scratch, int flags)
+	- same with room for 'count' ints in scratch, SHUFFLE_BUILD_UNIQUE
+	  removes duplicate keys and returns the number of keys left
+
+The counts of all three digits are made in one pass before sorting, a pass
+where every key has the same digit is skipped. If an odd number of passes is
+skipped the sorted values are in the array instead and are shuffled with
+ShuffleSortedArrayScratch. Below SHUFFLE_BUILD_SMALL values an insertion sort
+is faster than clearing the counts.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle.h"
+
+#ifndef SHUFFLE_BUILD_SMALL
+#define SHUFFLE_BUILD_SMALL 64
+#endif
+
+#define RADIX_PASSES 3
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1<<RADIX_BITS)
+
+// flip the sign bit so negative keys sort before positive keys as unsigned
+static unsigned int RadixDigit(int value, int pass)
+{
+	return (((unsigned int)value ^ 0x80000000u) >> (pass*RADIX_BITS)) & (RADIX_BUCKETS-1);
+}
+
+static int CompareInts(const void *a, const void *b)
+{
+	int x = *(const int*)a, y = *(const int*)b;
+	return (x>y) - (x<y);
+}
+
+static int UniqueSorted(int *sorted, int count)
+{
+	int unique = count ? 1 : 0;
+	for (int i = 1; i<count; i++) {
+		if (sorted[i]!=sorted[unique-1])
+			sorted[unique++] = sorted[i];
+	}
+	return unique;
+}
+
+int BuildShuffledArrayScratch(int *unsorted, int count, int *scratch, int flags)
+{
+	if (count<SHUFFLE_BUILD_SMALL) {
+		for (int i = 1; i<count; i++) {
+			int value = unsorted[i];
+			int j = i;
+			for (; j>0 && unsorted[j-1]>value; j--)
+				unsorted[j] = unsorted[j-1];
+			unsorted[j] = value;
+		}
+		if (flags & SHUFFLE_BUILD_UNIQUE)
+			count = UniqueSorted(unsorted, count);
+		ShuffleSortedArray(unsorted, count);
+		return count;
+	}
+
+	int counts[RADIX_PASSES * RADIX_BUCKETS];
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i<count; i++) {
+		for (int pass = 0; pass<RADIX_PASSES; pass++)
+			counts[pass*RADIX_BUCKETS + RadixDigit(unsorted[i], pass)]++;
+	}
+
+	int *source = unsorted;
+	int *dest = scratch;
+	for (int pass = 0; pass<RADIX_PASSES; pass++) {
+		int *offsets = counts + pass*RADIX_BUCKETS;
+		if (offsets[RadixDigit(source[0], pass)]==count)
+			continue;	// all keys have the same digit, the order does not change
+		for (int b = 0, offset = 0; b<RADIX_BUCKETS; b++) {
+			int n = offsets[b];
+			offsets[b] = offset;
+			offset += n;
+		}
+		for (int i = 0; i<count; i++)
+			dest[offsets[RadixDigit(source[i], pass)]++] = source[i];
+		int *tmp = source;
+		source = dest;
+		dest = tmp;
+	}
+
+	if (flags & SHUFFLE_BUILD_UNIQUE)
+		count = UniqueSorted(source, count);
+	if (source==scratch)
+		ShuffleSortedArrayCopy(unsorted, scratch, count);
+	else
+		ShuffleSortedArrayScratch(unsorted, count, scratch);
+	return count;
+}
+
+int BuildShuffledArray(int *unsorted, int count)
+{
+	int *scratch = count>=SHUFFLE_BUILD_SMALL ? (int*)malloc(count * sizeof(int)) : NULL;
+	if (count>=SHUFFLE_BUILD_SMALL && !scratch) {
+		qsort(unsorted, count, sizeof(int), CompareInts);
+		ShuffleSortedArray(unsorted, count);
+		return count;
+	}
+	count = BuildShuffledArrayScratch(unsorted, count, scratch, 0);
+	free(scratch);
+	return count;
+}
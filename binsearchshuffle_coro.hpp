@@ -0,0 +1,362 @@
+#ifndef __BINSHUFFLE_CORO_HPP__
+#define __BINSHUFFLE_CORO_HPP__
+
+// Coroutine searches, C++20
+//
+// A search of a large shuffled array waits for memory at almost every level.
+// co_await shuffled_search prefetches the next value and suspends the awaiting
+// coroutine before each cache line it hasn't read yet, so an executor can run
+// the levels of many searches in turn and the loads of all of them are in
+// flight at the same time, like ShuffledBinarySearchBatch but for lookups that
+// come from unrelated coroutines:
+//
+//	shuffle::round_robin_executor executor;
+//	executor.spawn([](shuffle::round_robin_executor &executor, const int *array, int count, int value) -> shuffle::task<void> {
+//		int index = co_await shuffle::shuffled_search(executor, value, array, count);
+//		...
+//	}(executor, array, count, value));
+//	executor.run();	// until every spawned task is done
+//
+// The search is an awaiter in the frame of the awaiting coroutine rather than a
+// coroutine of its own, the executor steps it one line at a time and resumes
+// the awaiting coroutine when it is done, so a search allocates nothing. The
+// top SHUFFLE_CORO_CACHED_LEVELS levels are read by every search and stay in
+// the caches so they are read without suspending. A step costs a few
+// nanoseconds, so this pays for arrays larger than the last level cache with
+// tens to hundreds of searches in flight, not for arrays in the caches.
+//
+// The arguments of a coroutine are copied into its frame, so pass the executor
+// and arrays by reference or pointer and keep them alive until run returns.
+// task frames come from a free list of each thread. An executor and the tasks
+// on it belong to one thread.
+
+#if !defined(__cpp_impl_coroutine) || __cplusplus<202002L
+#error "binsearchshuffle_coro.hpp needs C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SHUFFLE_CORO_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define SHUFFLE_CORO_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define SHUFFLE_CORO_PREFETCH(address) ((void)(address))
+#endif
+
+#ifndef SHUFFLE_CORO_CACHED_LEVELS
+#define SHUFFLE_CORO_CACHED_LEVELS 8	// top levels shuffled_search reads without suspending, 255 values
+#endif
+
+namespace shuffle {
+
+namespace detail {
+
+// coroutine frames in 64 byte size classes, kept on a list per thread when they are freed
+class FramePool {
+public:
+	static void *Alloc(std::size_t size)
+	{
+		std::size_t bucket = (size+kLine-1)/kLine;
+		if (bucket>=kBuckets)
+			return ::operator new(size);
+		Node *&list = Lists().heads[bucket];
+		if (Node *node = list) {
+			list = node->next;
+			return node;
+		}
+		return ::operator new(bucket*kLine);
+	}
+
+	static void Free(void *frame, std::size_t size)
+	{
+		std::size_t bucket = (size+kLine-1)/kLine;
+		if (bucket>=kBuckets) {
+			::operator delete(frame);
+			return;
+		}
+		Node *node = static_cast<Node*>(frame);
+		node->next = Lists().heads[bucket];
+		Lists().heads[bucket] = node;
+	}
+
+private:
+	static constexpr std::size_t kLine = 64;
+	static constexpr std::size_t kBuckets = 16;	// frames up to 960 bytes
+
+	struct Node { Node *next; };
+	struct ThreadLists {
+		Node *heads[kBuckets] = {};
+		~ThreadLists()
+		{
+			for (Node *head : heads) {
+				while (head) {
+					Node *next = head->next;
+					::operator delete(head);
+					head = next;
+				}
+			}
+		}
+	};
+	static ThreadLists &Lists()
+	{
+		thread_local ThreadLists lists;
+		return lists;
+	}
+};
+
+template<typename T>
+struct TaskResult {
+	T value{};
+	void return_value(T result) { value = std::move(result); }
+	T Take() { return std::move(value); }
+};
+
+template<>
+struct TaskResult<void> {
+	void return_void() {}
+	void Take() {}
+};
+
+}	// namespace detail
+
+// a coroutine that starts when it is awaited or spawned, co_await gives its co_return value
+template<typename T>
+class task {
+public:
+	struct promise_type : detail::TaskResult<T> {
+		std::coroutine_handle<> continuation;	// resumed when the task is done, none for a spawned task
+		std::exception_ptr exception;
+		bool detached = false;					// spawned, the frame frees itself when done
+
+		task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		struct FinalAwaiter {
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				promise_type &promise = handle.promise();
+				if (promise.continuation)
+					return promise.continuation;
+				if (promise.detached)
+					handle.destroy();
+				return std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception()
+		{
+			if (detached)
+				std::terminate();	// nobody to rethrow it to
+			exception = std::current_exception();
+		}
+
+		static void *operator new(std::size_t size) { return detail::FramePool::Alloc(size); }
+		static void operator delete(void *frame, std::size_t size) { detail::FramePool::Free(frame, size); }
+	};
+
+	task() = default;
+	task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+	task &operator=(task &&other) noexcept
+	{
+		if (this!=&other) {
+			if (handle_)
+				handle_.destroy();
+			handle_ = std::exchange(other.handle_, nullptr);
+		}
+		return *this;
+	}
+	task(const task&) = delete;
+	task &operator=(const task&) = delete;
+	~task()
+	{
+		if (handle_)
+			handle_.destroy();
+	}
+
+	bool done() const { return !handle_ || handle_.done(); }
+
+	// awaiting a task runs it until it suspends, then the awaiting coroutine continues when it is done
+	bool await_ready() const noexcept { return done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle_.promise().continuation = awaiting;
+		return handle_;
+	}
+	T await_resume()
+	{
+		if (handle_.promise().exception)
+			std::rethrow_exception(handle_.promise().exception);
+		return handle_.promise().Take();
+	}
+
+private:
+	friend class round_robin_executor;
+	explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+// resumes suspended coroutines in the order they suspended in, on the thread that calls run
+class round_robin_executor {
+public:
+	struct YieldAwaiter {
+		round_robin_executor *executor;
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { executor->Push(ResumeHandle, handle.address()); }
+		void await_resume() const noexcept {}
+	};
+
+	// lets the other coroutines run first
+	YieldAwaiter yield() { return YieldAwaiter{ this }; }
+	// starts loading an address and lets the other coroutines run while it loads
+	YieldAwaiter prefetch(const void *address)
+	{
+		SHUFFLE_CORO_PREFETCH(address);
+		return YieldAwaiter{ this };
+	}
+
+	// the executor owns the task and it starts in run, its frame is freed when it is done
+	template<typename T>
+	void spawn(task<T> spawned)
+	{
+		if (spawned.done())
+			return;
+		auto handle = std::exchange(spawned.handle_, nullptr);
+		handle.promise().detached = true;
+		Push(ResumeHandle, handle.address());
+	}
+
+	// resumes until no coroutine is left that can run, the number of resumes
+	std::size_t run()
+	{
+		std::size_t resumes = 0;
+		while (first_!=end_) {
+			Ready ready = ready_[first_ & (ready_.size()-1)];
+			first_++;
+			ready.resume(ready.state);
+			resumes++;
+		}
+		return resumes;
+	}
+
+	bool empty() const { return first_==end_; }
+
+	// an awaiter that is not a coroutine runs 'resume' instead, it pushes itself again or resumes its coroutine
+	void Push(void (*resume)(void *state), void *state)
+	{
+		if (end_-first_==ready_.size()) {
+			// a power of two ring, the entries are moved to the start of a larger one
+			std::vector<Ready> grown(ready_.empty() ? 64 : 2*ready_.size());
+			for (std::size_t i = first_; i!=end_; i++)
+				grown[i-first_] = ready_[i & (ready_.size()-1)];
+			end_ -= first_;
+			first_ = 0;
+			ready_.swap(grown);
+		}
+		ready_[end_++ & (ready_.size()-1)] = Ready{ resume, state };
+	}
+
+private:
+	struct Ready {
+		void (*resume)(void *state);
+		void *state;
+	};
+	static void ResumeHandle(void *address) { std::coroutine_handle<>::from_address(address).resume(); }
+
+	std::vector<Ready> ready_;	// ring of what can run
+	std::size_t first_ = 0, end_ = 0;
+};
+
+namespace detail {
+
+// a search that the executor steps through one cache line at a time, it lives
+// in the frame of the awaiting coroutine so a search allocates nothing
+template<typename T, typename Compare>
+class SearchAwaiter {
+public:
+	SearchAwaiter(round_robin_executor &executor, T value, const T *shuffled_array, int count, Compare compare, int cached_levels)
+		: executor_(&executor), value_(std::move(value)), array_(shuffled_array), count_(count), cached_levels_(cached_levels), compare_(compare) {}
+
+	// the levels in the caches and a search that ends in them don't suspend
+	bool await_ready() { return Step(); }
+	void await_suspend(std::coroutine_handle<> awaiting)
+	{
+		awaiting_ = awaiting;
+		executor_->Push(Resume, this);
+	}
+	int await_resume() const noexcept { return found_; }
+
+private:
+	static void Resume(void *state)
+	{
+		SearchAwaiter *search = static_cast<SearchAwaiter*>(state);
+		if (search->Step())
+			search->awaiting_.resume();
+		else
+			search->executor_->Push(Resume, search);
+	}
+
+	// reads levels until the next one is on a line that isn't loaded yet, true when the search is done
+	bool Step()
+	{
+		while (count_>0) {
+			const T *address = array_+index_;
+			std::uintptr_t line = reinterpret_cast<std::uintptr_t>(address)/64;
+			// the left child is next to its parent and often on the same line
+			if (level_>=cached_levels_ && line!=line_) {
+				line_ = line;
+				SHUFFLE_CORO_PREFETCH(address);
+				return false;
+			}
+			level_++;
+			const T &read = *address;
+			if (compare_(read, value_)) {
+				index_ += count_/2+1;
+				count_ = (count_-1)/2;
+			} else if (compare_(value_, read)) {
+				index_++;
+				count_ /= 2;
+			} else {
+				found_ = index_;
+				return true;
+			}
+		}
+		return true;
+	}
+
+	round_robin_executor *executor_;
+	T value_;
+	const T *array_;
+	int index_ = 0;
+	int count_;
+	int level_ = 0;
+	int cached_levels_;
+	int found_ = -1;
+	std::uintptr_t line_ = ~std::uintptr_t(0);	// line of the last prefetch
+	Compare compare_;
+	std::coroutine_handle<> awaiting_;
+};
+
+}	// namespace detail
+
+// co_await gives the shuffled index of a value in a shuffled array like ShuffledBinarySearch, -1 if not found,
+// the awaiting coroutine is suspended on the executor before each cache line it reads below the top cached_levels
+template<typename T, typename Compare = std::less<>>
+detail::SearchAwaiter<T, Compare> shuffled_search(round_robin_executor &executor, T value, const T *shuffled_array, int count,
+	Compare compare = Compare(), int cached_levels = SHUFFLE_CORO_CACHED_LEVELS)
+{
+	return detail::SearchAwaiter<T, Compare>(executor, std::move(value), shuffled_array, count, compare, cached_levels);
+}
+
+}	// namespace shuffle
+
+#endif
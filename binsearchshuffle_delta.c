@@ -0,0 +1,140 @@
+/*
+Shuffled Array with a Delta
+
+Inserting or removing one value in a shuffled array sorts and shuffles the
+whole array. When updates come in one at a time the delta keeps them next to
+the shuffled array instead: a small sorted array of inserted values and a small
+sorted array of removed values (tombstones). A lookup searches the shuffled
+array and the two small arrays, and once there are max_delta updates they are
+merged into the shuffled array with ShuffledArrayBulkUpdate.
+
+- void ShuffledDeltaInit(ShuffledDelta *delta, int *shuffled_array, int count, int capacity, int *delta_buffer, int max_delta, int *scratch)
+	- shuffled_array has room for 'capacity' ints, delta_buffer for 2*max_delta
+	  ints and scratch is NULL or room for 'capacity' ints
+- int ShuffledDeltaInsert(ShuffledDelta *delta, int value)
+	- 1 if the value was inserted, 0 if it was already there, -1 if full
+- int ShuffledDeltaRemove(ShuffledDelta *delta, int value)
+	- 1 if the value was removed, 0 if it was not there
+- int ShuffledDeltaContains(const ShuffledDelta *delta, int value)
+	- 1 if the value is in the shuffled array or the delta
+- int ShuffledDeltaCount(const ShuffledDelta *delta)
+	- number of values including the delta
+- void ShuffledDeltaMerge(ShuffledDelta *delta)
+	- merges the delta into the shuffled array now
+
+A value in the tombstones is always in the shuffled array and a value in the
+inserts never is, so each value is in at most one of the three arrays. The
+delta arrays are kept sorted with memmove which is cheap for the few hundred
+or thousand values a delta should have.
+*/
+
+#include <string.h>
+#include "binsearchshuffle.h"
+
+// index of the first value not less than 'value'
+static int SortedLowerBound(int value, const int *sorted_array, int count)
+{
+	int first = 0;
+	while (count) {
+		int half = count/2;
+		if (sorted_array[first+half]<value) {
+			first += half+1;
+			count -= half+1;
+		} else
+			count = half;
+	}
+	return first;
+}
+
+static int SortedAdd(int value, int *sorted_array, int count)
+{
+	int slot = SortedLowerBound(value, sorted_array, count);
+	memmove(sorted_array+slot+1, sorted_array+slot, (count-slot) * sizeof(int));
+	sorted_array[slot] = value;
+	return count+1;
+}
+
+static int SortedRemove(int slot, int *sorted_array, int count)
+{
+	memmove(sorted_array+slot, sorted_array+slot+1, (count-slot-1) * sizeof(int));
+	return count-1;
+}
+
+void ShuffledDeltaInit(ShuffledDelta *delta, int *shuffled_array, int count, int capacity, int *delta_buffer, int max_delta, int *scratch)
+{
+	delta->shuffled_array = shuffled_array;
+	delta->count = count;
+	delta->capacity = capacity;
+	delta->inserts = delta_buffer;
+	delta->ninserts = 0;
+	delta->removes = delta_buffer + max_delta;
+	delta->nremoves = 0;
+	delta->max_delta = max_delta;
+	delta->scratch = scratch;
+}
+
+void ShuffledDeltaMerge(ShuffledDelta *delta)
+{
+	if (delta->ninserts || delta->nremoves) {
+		delta->count = ShuffledArrayBulkUpdate(delta->shuffled_array, delta->count, delta->inserts, delta->ninserts,
+			delta->removes, delta->nremoves, delta->scratch);
+		delta->ninserts = 0;
+		delta->nremoves = 0;
+	}
+}
+
+int ShuffledDeltaInsert(ShuffledDelta *delta, int value)
+{
+	int slot = SortedLowerBound(value, delta->removes, delta->nremoves);
+	if (slot<delta->nremoves && delta->removes[slot]==value) {	// removed from the shuffled array, bring it back
+		delta->nremoves = SortedRemove(slot, delta->removes, delta->nremoves);
+		return 1;
+	}
+	if (ShuffledBinarySearchFast(value, delta->shuffled_array, delta->count)>=0)
+		return 0;
+	slot = SortedLowerBound(value, delta->inserts, delta->ninserts);
+	if (slot<delta->ninserts && delta->inserts[slot]==value)
+		return 0;
+	if (delta->count+delta->ninserts>=delta->capacity) {
+		ShuffledDeltaMerge(delta);	// tombstones may make room
+		if (delta->count>=delta->capacity)
+			return -1;
+	}
+	delta->ninserts = SortedAdd(value, delta->inserts, delta->ninserts);
+	if (delta->ninserts+delta->nremoves>=delta->max_delta)
+		ShuffledDeltaMerge(delta);
+	return 1;
+}
+
+int ShuffledDeltaRemove(ShuffledDelta *delta, int value)
+{
+	int slot = SortedLowerBound(value, delta->inserts, delta->ninserts);
+	if (slot<delta->ninserts && delta->inserts[slot]==value) {
+		delta->ninserts = SortedRemove(slot, delta->inserts, delta->ninserts);
+		return 1;
+	}
+	if (ShuffledBinarySearchFast(value, delta->shuffled_array, delta->count)<0)
+		return 0;
+	slot = SortedLowerBound(value, delta->removes, delta->nremoves);
+	if (slot<delta->nremoves && delta->removes[slot]==value)
+		return 0;	// already removed
+	delta->nremoves = SortedAdd(value, delta->removes, delta->nremoves);
+	if (delta->ninserts+delta->nremoves>=delta->max_delta)
+		ShuffledDeltaMerge(delta);
+	return 1;
+}
+
+int ShuffledDeltaContains(const ShuffledDelta *delta, int value)
+{
+	if (ShuffledBinarySearchFast(value, delta->shuffled_array, delta->count)>=0) {
+		int slot = SortedLowerBound(value, delta->removes, delta->nremoves);
+		return slot==delta->nremoves || delta->removes[slot]!=value;
+	}
+	int slot = SortedLowerBound(value, delta->inserts, delta->ninserts);
+	return slot<delta->ninserts && delta->inserts[slot]==value;
+}
+
+int ShuffledDeltaCount(const ShuffledDelta *delta)
+{
+	return delta->count + delta->ninserts - delta->nremoves;
+}
@@ -0,0 +1,173 @@
+/*
+Eytzinger Layout
+
+The shuffled array is the sorted values in pre-order of a binary search tree
+(node, lower half, upper half). The Eytzinger layout stores the same tree
+breadth first instead: the root first, then the two nodes of the second level,
+then the four of the third level and so on, so the children of node k are at
+2k+1 and 2k+2.
+
+The upside is that all the nodes four levels below node k are the sixteen
+values starting at 16k+15, which is one cache line for ints, so the search can
+prefetch the line it needs four steps ahead. The downside is that the first
+levels are spread out the same way as a regular binary search, but those are
+in the cache anyway.
+
+- void EytzingerShuffleSortedArray(int *array, int count)
+	- reorders a sorted array in-place without extra memory
+- int EytzingerBinarySearch(int value, const int *eytzinger_array, int count)
+	- finds the index of a value (returns -1 if value was not found)
+- int EytzingerDeshuffleIndex(int index, int count)
+	- converts an index into a linear index, this is a few shifts
+- void EytzingerSortShuffledArray(int *array, int count)
+	- sorts an Eytzinger array in-place
+
+In-place reorder
+
+The leaves on the last level are the values at even positions of the first
+part of the sorted array (leaf, parent, leaf, grandparent, leaf, ...) and the
+last level comes last in the array. So the leaves are moved to the end, keeping
+all values in order, and the remaining values are a sorted array for a tree
+that is one level shorter, which is reordered the same way.
+
+Moving every other value to the end is done by splitting the values in two
+halves, doing each half and swapping the middle two parts with a rotation.
+This is O(n log n) moves but only needs a small stack.
+*/
+
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_internal.h"
+
+static int FloorLog2(unsigned int value)
+{
+	int log2 = 0;
+	while (value>>=1)
+		log2++;
+	return log2;
+}
+
+static void ReverseInts(int *array, int count)
+{
+	for (int i = 0, j = count-1; i<j; i++, j--) {
+		int tmp = array[i];
+		array[i] = array[j];
+		array[j] = tmp;
+	}
+}
+
+// rotate 'count' values so the value at 'first' is the first
+static void RotateInts(int *array, int count, int first)
+{
+	if (first<=0 || first>=count)
+		return;
+	ReverseInts(array, first);
+	ReverseInts(array+first, count-first);
+	ReverseInts(array, count);
+}
+
+// a0 b0 a1 b1 .. => b0 b1 .. a0 a1 ..
+static void Unshuffle(int *array, int pairs)
+{
+	if (pairs<=1) {
+		if (pairs) {
+			int tmp = array[0];
+			array[0] = array[1];
+			array[1] = tmp;
+		}
+		return;
+	}
+	int lower = pairs/2;
+	Unshuffle(array, lower);
+	Unshuffle(array + 2*lower, pairs-lower);
+	// b(lower) a(lower) b(upper) a(upper), swap the middle parts
+	RotateInts(array + lower, pairs, lower);
+}
+
+// b0 b1 .. a0 a1 .. => a0 b0 a1 b1 .., reverse of Unshuffle
+static void Reshuffle(int *array, int pairs)
+{
+	if (pairs<=1) {
+		if (pairs) {
+			int tmp = array[0];
+			array[0] = array[1];
+			array[1] = tmp;
+		}
+		return;
+	}
+	int lower = pairs/2;
+	RotateInts(array + lower, pairs, pairs-lower);
+	Reshuffle(array, lower);
+	Reshuffle(array + 2*lower, pairs-lower);
+}
+
+void EytzingerShuffleSortedArray(int *array, int count)
+{
+	while (count>1) {
+		int upper = (1<<FloorLog2((unsigned int)count))-1;	// nodes above the last level
+		int leaves = count-upper;
+		// leaf, parent, leaf, .. leaf, parents => parents, leaves, leaf, parents
+		Unshuffle(array, leaves-1);
+		// => parents, parents, leaves, leaf
+		RotateInts(array + leaves-1, count-(leaves-1), leaves);
+		count = upper;
+	}
+}
+
+void EytzingerSortShuffledArray(int *array, int count)
+{
+	int sizes[32];	// tree sizes in the order EytzingerShuffleSortedArray made them
+	int levels = 0;
+	while (count>1) {
+		sizes[levels++] = count;
+		count = (1<<FloorLog2((unsigned int)count))-1;
+	}
+	while (levels--) {
+		count = sizes[levels];
+		int leaves = count-((1<<FloorLog2((unsigned int)count))-1);
+		RotateInts(array + leaves-1, count-(leaves-1), count-(leaves-1)-leaves);
+		Reshuffle(array, leaves-1);
+	}
+}
+
+// k>>count_trailing_ones(k)+1, goes back up from where the search stopped to the
+// last node where the value was not greater.
+static size_t EytzingerLowerBound(size_t k)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return k >> (__builtin_ctzll(~(unsigned long long)k)+1);
+#else
+	while (k&1)
+		k >>= 1;
+	return k>>1;
+#endif
+}
+
+int EytzingerBinarySearch(int value, const int *eytzinger_array, int count)
+{
+	size_t k = 1;	// one based node index, children are 2k and 2k+1
+	while (k<=(size_t)count) {
+		SHUFFLE_PREFETCH(eytzinger_array + k*16 - 1);	// 4 levels ahead
+		k = 2*k + (eytzinger_array[k-1]<value);
+	}
+	k = EytzingerLowerBound(k);
+	if (k && eytzinger_array[k-1]==value)
+		return (int)(k-1);
+	return -1;	// index not found
+}
+
+int EytzingerDeshuffleIndex(int index, int count)
+{
+	if (index<0 || index>=count)
+		return -1;
+
+	long long k = (long long)index+1;
+	int depth = FloorLog2((unsigned int)k);
+	int levels = FloorLog2((unsigned int)count)+1;
+	// in-order position if the last level was full
+	long long linear = ((2*(k-(1LL<<depth))+1) << (levels-1-depth)) - 1;
+	// leaves on the last level are every other value from the start, remove
+	// the ones missing on a partial last level
+	long long leaves = count-((1LL<<(levels-1))-1);
+	long long missing = (linear+1)/2 - leaves;
+	return (int)(missing>0 ? linear-missing : linear);
+}
@@ -0,0 +1,736 @@
+﻿/*
+Shuffled Index Files
+
+Sorting and shuffling a large table on every start is wasted work when the
+table only changes offline. A shuffled index file holds the keys already in
+their layout and any number of value arrays, and opening it maps the file
+read-only so the searches run on the mapped pages without copying anything.
+Opening a 2 GB table is then only the page faults of the searches.
+
+- int ShuffleFileWrite(const char *path, const void *keys, int count, int key_type, int layout, const void **values, const size_t *sizes, int arrays)
+	- writes keys that are already in 'layout' and 'arrays' value arrays in
+	  sorted order, values[a] has 'count' values of sizes[a] bytes
+- int ShuffleFileOpen(ShuffleFile *file, const char *path, int flags)
+	- maps a file and checks the header, the flags are hints for how the pages
+	  are read, SHUFFLE_FILE_VERIFY also checks the checksum
+- int ShuffleFileSearch(const ShuffleFile *file, int value)
+	- searches SHUFFLE_KEY_I32 keys in the layout of the file
+- int ShuffleFileLinearIndex(const ShuffleFile *file, int index)
+	- DeshuffleIndex for the layout of the file
+- const void *ShuffleFileLookupValue(const ShuffleFile *file, int value, int array)
+	- search, deshuffle and the address of the value in a value array
+- int ShuffleFileStreamBegin(ShuffleFileStream *stream, const char *path, int count, int key_type, const size_t *sizes, int arrays, int buffer_keys)
+- int ShuffleFileStreamAdd(ShuffleFileStream *stream, const void *keys, int n, const void **values)
+- int ShuffleFileStreamEnd(ShuffleFileStream *stream)
+	- writes a SHUFFLE_LAYOUT_SHUFFLED file from keys and values in sorted
+	  order, the same file as ShuffleFileWrite, with memory for buffer_keys
+	  keys instead of the whole table
+
+Format
+
+The header (ShuffleFileHeader) is followed by a table of value arrays
+(ShuffleFileArray), then the keys and then the value arrays, each starting at
+a multiple of SHUFFLE_FILE_ALIGNMENT and the file is padded with zeros to a
+multiple of it too. Page aligned arrays let the OS map huge pages where it
+can. Other key types are stored as well, the typed functions can search
+file->keys directly.
+
+The version is incremented when the format changes, a file of any other
+version is rejected. byte_order is checked so a file from a machine with the other byte
+order is rejected instead of read wrong.
+
+The checksum is a sum of a mix of each 64 bit word with its file offset over
+the whole file, with the checksum itself taken as zero, so a changed count or
+offset in the header is found as well as a changed key. A sum does not depend
+on the order the words are added in so parts of the file can be checksummed in
+any order while the file is written.
+
+The header is checked before anything is read through it. The keys and each
+value array have to be in the file and start at a multiple of the alignment of
+the file, which is a power of two of at least 8, so the keys can be read as
+their type.
+
+Streaming
+
+A table larger than memory can't be shuffled in memory first. The keys of any
+subtree are consecutive in sorted order and consecutive in the shuffled array
+too, in the range from its index to index+count, so a stream splits the tree
+into the largest subtrees of at most buffer_keys keys, the blocks, and shuffles
+the keys of a block in the buffer as they are added (ShuffleIndex within the
+block). Once the last key of a block is added the block is one write at its
+index. The blocks come in the order of their indexes so the writes move
+forward through the file, leaving a hole for each key above the blocks. Those
+top keys, at most about 2*count/buffer_keys of them, are kept in memory and written
+into the holes at the end. The values are in sorted order already and each
+array is written in order through its own FILE.
+
+Blocks start at any key so their first and last 64 bit words can be shared
+with a top key. Such parts of words are kept and put together at the end,
+the order independent checksum does the rest.
+*/
+
+#if !defined(_WIN32)
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char s_magic[8] = "SHUFIDX";
+
+static uint64_t Mix(uint64_t x)
+{
+	// splitmix64 finalizer, every bit of the word and offset changes about half of the bits
+	x ^= x>>30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x>>27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x>>31;
+	return x;
+}
+
+uint64_t ShuffleFileChecksum(const void *data, uint64_t bytes, uint64_t offset)
+{
+	const unsigned char *bytes_in = (const unsigned char*)data;
+	uint64_t sum = 0;
+	for (uint64_t at = 0; at<bytes; at += 8) {
+		uint64_t word = 0;
+		memcpy(&word, bytes_in+at, bytes-at<8 ? (size_t)(bytes-at) : 8);
+		sum += Mix(word + Mix(offset+at));
+	}
+	return sum;
+}
+
+static int KeySize(int key_type)
+{
+	switch (key_type) {
+		case SHUFFLE_KEY_I32:
+		case SHUFFLE_KEY_U32:
+		case SHUFFLE_KEY_F32:
+			return 4;
+		case SHUFFLE_KEY_I64:
+		case SHUFFLE_KEY_U64:
+		case SHUFFLE_KEY_F64:
+			return 8;
+	}
+	return 0;
+}
+
+static uint64_t LayoutKeys(int layout, int count)
+{
+	return layout==SHUFFLE_LAYOUT_BLOCK ? (uint64_t)BlockShuffledArraySize(count) : (uint64_t)count;
+}
+
+static uint64_t Align(uint64_t offset)
+{
+	return (offset+SHUFFLE_FILE_ALIGNMENT-1) / SHUFFLE_FILE_ALIGNMENT * SHUFFLE_FILE_ALIGNMENT;
+}
+
+// write an array and the padding after it, adds it to the checksum
+static int WriteArray(FILE *f, const void *data, uint64_t bytes, uint64_t *offset, uint64_t *checksum)
+{
+	static const unsigned char zeros[SHUFFLE_FILE_ALIGNMENT];
+	uint64_t padding = Align(*offset+bytes) - (*offset+bytes);
+	if (bytes && fwrite(data, 1, (size_t)bytes, f)!=bytes)
+		return 0;
+	if (padding && fwrite(zeros, 1, (size_t)padding, f)!=padding)
+		return 0;
+	*checksum += ShuffleFileChecksum(data, bytes, *offset);	// padding is zeros
+	if (padding) {
+		uint64_t end = *offset+bytes;
+		uint64_t word_end = (end+7) & ~7ull;	// rest of a partial word is zero in both
+		*checksum += ShuffleFileChecksum(zeros, *offset+bytes+padding-word_end, word_end);
+	}
+	*offset += bytes+padding;
+	return 1;
+}
+
+// the header and array table of a file, the checksum is left 0
+static int InitHeader(ShuffleFileHeader *header, ShuffleFileArray *table, int count, int key_type, int layout, const size_t *sizes, int arrays)
+{
+	if (!KeySize(key_type) || layout<SHUFFLE_LAYOUT_SHUFFLED || layout>SHUFFLE_LAYOUT_EYTZINGER ||
+		arrays<0 || arrays>SHUFFLE_FILE_MAX_ARRAYS || count<0 || (count && !LayoutKeys(layout, count)))
+		return SHUFFLE_FILE_ERROR_FORMAT;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, s_magic, sizeof(header->magic));
+	header->version = SHUFFLE_FILE_VERSION;
+	header->byte_order = 0x01020304;
+	header->header_size = (uint32_t)(sizeof(*header) + arrays * sizeof(ShuffleFileArray));
+	header->key_type = (uint32_t)key_type;
+	header->key_size = (uint32_t)KeySize(key_type);
+	header->layout = (uint32_t)layout;
+	header->alignment = SHUFFLE_FILE_ALIGNMENT;
+	header->arrays = (uint32_t)arrays;
+	header->count = (uint64_t)count;
+	header->keys = LayoutKeys(layout, count);
+	header->keys_offset = Align(header->header_size);
+	uint64_t offset = Align(header->keys_offset + header->keys*header->key_size);
+	for (int a = 0; a<arrays; a++) {
+		table[a].offset = offset;
+		table[a].size = sizes[a];
+		offset = Align(offset + (uint64_t)count*sizes[a]);
+	}
+	return SHUFFLE_FILE_OK;
+}
+
+int ShuffleFileWrite(const char *path, const void *keys, int count, int key_type, int layout, const void **values, const size_t *sizes, int arrays)
+{
+	ShuffleFileHeader header;
+	ShuffleFileArray table[SHUFFLE_FILE_MAX_ARRAYS];
+	int error = InitHeader(&header, table, count, key_type, layout, sizes, arrays);
+	if (error)
+		return error;
+	// header and table are 8 byte multiples so their checksums add up
+	uint64_t checksum = ShuffleFileChecksum(&header, sizeof(header), 0) +
+		ShuffleFileChecksum(table, arrays*sizeof(ShuffleFileArray), sizeof(header));
+
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return SHUFFLE_FILE_ERROR_OPEN;
+	int ok = fwrite(&header, sizeof(header), 1, f)==1;
+	if (ok && arrays)
+		ok = fwrite(table, sizeof(ShuffleFileArray), arrays, f)==(size_t)arrays;
+	uint64_t offset = header.header_size;
+	if (ok)
+		ok = WriteArray(f, NULL, 0, &offset, &checksum);
+	if (ok)
+		ok = WriteArray(f, keys, header.keys*header.key_size, &offset, &checksum);
+	for (int a = 0; ok && a<arrays; a++)
+		ok = WriteArray(f, values[a], (uint64_t)count*sizes[a], &offset, &checksum);
+	header.checksum = checksum;
+	if (ok)
+		ok = !fseek(f, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, f)==1;
+	if (fclose(f))
+		ok = 0;
+	if (!ok)
+		remove(path);	// no partial file, the same as a stream that fails
+	return ok ? SHUFFLE_FILE_OK : SHUFFLE_FILE_ERROR_OPEN;
+}
+
+// move a stream to a file offset, past the end leaves a hole of zeros
+static int Seek(FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+	return !_fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+	return !fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+typedef struct StreamWord {
+	uint64_t offset;		// file offset of a 64 bit word
+	uint64_t word;			// the bytes of it one write had, zeros for the rest
+} StreamWord;
+
+typedef struct StreamTop {
+	uint64_t index;			// shuffled index of a key above the blocks
+	unsigned char key[8];
+} StreamTop;
+
+typedef struct StreamState {
+	FILE *keys_file;
+	FILE *values_files[SHUFFLE_FILE_MAX_ARRAYS];
+	uint64_t values_offsets[SHUFFLE_FILE_MAX_ARRAYS];	// file offset of the next value
+	uint64_t values_words[SHUFFLE_FILE_MAX_ARRAYS];	// bytes of the word the next value starts in
+	unsigned char *buffer;	// keys of the block being added, shuffled
+	int buffer_keys;
+	int block_first;		// linear index of the first key of the block
+	int block_count;		// 0 for a top key
+	uint64_t block_index;	// shuffled index of the first key of the block
+	StreamTop *tops;
+	size_t ntops, max_tops;
+	StreamWord *words;		// words split between writes
+	size_t nwords, max_words;
+	unsigned char last[8];	// the last key added
+	uint64_t checksum;
+	char *path;
+} StreamState;
+
+// room for n+1 elements, NULL if that fails and then the array is still the caller's to free
+static void *Grow(void *array, size_t *max, size_t n, size_t size)
+{
+	if (n<*max)
+		return array;
+	size_t grown = *max ? *max*2 : 64;
+	void *p = realloc(array, grown*size);
+	if (p)
+		*max = grown;
+	return p;
+}
+
+static int KeyLess(int key_type, const unsigned char *a, const unsigned char *b)
+{
+	union { int32_t i32; uint32_t u32; int64_t i64; uint64_t u64; float f32; double f64; } x, y;
+	memcpy(&x, a, KeySize(key_type));
+	memcpy(&y, b, KeySize(key_type));
+	switch (key_type) {
+		case SHUFFLE_KEY_I32: return x.i32<y.i32;
+		case SHUFFLE_KEY_U32: return x.u32<y.u32;
+		case SHUFFLE_KEY_I64: return x.i64<y.i64;
+		case SHUFFLE_KEY_U64: return x.u64<y.u64;
+		case SHUFFLE_KEY_F32: return x.f32<y.f32;
+		case SHUFFLE_KEY_F64: return x.f64<y.f64;
+	}
+	return 0;
+}
+
+// checksum of a write anywhere in the keys, the words at its ends are kept until the other writes of them are done
+static int StreamChecksum(StreamState *state, const unsigned char *data, uint64_t bytes, uint64_t offset)
+{
+	uint64_t head = (8-(offset&7)) & 7;
+	if (head>bytes)
+		head = bytes;
+	uint64_t middle = (bytes-head) & ~7ull;
+	uint64_t tail = bytes-head-middle;
+	if (head || tail) {
+		// room for both
+		StreamWord *words = (StreamWord*)Grow(state->words, &state->max_words, state->nwords+1, sizeof(StreamWord));
+		if (!words)
+			return 0;
+		state->words = words;
+	}
+	if (head) {
+		StreamWord *w = &state->words[state->nwords++];
+		w->offset = offset & ~7ull;
+		w->word = 0;
+		memcpy((unsigned char*)&w->word + (offset&7), data, (size_t)head);
+	}
+	state->checksum += ShuffleFileChecksum(data+head, middle, offset+head);
+	if (tail) {
+		StreamWord *w = &state->words[state->nwords++];
+		w->offset = offset+head+middle;
+		w->word = 0;
+		memcpy(&w->word, data+head+middle, (size_t)tail);
+	}
+	return 1;
+}
+
+static int CompareWords(const void *a, const void *b)
+{
+	uint64_t x = ((const StreamWord*)a)->offset, y = ((const StreamWord*)b)->offset;
+	return x<y ? -1 : x>y;
+}
+
+static int CompareTops(const void *a, const void *b)
+{
+	uint64_t x = ((const StreamTop*)a)->index, y = ((const StreamTop*)b)->index;
+	return x<y ? -1 : x>y;
+}
+
+// checksum of the zeros from the end of an array to the next alignment
+static uint64_t PaddingChecksum(uint64_t end)
+{
+	static const unsigned char zeros[SHUFFLE_FILE_ALIGNMENT];
+	uint64_t word_end = (end+7) & ~7ull;
+	return word_end<Align(end) ? ShuffleFileChecksum(zeros, Align(end)-word_end, word_end) : 0;
+}
+
+static void StreamFree(StreamState *state)
+{
+	if (state->keys_file)
+		fclose(state->keys_file);
+	for (int a = 0; a<SHUFFLE_FILE_MAX_ARRAYS; a++) {
+		if (state->values_files[a])
+			fclose(state->values_files[a]);
+	}
+	free(state->buffer);
+	free(state->tops);
+	free(state->words);
+	free(state->path);
+	free(state);
+}
+
+static int StreamFail(ShuffleFileStream *stream, int error)
+{
+	if (!stream->error)
+		stream->error = error;
+	return stream->error;
+}
+
+int ShuffleFileStreamBegin(ShuffleFileStream *stream, const char *path, int count, int key_type, const size_t *sizes, int arrays, int buffer_keys)
+{
+	memset(stream, 0, sizeof(*stream));
+	stream->error = InitHeader(&stream->header, stream->table, count, key_type, SHUFFLE_LAYOUT_SHUFFLED, sizes, arrays);
+	if (stream->error)
+		return stream->error;
+	StreamState *state = (StreamState*)calloc(1, sizeof(StreamState));
+	if (!state)
+		return StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+	// on an error End closes and removes what was made so far
+	stream->state = state;
+	state->buffer_keys = buffer_keys>0 ? buffer_keys : SHUFFLE_FILE_STREAM_BUFFER;
+	if (state->buffer_keys>count)
+		state->buffer_keys = count;
+	state->buffer = (unsigned char*)malloc((size_t)state->buffer_keys*stream->header.key_size + 1);
+	state->path = (char*)malloc(strlen(path)+1);
+	if (!state->buffer || !state->path) {
+		StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+		return ShuffleFileStreamEnd(stream);
+	}
+	strcpy(state->path, path);
+	state->checksum = ShuffleFileChecksum(&stream->header, sizeof(stream->header), 0) +
+		ShuffleFileChecksum(stream->table, arrays*sizeof(ShuffleFileArray), sizeof(stream->header)) +
+		PaddingChecksum(stream->header.header_size);
+
+	// the header until the checksum is known and a zero at the end so the file has its size
+	uint64_t end = Align(stream->header.keys_offset + stream->header.keys*stream->header.key_size);
+	if (arrays)
+		end = Align(stream->table[arrays-1].offset + (uint64_t)count*stream->table[arrays-1].size);
+	state->keys_file = fopen(path, "wb");
+	int ok = state->keys_file!=NULL;
+	if (ok)
+		ok = fwrite(&stream->header, sizeof(stream->header), 1, state->keys_file)==1;
+	if (ok && arrays)
+		ok = fwrite(stream->table, sizeof(ShuffleFileArray), arrays, state->keys_file)==(size_t)arrays;
+	if (ok)
+		ok = Seek(state->keys_file, end-1) && fputc(0, state->keys_file)!=EOF && !fflush(state->keys_file);
+	// each value array is written in order through its own stream
+	for (int a = 0; ok && a<arrays; a++) {
+		state->values_files[a] = fopen(path, "r+b");
+		state->values_offsets[a] = stream->table[a].offset;
+		ok = state->values_files[a] && Seek(state->values_files[a], state->values_offsets[a]);
+	}
+	if (ok)
+		return SHUFFLE_FILE_OK;
+	StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+	return ShuffleFileStreamEnd(stream);
+}
+
+// the block of at most buffer_keys keys or the top key that a linear index is in
+static void StreamFindBlock(ShuffleFileStream *stream, StreamState *state, int linear)
+{
+	int first = 0, count = (int)stream->header.count;
+	uint64_t index = 0;
+	while (count>state->buffer_keys) {
+		int middle = first+count/2;
+		if (linear==middle) {
+			count = 0;
+			break;
+		} else if (linear<middle) {
+			index++;
+			count /= 2;
+		} else {
+			index += count/2+1;
+			first = middle+1;
+			count = (count-1)/2;
+		}
+	}
+	state->block_first = count ? first : linear;
+	state->block_count = count;
+	state->block_index = index;
+}
+
+static int StreamValues(StreamState *state, int a, const unsigned char *data, uint64_t bytes)
+{
+	if (!bytes)
+		return 1;
+	if (fwrite(data, 1, (size_t)bytes, state->values_files[a])!=bytes)
+		return 0;
+	// the arrays start at 8 byte offsets so a partial word is only ever at the end of the values so far
+	uint64_t offset = state->values_offsets[a];
+	while (bytes && (offset&7)) {
+		((unsigned char*)&state->values_words[a])[offset&7] = *data++;
+		bytes--;
+		if (!(++offset & 7)) {
+			state->checksum += Mix(state->values_words[a] + Mix(offset-8));
+			state->values_words[a] = 0;
+		}
+	}
+	uint64_t whole = bytes & ~7ull;
+	state->checksum += ShuffleFileChecksum(data, whole, offset);
+	offset += whole;
+	memcpy(&state->values_words[a], data+whole, (size_t)(bytes-whole));
+	state->values_offsets[a] = offset+bytes-whole;
+	return 1;
+}
+
+int ShuffleFileStreamAdd(ShuffleFileStream *stream, const void *keys, int n, const void **values)
+{
+	StreamState *state = (StreamState*)stream->state;
+	if (stream->error)
+		return stream->error;
+	if (n<0 || (uint64_t)n>stream->header.count-stream->added)
+		return StreamFail(stream, SHUFFLE_FILE_ERROR_ORDER);
+	int key_type = (int)stream->header.key_type, key_size = (int)stream->header.key_size;
+	const unsigned char *key = (const unsigned char*)keys;
+	for (int i = 0; i<n; i++, key += key_size) {
+		int linear = (int)stream->added;
+		if (linear && KeyLess(key_type, key, state->last))
+			return StreamFail(stream, SHUFFLE_FILE_ERROR_ORDER);
+		memcpy(state->last, key, key_size);
+		stream->added++;
+		if (linear>=state->block_first+state->block_count)
+			StreamFindBlock(stream, state, linear);
+		if (!state->block_count) {
+			StreamTop *tops = (StreamTop*)Grow(state->tops, &state->max_tops, state->ntops+1, sizeof(StreamTop));
+			if (!tops)
+				return StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+			state->tops = tops;
+			state->tops[state->ntops].index = state->block_index;
+			memcpy(state->tops[state->ntops++].key, key, key_size);
+			continue;
+		}
+		int at = ShuffleIndex(linear-state->block_first, state->block_count);
+		memcpy(state->buffer + (size_t)at*key_size, key, key_size);
+		if (linear==state->block_first+state->block_count-1) {
+			// a whole block is in the buffer, the blocks are in the file in the order they are added
+			uint64_t offset = stream->header.keys_offset + state->block_index*key_size;
+			uint64_t bytes = (uint64_t)state->block_count*key_size;
+			if (!Seek(state->keys_file, offset) || fwrite(state->buffer, 1, (size_t)bytes, state->keys_file)!=bytes)
+				return StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+			if (!StreamChecksum(state, state->buffer, bytes, offset))
+				return StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+		}
+	}
+	for (int a = 0; a<(int)stream->header.arrays; a++) {
+		if (!StreamValues(state, a, (const unsigned char*)values[a], (uint64_t)n*stream->table[a].size))
+			return StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+	}
+	return SHUFFLE_FILE_OK;
+}
+
+int ShuffleFileStreamEnd(ShuffleFileStream *stream)
+{
+	StreamState *state = (StreamState*)stream->state;
+	if (!state)
+		return stream->error;
+	if (stream->added!=stream->header.count)
+		StreamFail(stream, SHUFFLE_FILE_ERROR_ORDER);
+
+	// the top keys go in the holes between the blocks
+	uint32_t key_size = stream->header.key_size;
+	if (state->ntops)
+		qsort(state->tops, state->ntops, sizeof(StreamTop), CompareTops);
+	for (size_t t = 0; !stream->error && t<state->ntops; t++) {
+		uint64_t offset = stream->header.keys_offset + state->tops[t].index*key_size;
+		if (!Seek(state->keys_file, offset) || fwrite(state->tops[t].key, 1, key_size, state->keys_file)!=key_size ||
+			!StreamChecksum(state, state->tops[t].key, key_size, offset))
+			StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+	}
+	if (!stream->error) {
+		// the parts of split words are put together, the rest of the last word of the keys is zeros
+		if (state->nwords)
+			qsort(state->words, state->nwords, sizeof(StreamWord), CompareWords);
+		for (size_t w = 0; w<state->nwords; ) {
+			uint64_t offset = state->words[w].offset, word = 0;
+			for (; w<state->nwords && state->words[w].offset==offset; w++)
+				word |= state->words[w].word;
+			state->checksum += Mix(word + Mix(offset));
+		}
+		state->checksum += PaddingChecksum(stream->header.keys_offset + stream->header.keys*key_size);
+		for (int a = 0; a<(int)stream->header.arrays; a++) {
+			uint64_t offset = state->values_offsets[a];
+			if (offset&7)
+				state->checksum += Mix(state->values_words[a] + Mix(offset & ~7ull));
+			state->checksum += PaddingChecksum(offset);
+		}
+		stream->header.checksum = state->checksum;
+		if (!Seek(state->keys_file, 0) || fwrite(&stream->header, sizeof(stream->header), 1, state->keys_file)!=1)
+			StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+	}
+	for (int a = 0; a<(int)stream->header.arrays; a++) {
+		if (state->values_files[a] && fclose(state->values_files[a]))
+			StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+		state->values_files[a] = NULL;
+	}
+	int created = state->keys_file!=NULL;
+	if (created && fclose(state->keys_file))
+		StreamFail(stream, SHUFFLE_FILE_ERROR_OPEN);
+	state->keys_file = NULL;
+	if (stream->error && created)
+		remove(state->path);
+	StreamFree(state);
+	stream->state = NULL;
+	return stream->error;
+}
+
+static int CheckHeader(const ShuffleFile *file)
+{
+	const ShuffleFileHeader *header = (const ShuffleFileHeader*)file->map;
+	if (file->size<sizeof(ShuffleFileHeader) || memcmp(header->magic, s_magic, sizeof(s_magic)))
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	if (header->byte_order!=0x01020304 || header->version!=SHUFFLE_FILE_VERSION)
+		return SHUFFLE_FILE_ERROR_VERSION;
+	if (header->arrays>SHUFFLE_FILE_MAX_ARRAYS || header->header_size<sizeof(ShuffleFileHeader) + header->arrays*sizeof(ShuffleFileArray) ||
+		header->header_size>file->size || !KeySize((int)header->key_type) ||
+		header->key_size!=(uint32_t)KeySize((int)header->key_type) || header->count>0x7fffffff)
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	// the searches and ShuffleFileLinearIndex read the number of keys of their layout
+	if (header->layout<SHUFFLE_LAYOUT_SHUFFLED || header->layout>SHUFFLE_LAYOUT_EYTZINGER || header->keys!=LayoutKeys((int)header->layout, (int)header->count))
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	// the map is page aligned so offsets at a multiple of the alignment, and of the key size, are aligned keys and values
+	uint32_t alignment = header->alignment;
+	if (alignment<8 || (alignment & (alignment-1)))
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	if (header->keys_offset<header->header_size || header->keys_offset>file->size || header->keys_offset%alignment ||
+		header->keys>(file->size-header->keys_offset)/header->key_size)
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	const ShuffleFileArray *arrays = (const ShuffleFileArray*)(header+1);
+	for (uint32_t a = 0; a<header->arrays; a++) {
+		if (arrays[a].offset<header->header_size || arrays[a].offset>file->size || arrays[a].offset%alignment ||
+			(arrays[a].size && header->count>(file->size-arrays[a].offset)/arrays[a].size))
+			return SHUFFLE_FILE_ERROR_FORMAT;
+	}
+	return SHUFFLE_FILE_OK;
+}
+
+// 0 if the checksum of the file matches the header
+static int VerifyChecksum(const ShuffleFileHeader *header, const unsigned char *map, uint64_t size)
+{
+	// the checksum word counts as zero
+	uint64_t at = offsetof(ShuffleFileHeader, checksum);
+	uint64_t sum = ShuffleFileChecksum(map, size, 0) - Mix(header->checksum + Mix(at)) + Mix(Mix(at));
+	return sum!=header->checksum;
+}
+
+int ShuffleFileOpen(ShuffleFile *file, const char *path, int flags)
+{
+	memset(file, 0, sizeof(*file));
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		(flags & SHUFFLE_FILE_RANDOM) ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER size;
+	if (f==INVALID_HANDLE_VALUE)
+		return SHUFFLE_FILE_ERROR_OPEN;
+	if (!GetFileSizeEx(f, &size)) {
+		CloseHandle(f);
+		return SHUFFLE_FILE_ERROR_OPEN;
+	}
+	if (!size.QuadPart) {
+		CloseHandle(f);
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	}
+	file->handle = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(f);
+	if (!file->handle)
+		return SHUFFLE_FILE_ERROR_OPEN;
+	file->map = (const unsigned char*)MapViewOfFile(file->handle, FILE_MAP_READ, 0, 0, 0);
+	if (!file->map) {
+		CloseHandle(file->handle);
+		file->handle = NULL;
+		return SHUFFLE_FILE_ERROR_OPEN;
+	}
+	file->size = (uint64_t)size.QuadPart;
+	if (flags & SHUFFLE_FILE_WILLNEED) {
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = (PVOID)file->map;
+		range.NumberOfBytes = (SIZE_T)file->size;
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd<0)
+		return SHUFFLE_FILE_ERROR_OPEN;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return SHUFFLE_FILE_ERROR_OPEN;
+	}
+	if (st.st_size<=0) {
+		close(fd);
+		return SHUFFLE_FILE_ERROR_FORMAT;
+	}
+	int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if (flags & SHUFFLE_FILE_POPULATE)
+		map_flags |= MAP_POPULATE;
+#endif
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, map_flags, fd, 0);
+	close(fd);	// the mapping keeps the file open
+	if (map==MAP_FAILED)
+		return SHUFFLE_FILE_ERROR_OPEN;
+	file->map = (const unsigned char*)map;
+	file->size = (uint64_t)st.st_size;
+	if (flags & SHUFFLE_FILE_RANDOM)
+		madvise(map, (size_t)file->size, MADV_RANDOM);
+	if (flags & SHUFFLE_FILE_WILLNEED)
+		madvise(map, (size_t)file->size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	if (flags & SHUFFLE_FILE_HUGEPAGES)
+		madvise(map, (size_t)file->size, MADV_HUGEPAGE);
+#endif
+#endif
+
+	int error = CheckHeader(file);
+	if (!error) {
+		file->header = (const ShuffleFileHeader*)file->map;
+		file->arrays = (const ShuffleFileArray*)(file->header+1);
+		file->keys = file->map + file->header->keys_offset;
+		if ((flags & SHUFFLE_FILE_VERIFY) && VerifyChecksum(file->header, file->map, file->size))
+			error = SHUFFLE_FILE_ERROR_CHECKSUM;
+	}
+	if (error)
+		ShuffleFileClose(file);
+	return error;
+}
+
+void ShuffleFileClose(ShuffleFile *file)
+{
+	if (file->map) {
+#ifdef _WIN32
+		UnmapViewOfFile(file->map);
+		CloseHandle(file->handle);
+#else
+		munmap((void*)file->map, (size_t)file->size);
+#endif
+	}
+	memset(file, 0, sizeof(*file));
+}
+
+int ShuffleFileSearch(const ShuffleFile *file, int value)
+{
+	const int *keys = (const int*)file->keys;
+	int count = (int)file->header->count;
+	if (file->header->key_type!=SHUFFLE_KEY_I32)
+		return -1;
+	switch (file->header->layout) {
+		case SHUFFLE_LAYOUT_SHUFFLED:
+			return ShuffledBinarySearchFast(value, keys, count);
+		case SHUFFLE_LAYOUT_BLOCK:
+			return BlockShuffledBinarySearch(value, keys, count);
+		case SHUFFLE_LAYOUT_EYTZINGER:
+			return EytzingerBinarySearch(value, keys, count);
+	}
+	return -1;
+}
+
+int ShuffleFileLinearIndex(const ShuffleFile *file, int index)
+{
+	int count = (int)file->header->count;
+	switch (file->header->layout) {
+		case SHUFFLE_LAYOUT_SHUFFLED:
+			return DeshuffleIndex(index, count);
+		case SHUFFLE_LAYOUT_BLOCK:
+			return BlockDeshuffleIndex(index, count);
+		case SHUFFLE_LAYOUT_EYTZINGER:
+			return EytzingerDeshuffleIndex(index, count);
+	}
+	return -1;
+}
+
+const void *ShuffleFileLookupValue(const ShuffleFile *file, int value, int array)
+{
+	if (array<0 || array>=(int)file->header->arrays)
+		return NULL;
+	int index = ShuffleFileSearch(file, value);
+	if (index<0)
+		return NULL;
+	int linear = ShuffleFileLinearIndex(file, index);
+	return file->map + file->arrays[array].offset + (uint64_t)linear*file->arrays[array].size;
+}
@@ -0,0 +1,112 @@
+#ifndef __BINSHUFFLE_FILE_H__
+#define __BINSHUFFLE_FILE_H__
+
+#include "binsearchshuffle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shuffled index files that are searched in place with mmap, see binsearchshuffle_file.c
+
+#define SHUFFLE_FILE_VERSION 1
+#define SHUFFLE_FILE_ALIGNMENT 4096		// arrays in the file start at a multiple of this
+#define SHUFFLE_FILE_MAX_ARRAYS 16		// value arrays per file
+
+// key types
+#define SHUFFLE_KEY_I32 1
+#define SHUFFLE_KEY_U32 2
+#define SHUFFLE_KEY_I64 3
+#define SHUFFLE_KEY_U64 4
+#define SHUFFLE_KEY_F32 5
+#define SHUFFLE_KEY_F64 6
+
+// key layouts
+#define SHUFFLE_LAYOUT_SHUFFLED 1	// ShuffleSortedArray
+#define SHUFFLE_LAYOUT_BLOCK 2		// BlockShuffleSortedArray, BlockShuffledArraySize(count) keys
+#define SHUFFLE_LAYOUT_EYTZINGER 3	// EytzingerShuffleSortedArray
+
+// open flags
+#define SHUFFLE_FILE_VERIFY 1		// check the checksum, reads the whole file
+#define SHUFFLE_FILE_RANDOM 2		// no read ahead, only the pages a search touches are read
+#define SHUFFLE_FILE_WILLNEED 4		// start reading the whole file in the background
+#define SHUFFLE_FILE_HUGEPAGES 8	// ask for huge pages where the OS supports it for file mappings
+#define SHUFFLE_FILE_POPULATE 16	// read the whole file before open returns (Linux)
+
+// open errors
+#define SHUFFLE_FILE_OK 0
+#define SHUFFLE_FILE_ERROR_OPEN -1		// file could not be opened or mapped
+#define SHUFFLE_FILE_ERROR_FORMAT -2	// not a shuffled index file or truncated
+#define SHUFFLE_FILE_ERROR_VERSION -3	// other version or other byte order
+#define SHUFFLE_FILE_ERROR_CHECKSUM -4
+#define SHUFFLE_FILE_ERROR_ORDER -5		// streamed keys not in sorted order or not 'count' of them
+
+#ifndef SHUFFLE_FILE_STREAM_BUFFER
+#define SHUFFLE_FILE_STREAM_BUFFER (1<<20)	// keys a stream shuffles in memory at a time
+#endif
+
+// the file starts with the header which is followed by the table of value arrays,
+// all numbers are in the byte order of the machine that wrote the file
+typedef struct ShuffleFileHeader {
+	char magic[8];			// "SHUFIDX" and a zero
+	uint32_t version;
+	uint32_t byte_order;	// 0x01020304
+	uint32_t header_size;	// bytes of header and array table
+	uint32_t key_type;
+	uint32_t key_size;		// bytes per key
+	uint32_t layout;
+	uint32_t alignment;
+	uint32_t arrays;		// number of value arrays
+	uint64_t count;			// number of keys and values
+	uint64_t keys;			// number of keys in the layout, more than 'count' for padded layouts
+	uint64_t keys_offset;	// file offset of the keys
+	uint64_t checksum;		// of the whole file with this taken as zero, see ShuffleFileChecksum
+} ShuffleFileHeader;
+
+typedef struct ShuffleFileArray {
+	uint64_t offset;		// file offset of the array
+	uint64_t size;			// bytes per value
+} ShuffleFileArray;
+
+typedef struct ShuffleFile {
+	const ShuffleFileHeader *header;
+	const ShuffleFileArray *arrays;	// header->arrays value arrays
+	const void *keys;				// header->keys keys in header->layout
+	const unsigned char *map;
+	uint64_t size;					// bytes mapped
+	void *handle;					// mapping handle on Windows
+} ShuffleFile;
+
+// write keys in 'layout' and value arrays in sorted order, SHUFFLE_FILE_OK or an error
+int ShuffleFileWrite(const char *path, const void *keys, int count, int key_type, int layout, const void **values, const size_t *sizes, int arrays);
+int ShuffleFileOpen(ShuffleFile *file, const char *path, int flags); // SHUFFLE_FILE_OK or an error
+void ShuffleFileClose(ShuffleFile *file);
+
+// SHUFFLE_KEY_I32 keys in any layout
+int ShuffleFileSearch(const ShuffleFile *file, int value); // index in the keys, -1 if not found
+int ShuffleFileLinearIndex(const ShuffleFile *file, int index); // sorted index of a key index
+const void *ShuffleFileLookupValue(const ShuffleFile *file, int value, int array); // value of a key, NULL if not found
+
+// a file written from keys and values in sorted order without the table in memory, see binsearchshuffle_file.c
+typedef struct ShuffleFileStream {
+	ShuffleFileHeader header;
+	ShuffleFileArray table[SHUFFLE_FILE_MAX_ARRAYS];
+	uint64_t added;			// keys added so far
+	int error;				// first error, SHUFFLE_FILE_OK while the stream is good
+	void *state;			// files and buffers
+} ShuffleFileStream;
+
+// starts a SHUFFLE_LAYOUT_SHUFFLED file of 'count' keys, buffer_keys 0 = SHUFFLE_FILE_STREAM_BUFFER
+int ShuffleFileStreamBegin(ShuffleFileStream *stream, const char *path, int count, int key_type, const size_t *sizes, int arrays, int buffer_keys);
+// the next 'n' keys in sorted order and values[a] with their 'n' values of each array
+int ShuffleFileStreamAdd(ShuffleFileStream *stream, const void *keys, int n, const void **values); // SHUFFLE_FILE_OK or the first error
+int ShuffleFileStreamEnd(ShuffleFileStream *stream); // writes the header, SHUFFLE_FILE_OK or the first error and the file is removed
+
+// checksum of 'bytes' bytes at 'offset' in the file (multiple of 8), checksums of parts add up to the checksum of the whole
+uint64_t ShuffleFileChecksum(const void *data, uint64_t bytes, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,420 @@
+/*
+Gapped Shuffled Array
+
+InsertShuffledArrayValue sorts and shuffles the whole array for every value.
+The gapped array instead keeps free slots spread out over the sorted order
+(a packed memory array) and stores the slots in the shuffled layout, so the
+search still only reads forward in memory.
+
+Each subtree of the shuffled layout is a block of consecutive slots: the
+subtree at shuffled index 'index' with 'count' slots is slots index to
+index+count-1, and they are the sorted slots first to first+count-1. So
+the slots of a subtree can be counted and redistributed without touching the
+rest of the array.
+
+- int ShuffledGappedInit(ShuffledGapped *gapped, const int *sorted_array, int count)
+	- builds a gapped array from sorted unique values, 0 if out of memory
+- void ShuffledGappedFree(ShuffledGapped *gapped)
+- int ShuffledGappedSearch(int value, const ShuffledGapped *gapped)
+	- slot index of a value (-1 if not found), gapped->slots[index]==value
+- int ShuffledGappedInsert(ShuffledGapped *gapped, int value)
+	- 1 if the value was inserted, 0 if it was already there, -1 if out of memory
+- int ShuffledGappedRemove(ShuffledGapped *gapped, int value)
+	- 1 if the value was removed, 0 if it was not there
+
+Gaps
+
+A gap holds a copy of the nearest value before it in sorted order and the
+first sorted slot is never a gap, so the slots are sorted with repeats and a
+value is the first slot of its repeats. The search is a lower bound that
+returns the first slot not less than the value, which is never a gap.
+
+Insert
+
+If the sorted slot before the first slot not less than the value is a gap the
+value is stored there. Otherwise the subtrees containing that slot are checked
+from the smallest up until one has room under its density limit, which is
+100% for single slots and goes down to 75% for the whole array, and the values
+of that subtree are spread out evenly. If the whole array is over 75% the
+capacity is doubled. Spreading a subtree is O(slots) so an insert is
+amortized O(log^2 n) moves like a packed memory array.
+
+Remove
+
+The slot becomes a gap and the gaps after it get the value before it, which
+takes as long as the run of gaps after it. To keep the runs short the
+subtrees containing the slot are checked from the smallest one of at least
+GAPPED_LEAF slots up, and if it is under its density limit, which goes from
+12.5% up to 25% for the whole array, the values of the first subtree that
+isn't are spread out evenly instead, like inserts do with the upper limits.
+Below 25% the capacity is halved. So removing many values in a row is also
+amortized O(log^2 n) moves.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle.h"
+
+#define GAPPED_MIN_CAPACITY 16
+#define GAPPED_MAX_DEPTH 64
+#define GAPPED_LEAF 32		// smallest subtree with a density limit for removes
+
+static int IsGap(const ShuffledGapped *gapped, int index)
+{
+	return (gapped->gaps[index>>5]>>(index&31)) & 1;
+}
+
+static void SetGap(ShuffledGapped *gapped, int index, int gap)
+{
+	if (gap)
+		gapped->gaps[index>>5] |= 1u<<(index&31);
+	else
+		gapped->gaps[index>>5] &= ~(1u<<(index&31));
+}
+
+static int CountGaps(const ShuffledGapped *gapped, int index, int count)
+{
+	int gaps = 0;
+	for (; count && (index&31); index++, count--)
+		gaps += IsGap(gapped, index);
+	for (; count>=32; index += 32, count -= 32) {
+		uint32_t word = gapped->gaps[index>>5];
+		while (word) {
+			word &= word-1;
+			gaps++;
+		}
+	}
+	for (; count; index++, count--)
+		gaps += IsGap(gapped, index);
+	return gaps;
+}
+
+// shuffled index of a sorted slot
+static int SlotIndex(int linear, int count)
+{
+	int index = 0;
+	int first = 0;
+	while (count) {
+		int middle = first + count/2;
+		if (linear==middle)
+			break;
+		if (linear<middle) {
+			index++;
+			count /= 2;
+		} else {
+			index += count/2+1;
+			first = middle+1;
+			count = (count-1)/2;
+		}
+	}
+	return index;
+}
+
+// the gaps from sorted slot 'linear' up to the next value get 'value'
+static void FillGaps(ShuffledGapped *gapped, int linear, int value)
+{
+	ShuffledIterator it;
+	ShuffledIteratorBegin(&it, gapped->slots, gapped->capacity, linear, gapped->capacity);
+	for (int slot = ShuffledIteratorNext(&it); slot>=0 && IsGap(gapped, slot); slot = ShuffledIteratorNext(&it))
+		gapped->slots[slot] = value;
+}
+
+// values of the subtree at 'index' in sorted order, returns the number of values
+static int GatherValues(const ShuffledGapped *gapped, int index, int count, int *values)
+{
+	ShuffledIterator it;
+	int n = 0;
+	ShuffledIteratorBegin(&it, gapped->slots+index, count, 0, count);
+	for (int slot = ShuffledIteratorNext(&it); slot>=0; slot = ShuffledIteratorNext(&it)) {
+		if (!IsGap(gapped, index+slot))
+			values[n++] = gapped->slots[index+slot];
+	}
+	return n;
+}
+
+// spread 'n' sorted values evenly over the subtree at 'index', value i is stored
+// at sorted slot i*count/n followed by gaps with copies of it
+static void SpreadValues(ShuffledGapped *gapped, int index, int count, const int *values, int n)
+{
+	ShuffledIterator it;
+	int value = 0;
+	long long next = 0;	// sorted slot of the next value
+	ShuffledIteratorBegin(&it, gapped->slots+index, count, 0, count);
+	for (int linear = 0, slot = ShuffledIteratorNext(&it); slot>=0; linear++, slot = ShuffledIteratorNext(&it)) {
+		int gap = value>=n || linear!=next;
+		if (!gap)
+			next = (long long)(++value) * count / n;
+		gapped->slots[index+slot] = value ? values[value-1] : 0;
+		SetGap(gapped, index+slot, gap);
+	}
+}
+
+// set the capacity and spread the values in scratch over all slots
+static int Resize(ShuffledGapped *gapped, int capacity, int n)
+{
+	// if a smaller buffer can't be allocated the larger buffer is still fine
+	int *slots = (int*)realloc(gapped->slots, capacity * sizeof(int));
+	if (slots)
+		gapped->slots = slots;
+	uint32_t *gaps = (uint32_t*)realloc(gapped->gaps, ((capacity+31)/32) * sizeof(uint32_t));
+	if (gaps)
+		gapped->gaps = gaps;
+	if ((!slots || !gaps) && capacity>gapped->capacity)
+		return 0;
+	gapped->capacity = capacity;
+	gapped->count = n;
+	SpreadValues(gapped, 0, capacity, gapped->scratch, n);
+	return 1;
+}
+
+// scratch is the values to spread and room for one more
+static int GrowScratch(ShuffledGapped *gapped, int count)
+{
+	int *scratch = (int*)realloc(gapped->scratch, (count+1) * sizeof(int));
+	if (!scratch)
+		return 0;
+	gapped->scratch = scratch;
+	return 1;
+}
+
+static int CapacityFor(int count)
+{
+	int capacity = GAPPED_MIN_CAPACITY;
+	while (capacity<2*count && capacity<(1<<30))
+		capacity *= 2;
+	return capacity;
+}
+
+int ShuffledGappedInit(ShuffledGapped *gapped, const int *sorted_array, int count)
+{
+	gapped->slots = NULL;
+	gapped->gaps = NULL;
+	gapped->scratch = NULL;
+	gapped->capacity = 0;
+	gapped->count = 0;
+	int capacity = CapacityFor(count);
+	if (!GrowScratch(gapped, capacity))
+		return 0;
+	if (count)
+		memcpy(gapped->scratch, sorted_array, count * sizeof(int));
+	if (!Resize(gapped, capacity, count)) {
+		ShuffledGappedFree(gapped);
+		return 0;
+	}
+	return 1;
+}
+
+void ShuffledGappedFree(ShuffledGapped *gapped)
+{
+	free(gapped->slots);
+	free(gapped->gaps);
+	free(gapped->scratch);
+	gapped->slots = NULL;
+	gapped->gaps = NULL;
+	gapped->scratch = NULL;
+	gapped->capacity = 0;
+	gapped->count = 0;
+}
+
+// first slot not less than 'value', returns the sorted slot and its shuffled index in *slot
+static int GappedLowerBound(int value, const int *slots, int count, int *slot)
+{
+	int index = 0;
+	int first = 0;
+	*slot = -1;
+	while (count) {
+		if (slots[index]<value) {
+			first += count/2+1;
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			*slot = index;
+			index++;
+			count /= 2;
+		}
+	}
+	return first;
+}
+
+int ShuffledGappedSearch(int value, const ShuffledGapped *gapped)
+{
+	int slot;
+	if (!gapped->count)
+		return -1;
+	GappedLowerBound(value, gapped->slots, gapped->capacity, &slot);
+	return slot>=0 && gapped->slots[slot]==value ? slot : -1;
+}
+
+int ShuffledGappedInsert(ShuffledGapped *gapped, int value)
+{
+	int slot;
+	int linear = GappedLowerBound(value, gapped->slots, gapped->capacity, &slot);
+	if (gapped->count && slot>=0 && gapped->slots[slot]==value)
+		return 0;
+
+	if (!gapped->count) {
+		gapped->scratch[0] = value;
+		SpreadValues(gapped, 0, gapped->capacity, gapped->scratch, 1);
+		gapped->count = 1;
+		return 1;
+	}
+	if (linear) {
+		int before = SlotIndex(linear-1, gapped->capacity);
+		if (IsGap(gapped, before)) {	// the gaps before keep the value they have
+			gapped->slots[before] = value;
+			SetGap(gapped, before, 0);
+			gapped->count++;
+			return 1;
+		}
+	}
+
+	// the subtrees containing the first slot not less than the value (the last
+	// slot if there is none), the new value goes into one of these so the value
+	// at the end of the subtree and the gaps after the subtree do not change
+	struct { int index, count; } aPath[GAPPED_MAX_DEPTH];
+	int depth = 0;
+	int target = linear<gapped->capacity ? linear : gapped->capacity-1;
+	int index = 0, first = 0, count = gapped->capacity;
+	while (count) {
+		aPath[depth].index = index;
+		aPath[depth].count = count;
+		depth++;
+		int middle = first + count/2;
+		if (target==middle)
+			break;
+		if (target<middle) {
+			index++;
+			count /= 2;
+		} else {
+			index += count/2+1;
+			first = middle+1;
+			count = (count-1)/2;
+		}
+	}
+
+	// density limit goes from 100% for the deepest subtree to 75% for the whole array
+	int levels = depth;
+	while (depth--) {
+		index = aPath[depth].index;
+		count = aPath[depth].count;
+		int values = count - CountGaps(gapped, index, count) + 1;
+		double limit = levels>1 ? 0.75 + 0.25 * depth / (levels-1) : 0.75;
+		if (values<=limit*count)
+			break;
+	}
+	if (depth<0) {	// the whole array is full, double it
+		if (gapped->capacity>=(1<<30) || !GrowScratch(gapped, 2*gapped->capacity))
+			return -1;
+		index = 0;
+		count = gapped->capacity;
+	}
+
+	int n = GatherValues(gapped, index, count, gapped->scratch);
+	int at = 0;
+	while (at<n && gapped->scratch[at]<value)
+		at++;
+	memmove(gapped->scratch+at+1, gapped->scratch+at, (n-at) * sizeof(int));
+	gapped->scratch[at] = value;
+	n++;
+	if (depth<0) {
+		if (!Resize(gapped, 2*gapped->capacity, n)) {
+			// keep the old capacity, spreading it again restores it
+			memmove(gapped->scratch+at, gapped->scratch+at+1, (n-at-1) * sizeof(int));
+			SpreadValues(gapped, 0, gapped->capacity, gapped->scratch, n-1);
+			return -1;
+		}
+	} else {
+		SpreadValues(gapped, index, count, gapped->scratch, n);
+		gapped->count++;
+	}
+	return 1;
+}
+
+int ShuffledGappedRemove(ShuffledGapped *gapped, int value)
+{
+	int slot = ShuffledGappedSearch(value, gapped);
+	if (slot<0)
+		return 0;
+	int capacity = gapped->capacity;
+	gapped->count--;
+	if (gapped->count*4<capacity && capacity>GAPPED_MIN_CAPACITY) {	// halve the capacity
+		int n = GatherValues(gapped, 0, capacity, gapped->scratch);
+		int at = 0;
+		while (gapped->scratch[at]!=value)
+			at++;
+		memmove(gapped->scratch+at, gapped->scratch+at+1, (n-at-1) * sizeof(int));
+		Resize(gapped, capacity/2, n-1);
+		return 1;
+	}
+	if (!gapped->count) {	// the only value is the first slot
+		SetGap(gapped, slot, 1);
+		return 1;
+	}
+
+	// the subtrees containing the slot
+	struct { int index, first, count; } aPath[GAPPED_MAX_DEPTH];
+	int depth = 0;
+	int linear = DeshuffleIndex(slot, capacity);
+	int index = 0, first = 0, count = capacity;
+	while (count) {
+		aPath[depth].index = index;
+		aPath[depth].first = first;
+		aPath[depth].count = count;
+		depth++;
+		int middle = first + count/2;
+		if (linear==middle)
+			break;
+		if (linear<middle) {
+			index++;
+			count /= 2;
+		} else {
+			index += count/2+1;
+			first = middle+1;
+			count = (count-1)/2;
+		}
+	}
+
+	// density limit goes from 12.5% for the smallest subtree of GAPPED_LEAF slots
+	// or more to 25% for the whole array, which the halving above keeps
+	int leaf = depth-1;
+	while (leaf>0 && aPath[leaf].count<GAPPED_LEAF)
+		leaf--;
+	int up = leaf;
+	for (; up>0; up--) {
+		count = aPath[up].count;
+		int values = count - CountGaps(gapped, aPath[up].index, count) - 1;
+		if (values>=(0.25 - 0.125 * up / leaf) * count)
+			break;
+	}
+
+	if (up==leaf) {
+		// the slot becomes a gap and the gaps after it get the value before it, if
+		// the value is the first slot the next value moves to the first slot instead
+		if (linear) {
+			SetGap(gapped, slot, 1);
+			FillGaps(gapped, linear, gapped->slots[SlotIndex(linear-1, capacity)]);
+		} else {
+			ShuffledIterator it;
+			ShuffledIteratorBegin(&it, gapped->slots, capacity, 1, capacity);
+			int next = ShuffledIteratorNext(&it);
+			while (IsGap(gapped, next))
+				next = ShuffledIteratorNext(&it);
+			gapped->slots[slot] = gapped->slots[next];
+			SetGap(gapped, next, 1);
+			FillGaps(gapped, 1, gapped->slots[slot]);
+		}
+		return 1;
+	}
+
+	// spread the values of the subtree over it, the gaps after the subtree get its last value
+	index = aPath[up].index;
+	count = aPath[up].count;
+	int n = GatherValues(gapped, index, count, gapped->scratch);
+	int at = 0;
+	while (gapped->scratch[at]!=value)
+		at++;
+	memmove(gapped->scratch+at, gapped->scratch+at+1, (n-at-1) * sizeof(int));
+	SpreadValues(gapped, index, count, gapped->scratch, n-1);
+	FillGaps(gapped, aPath[up].first+count, gapped->scratch[n-2]);
+	return 1;
+}
@@ -0,0 +1,159 @@
+/*
+Hybrid Shuffled Binary Search
+
+Once ShuffledBinarySearch is down to a block of a few dozen values the whole
+block is in one or two cache lines, but it is still searched one level at a
+time with a compare and a dependent read per level. The hybrid layout shuffles
+blocks of more than SHUFFLE_HYBRID_LEAF values like ShuffleSortedArray and
+leaves smaller blocks sorted, and the search finishes in a leaf by counting
+the values less than the value with vector compares. The count is the
+position of the value in the leaf.
+
+- void HybridShuffleSortedArray(int *array, int count)
+	- shuffles the top of the tree, leaves of up to SHUFFLE_HYBRID_LEAF values stay sorted
+- int HybridShuffledBinarySearch(int value, const int *hybrid_array, int count)
+	- finds the index of a value (returns -1 if value was not found)
+- int HybridDeshuffleIndex(int index, int count)
+	- converts an index into a linear index
+- void HybridSortShuffledArray(int *array, int count)
+	- sorts a hybrid array
+
+The layout of the top levels is the same as the shuffled array so a block of
+more than SHUFFLE_HYBRID_LEAF values is the middle value, the lower half and
+then the upper half. A leaf is between SHUFFLE_HYBRID_LEAF/2 and
+SHUFFLE_HYBRID_LEAF values. Set SHUFFLE_HYBRID_LEAF at compile time, 16 or 32
+values is one or two cache lines of ints.
+*/
+
+#include <string.h>
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_internal.h"
+
+#if defined(SHUFFLE_X86) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define HYBRID_SSE2 1
+#elif defined(SHUFFLE_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifndef SHUFFLE_HYBRID_LEAF
+#define SHUFFLE_HYBRID_LEAF 16
+#endif
+
+#define MAX_HYBRID_DEPTH 64
+
+void HybridShuffleSortedArray(int *array, int count)
+{
+	struct { int first, count; } aStack[MAX_HYBRID_DEPTH];
+	int stk = 0;
+	int first = 0;
+
+	while (count>SHUFFLE_HYBRID_LEAF || stk) {
+		if (count<=SHUFFLE_HYBRID_LEAF) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			continue;
+		}
+		// rotate right first half elements, push second half of elements on the stack
+		int tmp = array[first+count/2];
+		memmove(&array[first+1], &array[first], sizeof(array[0]) * (count/2));
+		array[first] = tmp;
+		first++;
+		aStack[stk].first = first+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count /= 2;
+	}
+}
+
+void HybridSortShuffledArray(int *array, int count)
+{
+	struct { int first, count; } aStack[MAX_HYBRID_DEPTH];
+	int stk = 0;
+	int first = 0;
+
+	while (count>SHUFFLE_HYBRID_LEAF || stk) {
+		if (count<=SHUFFLE_HYBRID_LEAF) {
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+			continue;
+		}
+		// rotate left first half elements, push second half of elements on the stack
+		int tmp = array[first];
+		memmove(&array[first], &array[first+1], sizeof(array[0]) * (count/2));
+		array[first+count/2] = tmp;
+		aStack[stk].first = first+1+count/2;
+		aStack[stk].count = (count-1)/2;
+		stk++;
+		count /= 2;
+	}
+}
+
+// number of values in the sorted leaf that are less than 'value'
+static int LeafLess(int value, const int *leaf, int count)
+{
+	int less = 0;
+	int i = 0;
+#if defined(HYBRID_SSE2)
+	__m128i v = _mm_set1_epi32(value);
+	__m128i sum = _mm_setzero_si128();
+	for (; i+4<=count; i += 4)	// each lane is -1 where leaf<value
+		sum = _mm_sub_epi32(sum, _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(leaf+i)), v));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	less = _mm_cvtsi128_si32(sum);
+#elif defined(SHUFFLE_NEON)
+	int32x4_t v = vdupq_n_s32(value);
+	uint32x4_t sum = vdupq_n_u32(0);
+	for (; i+4<=count; i += 4)	// each lane is all ones where leaf<value
+		sum = vsubq_u32(sum, vcltq_s32(vld1q_s32(leaf+i), v));
+	less = (int)(vgetq_lane_u32(sum, 0) + vgetq_lane_u32(sum, 1) + vgetq_lane_u32(sum, 2) + vgetq_lane_u32(sum, 3));
+#endif
+	for (; i<count; i++)
+		less += leaf[i]<value;
+	return less;
+}
+
+int HybridShuffledBinarySearch(int value, const int *hybrid_array, int count)
+{
+	int index = 0;
+	while (count>SHUFFLE_HYBRID_LEAF) {
+		int read = hybrid_array[index];
+		if (value==read)
+			return index;
+		else if (value>read) {
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	SHUFFLE_PREFETCH(hybrid_array+index+count-1);	// a leaf can cross into the next cache line
+	int less = LeafLess(value, hybrid_array+index, count);
+	if (less<count && hybrid_array[index+less]==value)
+		return index+less;
+	return -1;	// index not found
+}
+
+int HybridDeshuffleIndex(int index, int count)
+{
+	if (index<0 || index>=count)
+		return -1;
+	int first = 0;	// linear index of the first value in the block
+	while (count>SHUFFLE_HYBRID_LEAF) {
+		if (!index)
+			return first+count/2;
+		if (index>count/2) {
+			index -= count/2+1;
+			first += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index--;
+			count /= 2;
+		}
+	}
+	return first+index;	// leaves are sorted
+}
@@ -0,0 +1,68 @@
+#ifndef __BINSHUFFLE_INTERNAL_H__
+#define __BINSHUFFLE_INTERNAL_H__
+
+// Shared by the binsearchshuffle*.c files, not part of the API
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SHUFFLE_X86 1
+int ShuffleCpuHasAVX2(void); // AVX2 and POPCNT, in binsearchshuffle_simd.c
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64) || (defined(__ARM_NEON) && defined(__arm__))
+#define SHUFFLE_NEON 1
+#endif
+
+// compile a single function for an instruction set the rest of the file is not built for
+#if defined(__GNUC__) || defined(__clang__)
+#define SHUFFLE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SHUFFLE_TARGET(isa)
+#endif
+
+// hint that an address will be read soon, any address is fine (no fault)
+#if defined(__GNUC__) || defined(__clang__)
+#define SHUFFLE_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(SHUFFLE_X86)
+#include <xmmintrin.h>
+#define SHUFFLE_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define SHUFFLE_PREFETCH(address) ((void)(address))
+#endif
+
+// device backend of binsearchshuffle_offload.c, built with SHUFFLE_CUDA defined, see there
+#ifdef SHUFFLE_CUDA
+#ifdef __cplusplus
+extern "C" {
+#endif
+void *ShuffleCudaInit(const int *shuffled_array, int count, int batch); // NULL without a device
+void ShuffleCudaFree(void *device);
+int ShuffleCudaSubmit(void *device, const int *values, int nvalues, int *out_indices, int linear); // 0 if a device call failed, the batch is searched on the CPU
+int ShuffleCudaWait(void *device); // 0 if a device call failed, the failed batches are searched on the CPU
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+// counting for binsearchshuffle_stats.h, the counters are only declared and
+// updated with SHUFFLE_STATS defined
+#ifdef SHUFFLE_STATS
+#include <stdint.h>
+typedef struct ShuffleStatsScope {
+	uint64_t start[4];	// hardware counters at enter
+	int op;				// -1 if not counted
+	int sampled;		// start was read
+} ShuffleStatsScope;
+void ShuffleStatsEnter(ShuffleStatsScope *scope, int op);
+void ShuffleStatsLeave(ShuffleStatsScope *scope, uint64_t steps, uint64_t moved_bytes);
+#define SHUFFLE_STATS_ENTER(op) ShuffleStatsScope stats_scope; ShuffleStatsEnter(&stats_scope, op)
+#define SHUFFLE_STATS_LEAVE(steps, moved_bytes) ShuffleStatsLeave(&stats_scope, steps, moved_bytes)
+#define SHUFFLE_STATS_COUNTER(name) uint64_t name = 0
+#define SHUFFLE_STATS_ADD(name, n) ((name) += (n))
+#else
+#define SHUFFLE_STATS_ENTER(op)
+#define SHUFFLE_STATS_LEAVE(steps, moved_bytes)
+#define SHUFFLE_STATS_COUNTER(name)
+#define SHUFFLE_STATS_ADD(name, n)
+#endif
+
+#endif
@@ -0,0 +1,143 @@
+/*
+Offloaded Batch Search
+
+ShuffledBinarySearch only reads forward in one flat array and has no pointers,
+so the same loop can run as a GPU kernel with one thread per value. For batches
+of millions of values a GPU with the table in its own memory searches them
+while the CPU does other work. The offload uploads a shuffled array once and
+then takes batches of values, with the same calls on a CPU backend for
+machines without a device.
+
+- int ShuffleOffloadInit(ShuffleOffload *offload, const int *shuffled_array, int count, int flags, const ShuffleScheduler *scheduler)
+	- uploads the array to a device if there is one, returns SHUFFLE_OFFLOAD_CUDA or SHUFFLE_OFFLOAD_CPU
+- void ShuffleOffloadFree(ShuffleOffload *offload)
+- void ShuffleOffloadSubmit(ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags)
+	- starts a batch, SHUFFLE_OFFLOAD_LINEAR for sorted indices
+- int ShuffleOffloadWait(ShuffleOffload *offload)
+	- waits until the results of all submitted batches are in their out_indices
+- int ShuffleOffloadSearch(ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags)
+	- Submit and Wait
+
+Device
+
+A device backend implements the ShuffleCuda functions declared in
+binsearchshuffle_internal.h and is linked with this file compiled with
+SHUFFLE_CUDA defined. None is part of the library yet, one is added when it can
+be built and tested on a device, so without SHUFFLE_CUDA only the CPU backend
+is built. Submit may return before the results are written and Wait returns
+once they all are. If a device call fails the backend searches the batches it
+had on the CPU and returns 0, and the offload stays on the CPU after that, so
+the results are right either way.
+
+CPU
+
+The CPU backend runs ShuffledBinarySearchBatch, which overlaps the memory
+reads of its values, in tasks of SHUFFLE_OFFLOAD_TASK values on the
+scheduler. A submit searches the whole batch before it returns.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle_offload.h"
+#include "binsearchshuffle_internal.h"
+
+typedef struct OffloadJob {
+	const int *shuffled_array;
+	int count;
+	const int *values;
+	int nvalues;
+	int *out_indices;
+	int linear;
+} OffloadJob;
+
+static void SearchTask(void *data, int task)
+{
+	const OffloadJob *job = (const OffloadJob*)data;
+	int first = task*SHUFFLE_OFFLOAD_TASK;
+	int n = job->nvalues-first<SHUFFLE_OFFLOAD_TASK ? job->nvalues-first : SHUFFLE_OFFLOAD_TASK;
+	if (job->linear)
+		ShuffledBinarySearchBatchDeshuffled(job->values+first, n, job->shuffled_array, job->count, job->out_indices+first);
+	else
+		ShuffledBinarySearchBatch(job->values+first, n, job->shuffled_array, job->count, job->out_indices+first);
+}
+
+static void SearchOnCpu(const ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags)
+{
+	OffloadJob job;
+	job.shuffled_array = offload->shuffled_array;
+	job.count = offload->count;
+	job.values = values;
+	job.nvalues = nvalues;
+	job.out_indices = out_indices;
+	job.linear = (flags & SHUFFLE_OFFLOAD_LINEAR)!=0;
+	int ntasks = (nvalues+SHUFFLE_OFFLOAD_TASK-1)/SHUFFLE_OFFLOAD_TASK;
+	const ShuffleScheduler *scheduler = &offload->scheduler;
+	if (scheduler->run && scheduler->workers>1 && ntasks>1)
+		scheduler->run(scheduler, SearchTask, &job, ntasks);
+	else {
+		for (int t = 0; t<ntasks; t++)
+			SearchTask(&job, t);
+	}
+}
+
+int ShuffleOffloadInit(ShuffleOffload *offload, const int *shuffled_array, int count, int flags, const ShuffleScheduler *scheduler)
+{
+	memset(offload, 0, sizeof(*offload));
+	offload->backend = SHUFFLE_OFFLOAD_CPU;
+	offload->count = count>0 ? count : 0;
+	offload->shuffled_array = shuffled_array;
+	offload->scheduler = scheduler ? *scheduler : ShuffleThreadScheduler(0);
+#ifdef SHUFFLE_CUDA
+	if (!(flags & SHUFFLE_OFFLOAD_FORCE_CPU)) {
+		offload->device = ShuffleCudaInit(shuffled_array, offload->count, SHUFFLE_OFFLOAD_BATCH);
+		if (offload->device)
+			offload->backend = SHUFFLE_OFFLOAD_CUDA;
+	}
+#else
+	(void)flags;
+#endif
+	return offload->backend;
+}
+
+void ShuffleOffloadFree(ShuffleOffload *offload)
+{
+#ifdef SHUFFLE_CUDA
+	if (offload->device)
+		ShuffleCudaFree(offload->device);
+#endif
+	memset(offload, 0, sizeof(*offload));
+}
+
+void ShuffleOffloadSubmit(ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags)
+{
+	if (nvalues<=0)
+		return;
+#ifdef SHUFFLE_CUDA
+	if (offload->backend==SHUFFLE_OFFLOAD_CUDA) {
+		if (!ShuffleCudaSubmit(offload->device, values, nvalues, out_indices, (flags & SHUFFLE_OFFLOAD_LINEAR)!=0)) {
+			offload->error = 1;
+			offload->backend = SHUFFLE_OFFLOAD_CPU;
+		}
+		return;
+	}
+#endif
+	SearchOnCpu(offload, values, nvalues, out_indices, flags);
+}
+
+int ShuffleOffloadWait(ShuffleOffload *offload)
+{
+#ifdef SHUFFLE_CUDA
+	// a device that failed in a submit has no batches left, they were searched on the CPU
+	if (offload->device && !ShuffleCudaWait(offload->device)) {
+		offload->error = 1;
+		offload->backend = SHUFFLE_OFFLOAD_CPU;
+	}
+#endif
+	return !offload->error;
+}
+
+int ShuffleOffloadSearch(ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags)
+{
+	ShuffleOffloadSubmit(offload, values, nvalues, out_indices, flags);
+	return ShuffleOffloadWait(offload);
+}
@@ -0,0 +1,51 @@
+#ifndef __BINSHUFFLE_OFFLOAD_H__
+#define __BINSHUFFLE_OFFLOAD_H__
+
+#include "binsearchshuffle_parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Batches of searches on a GPU with the same calls on the CPU, see binsearchshuffle_offload.c
+
+#ifndef SHUFFLE_OFFLOAD_BATCH
+#define SHUFFLE_OFFLOAD_BATCH (1<<20)	// values per transfer to the device, two transfers are in flight
+#endif
+#ifndef SHUFFLE_OFFLOAD_TASK
+#define SHUFFLE_OFFLOAD_TASK 4096		// values per scheduler task of the CPU backend
+#endif
+
+// backends
+#define SHUFFLE_OFFLOAD_CPU 0		// ShuffledBinarySearchBatch on the scheduler
+#define SHUFFLE_OFFLOAD_CUDA 1		// a device backend, built with SHUFFLE_CUDA defined
+
+// init flags
+#define SHUFFLE_OFFLOAD_FORCE_CPU 1	// don't look for a device
+
+// search flags
+#define SHUFFLE_OFFLOAD_LINEAR 1	// sorted indices like ShuffledBinarySearchBatchDeshuffled instead of shuffled indices
+
+typedef struct ShuffleOffload {
+	int backend;
+	int count;
+	const int *shuffled_array;		// the caller's array, the CPU backend searches it
+	ShuffleScheduler scheduler;		// of the CPU backend
+	void *device;					// state of the device backend
+	int error;						// set by a failed device call, the searches then run on the CPU
+} ShuffleOffload;
+
+// uploads a shuffled array once, scheduler NULL = ShuffleThreadScheduler(0), the array must stay valid until ShuffleOffloadFree
+int ShuffleOffloadInit(ShuffleOffload *offload, const int *shuffled_array, int count, int flags, const ShuffleScheduler *scheduler); // the backend
+void ShuffleOffloadFree(ShuffleOffload *offload);
+
+// starts the search of a batch, 'values' can be reused on return and out_indices has the results after ShuffleOffloadWait
+void ShuffleOffloadSubmit(ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags);
+int ShuffleOffloadWait(ShuffleOffload *offload); // waits for every submitted batch, 0 once a device call failed (the results are still right)
+int ShuffleOffloadSearch(ShuffleOffload *offload, const int *values, int nvalues, int *out_indices, int flags); // submit and wait
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
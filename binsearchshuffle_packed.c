@@ -0,0 +1,403 @@
+/*
+Packed Shuffled Array
+
+Dense 64 bit IDs waste most of a cache line of ShuffledBinarySearch on high
+bits that are the same for all values near each other. The packed array is
+the hybrid layout (see binsearchshuffle_hybrid.c) for uint64_t values with
+the leaves stored as a base and small offsets: blocks of more than a leaf are
+shuffled like ShuffleSortedArray and only their middle values are stored, as
+full values, and every leaf is one cache line.
+
+- int ShuffledPackedBuild(ShuffledPacked *packed, const uint64_t *sorted_array, int count)
+	- builds a packed array from sorted unique values, 0 if out of memory
+- void ShuffledPackedFree(ShuffledPacked *packed)
+- int ShuffledPackedSearch(uint64_t value, const ShuffledPacked *packed)
+	- finds the linear index of a value (returns -1 if value was not found)
+- void ShuffledPackedUnpack(const ShuffledPacked *packed, uint64_t *sorted_array)
+	- writes all values in sorted order
+- size_t ShuffledPackedBytes(const ShuffledPacked *packed)
+	- bytes used by the values
+
+Leaves
+
+A leaf is 64 bytes: SHUFFLE_PACKED_LINE-8 bytes of sorted offsets from the
+smallest value of the leaf, then the smallest value itself. Every leaf has
+its own offset width, the smallest of 1, 2, 4 or 8 bytes its values fit in,
+so dense IDs get 56 values per cache line and IDs up to 65535 apart get 28.
+The first offset of a leaf is always 0, so its first byte holds the width
+instead. Unused offsets are all ones. The search reads one leaf and counts
+the offsets less than the value with 4 vector compares of the offset width,
+like HybridShuffledBinarySearch.
+
+The values per leaf are the same for the whole array, 56/width for the width
+that needs the fewest lines. A leaf with more values than fit in a line of
+its width, like the one leaf between two clusters of dense IDs, is split
+into lines of 56/width values after the leaves, and the leaf itself has a
+first byte of 0, the values per line, the index of the first line and the
+first values of the other lines, so only the values of that leaf pay for a
+second line read.
+
+Top
+
+The middle values are in the same order as the shuffled array without its
+leaves, so the right half of a block starts after the middle values of the
+left half, and the leaves are in sorted order. The blocks at each depth of
+the tree only have two sizes, hi and hi-1, so the build keeps a table of the
+middle values and leaves of both sizes per depth and the search steps to the
+right half with one compare instead of counting the left half.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_internal.h"
+
+#if defined(SHUFFLE_X86) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define PACKED_SSE2 1
+#elif defined(SHUFFLE_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#include <arm_neon.h>
+#define PACKED_NEON 1
+#endif
+
+#define PACKED_OFFSET_BYTES (SHUFFLE_PACKED_LINE-8)
+
+static uint64_t MaxOffset(int width)
+{
+	return width==8 ? ~(uint64_t)0 : ((uint64_t)1<<(8*width))-1;
+}
+
+static uint64_t ReadOffset(const unsigned char *line, int i, int width)
+{
+	if (width==1)
+		return line[i];
+	else if (width==2) {
+		uint16_t o;
+		memcpy(&o, line+2*i, 2);
+		return o;
+	} else if (width==4) {
+		uint32_t o;
+		memcpy(&o, line+4*i, 4);
+		return o;
+	}
+	uint64_t o;
+	memcpy(&o, line+8*i, 8);
+	return o;
+}
+
+// calls 'leaf' for the leaves of a block in sorted order, returns 0 if one fails
+typedef int (*PackedLeafFunc)(void *context, const uint64_t *sorted_array, int count);
+
+static int ForEachLeaf(const uint64_t *sorted_array, int count, int leaf_max, uint64_t *top, int *ntop, PackedLeafFunc leaf, void *context)
+{
+	while (count>leaf_max) {
+		if (top)
+			top[*ntop] = sorted_array[count/2];
+		(*ntop)++;
+		if (!ForEachLeaf(sorted_array, count/2, leaf_max, top, ntop, leaf, context))
+			return 0;
+		sorted_array += count/2+1;
+		count = (count-1)/2;
+	}
+	return count==0 || leaf(context, sorted_array, count);
+}
+
+// the narrowest offsets a block of sorted values fits in
+static int RangeWidth(const uint64_t *sorted_array, int count)
+{
+	uint64_t range = sorted_array[count-1]-sorted_array[0];
+	int width = 1;
+	while (width<8 && range>MaxOffset(width))
+		width *= 2;
+	return width;
+}
+
+typedef struct PackedWriter {
+	unsigned char *leaves;
+	unsigned char *line;	// the next leaf, NULL while counting
+	unsigned char *split;	// the next line of a split leaf
+	int lines;
+} PackedWriter;
+
+static int CountLines(void *context, const uint64_t *sorted_array, int count)
+{
+	int per = PACKED_OFFSET_BYTES/RangeWidth(sorted_array, count);
+	((PackedWriter*)context)->lines += count<=per ? 1 : 1+(count+per-1)/per;
+	return 1;
+}
+
+static void WriteLine(unsigned char *line, const uint64_t *sorted_array, int count)
+{
+	int width = RangeWidth(sorted_array, count);
+	uint64_t base = sorted_array[0];
+	memset(line, 0xff, PACKED_OFFSET_BYTES);
+	for (int i = 1; i<count; i++) {
+		uint64_t offset = sorted_array[i]-base;
+		if (width==1)
+			line[i] = (unsigned char)offset;
+		else if (width==2) {
+			uint16_t o = (uint16_t)offset;
+			memcpy(line+2*i, &o, 2);
+		} else if (width==4) {
+			uint32_t o = (uint32_t)offset;
+			memcpy(line+4*i, &o, 4);
+		} else
+			memcpy(line+8*i, &offset, 8);
+	}
+	memset(line, 0, width);
+	line[0] = (unsigned char)width;
+	memcpy(line+PACKED_OFFSET_BYTES, &base, 8);
+}
+
+static int WriteLeaf(void *context, const uint64_t *sorted_array, int count)
+{
+	PackedWriter *writer = (PackedWriter*)context;
+	unsigned char *line = writer->line;
+	int per = PACKED_OFFSET_BYTES/RangeWidth(sorted_array, count);
+	writer->line += SHUFFLE_PACKED_LINE;
+	if (count<=per) {
+		WriteLine(line, sorted_array, count);
+		return 1;
+	}
+	// at most 56 values in lines of at least 7
+	uint32_t split = (uint32_t)((writer->split-writer->leaves)/SHUFFLE_PACKED_LINE);
+	memset(line, 0xff, SHUFFLE_PACKED_LINE);
+	line[0] = 0;
+	line[1] = (unsigned char)per;
+	memcpy(line+4, &split, 4);
+	for (int c = 0; c*per<count; c++) {
+		if (c>0)
+			memcpy(line+8*c, sorted_array+c*per, 8);
+		WriteLine(writer->split, sorted_array+c*per, count-c*per<per ? count-c*per : per);
+		writer->split += SHUFFLE_PACKED_LINE;
+	}
+	return 1;
+}
+
+void ShuffledPackedFree(ShuffledPacked *packed)
+{
+	free(packed->memory);
+	memset(packed, 0, sizeof(*packed));
+}
+
+int ShuffledPackedBuild(ShuffledPacked *packed, const uint64_t *sorted_array, int count)
+{
+	memset(packed, 0, sizeof(*packed));
+	if (count<0)
+		return 0;
+
+	// the values per leaf with the fewest bytes, a leaf of wider offsets than that is split
+	size_t best = 0;
+	for (int width = 1; width<=8; width *= 2) {
+		PackedWriter counter = { NULL, NULL, NULL, 0 };
+		int ntop = 0;
+		ForEachLeaf(sorted_array, count, PACKED_OFFSET_BYTES/width, NULL, &ntop, CountLines, &counter);
+		size_t bytes = (size_t)counter.lines*SHUFFLE_PACKED_LINE+(size_t)ntop*sizeof(uint64_t);
+		if (width==1 || bytes<best) {
+			best = bytes;
+			packed->leaf_max = PACKED_OFFSET_BYTES/width;
+			packed->nlines = counter.lines;
+		}
+	}
+	packed->count = count;
+
+	// sizes of the blocks at each depth and their middle values and leaves
+	int depth = 0;
+	for (int hi = count; depth<SHUFFLE_PACKED_DEPTHS; hi /= 2) {
+		packed->hi[depth++] = hi;
+		if (hi==0)
+			break;
+	}
+	packed->depths = depth;
+	for (int d = depth-1; d>=0; d--) {
+		for (int s = 0; s<2; s++) {
+			int size = packed->hi[d]-s;
+			int ntop = 0, nleaves = 0;
+			if (size>packed->leaf_max) {
+				int left = size/2, right = (size-1)/2;
+				int l = left==packed->hi[d+1] ? 0 : 1, r = right==packed->hi[d+1] ? 0 : 1;
+				ntop = 1+packed->tops[d+1][l]+packed->tops[d+1][r];
+				nleaves = packed->leaf_counts[d+1][l]+packed->leaf_counts[d+1][r];
+			} else
+				nleaves = size>0;
+			packed->tops[d][s] = ntop;
+			packed->leaf_counts[d][s] = nleaves;
+		}
+	}
+	packed->ntop = packed->tops[0][0];
+	packed->nleaves = packed->leaf_counts[0][0];
+
+	size_t leaf_bytes = (size_t)packed->nlines*SHUFFLE_PACKED_LINE;
+	packed->memory = malloc(leaf_bytes+(size_t)packed->ntop*sizeof(uint64_t)+SHUFFLE_PACKED_LINE);
+	if (!packed->memory) {
+		memset(packed, 0, sizeof(*packed));
+		return 0;
+	}
+	packed->leaves = (unsigned char*)(((uintptr_t)packed->memory+SHUFFLE_PACKED_LINE-1) & ~(uintptr_t)(SHUFFLE_PACKED_LINE-1));
+	packed->top = (uint64_t*)(packed->leaves+leaf_bytes);
+
+	PackedWriter writer = { packed->leaves, packed->leaves, packed->leaves+(size_t)packed->nleaves*SHUFFLE_PACKED_LINE, 0 };
+	int ntop = 0;
+	ForEachLeaf(sorted_array, count, packed->leaf_max, packed->top, &ntop, WriteLeaf, &writer);
+	return 1;
+}
+
+// number of offsets in a leaf less than 'offset'
+static int LeafLess(uint64_t offset, const unsigned char *line, int width)
+{
+	int less = 0;
+	if (width==8) {
+		for (int i = 0; i<PACKED_OFFSET_BYTES/8; i++)
+			less += ReadOffset(line, i, 8)<offset;
+		return less;
+	}
+#if defined(PACKED_SSE2)
+	// unsigned compares are signed compares with the top bits flipped, each byte of a lane is -1 where the offset is less
+	__m128i v, flip, mask;
+	__m128i sum = _mm_setzero_si128();
+	const __m128i *lines = (const __m128i*)line;
+	if (width==1) {
+		flip = _mm_set1_epi8((char)0x80);
+		v = _mm_xor_si128(_mm_set1_epi8((char)offset), flip);
+		for (int i = 0; i<4; i++) {
+			mask = _mm_cmpgt_epi8(v, _mm_xor_si128(_mm_load_si128(lines+i), flip));
+			sum = _mm_sub_epi8(sum, i==3 ? _mm_unpacklo_epi64(mask, _mm_setzero_si128()) : mask);
+		}
+	} else if (width==2) {
+		flip = _mm_set1_epi16((short)0x8000);
+		v = _mm_xor_si128(_mm_set1_epi16((short)offset), flip);
+		for (int i = 0; i<4; i++) {
+			mask = _mm_cmpgt_epi16(v, _mm_xor_si128(_mm_load_si128(lines+i), flip));
+			sum = _mm_sub_epi8(sum, i==3 ? _mm_unpacklo_epi64(mask, _mm_setzero_si128()) : mask);
+		}
+	} else {
+		flip = _mm_set1_epi32((int)0x80000000u);
+		v = _mm_xor_si128(_mm_set1_epi32((int)offset), flip);
+		for (int i = 0; i<4; i++) {
+			mask = _mm_cmpgt_epi32(v, _mm_xor_si128(_mm_load_si128(lines+i), flip));
+			sum = _mm_sub_epi8(sum, i==3 ? _mm_unpacklo_epi64(mask, _mm_setzero_si128()) : mask);
+		}
+	}
+	sum = _mm_sad_epu8(sum, _mm_setzero_si128());
+	less = _mm_cvtsi128_si32(sum)+_mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+	return less/width;
+#elif defined(PACKED_NEON)
+	// each byte of a lane is all ones where the offset is less
+	static const uint8_t low_half[16] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+	uint8x16_t one = vdupq_n_u8(1);
+	uint8x16_t sum = vdupq_n_u8(0);
+	for (int i = 0; i<4; i++) {
+		uint8x16_t mask;
+		if (width==1)
+			mask = vcltq_u8(vld1q_u8(line+16*i), vdupq_n_u8((uint8_t)offset));
+		else if (width==2)
+			mask = vreinterpretq_u8_u16(vcltq_u16(vld1q_u16((const uint16_t*)(line+16*i)), vdupq_n_u16((uint16_t)offset)));
+		else
+			mask = vreinterpretq_u8_u32(vcltq_u32(vld1q_u32((const uint32_t*)(line+16*i)), vdupq_n_u32((uint32_t)offset)));
+		sum = vaddq_u8(sum, vandq_u8(mask, i==3 ? vld1q_u8(low_half) : one));
+	}
+	return vaddvq_u8(sum)/width;
+#else
+	for (int i = 0; i<PACKED_OFFSET_BYTES/width; i++)
+		less += ReadOffset(line, i, width)<offset;
+	return less;
+#endif
+}
+
+int ShuffledPackedSearch(uint64_t value, const ShuffledPacked *packed)
+{
+	const uint64_t *top = packed->top;
+	int count = packed->count;
+	int index = 0, leaf = 0, first = 0;
+	for (int depth = 1; count>packed->leaf_max; depth++) {
+		uint64_t read = top[index];
+		int less = count/2;
+		int s = less!=packed->hi[depth];	// size of the left half at the next depth
+		if (value==read)
+			return first+less;
+		else if (value>read) {
+			index += 1+packed->tops[depth][s];
+			leaf += packed->leaf_counts[depth][s];
+			first += less+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count = less;
+		}
+	}
+	if (count==0)
+		return -1;
+
+	const unsigned char *line = packed->leaves+(size_t)leaf*SHUFFLE_PACKED_LINE;
+	if (line[0]==0) {
+		// a split leaf, the line of the value is the last one that starts at or before it
+		int per = line[1], c = 1;
+		uint32_t split;
+		memcpy(&split, line+4, 4);
+		for (; c*per<count; c++) {
+			uint64_t read;
+			memcpy(&read, line+8*c, 8);
+			if (value<read)
+				break;
+		}
+		c--;
+		first += c*per;
+		count = count-c*per<per ? count-c*per : per;
+		line = packed->leaves+((size_t)split+c)*SHUFFLE_PACKED_LINE;
+	}
+	int width = line[0];
+	uint64_t base;
+	memcpy(&base, line+PACKED_OFFSET_BYTES, 8);
+	if (value<base || value-base>MaxOffset(width))
+		return -1;
+	uint64_t offset = value-base;
+	if (offset==0)
+		return first;
+	// the first offset is the width, count the 0 it stands for instead
+	int less = LeafLess(offset, line, width)-(ReadOffset(line, 0, width)<offset)+1;
+	if (less>=count)
+		return -1;
+	return ReadOffset(line, less, width)==offset ? first+less : -1;
+}
+
+static void UnpackLine(const unsigned char *line, uint64_t *sorted_array, int count)
+{
+	int width = line[0];
+	uint64_t base;
+	memcpy(&base, line+PACKED_OFFSET_BYTES, 8);
+	sorted_array[0] = base;
+	for (int i = 1; i<count; i++)
+		sorted_array[i] = base+ReadOffset(line, i, width);
+}
+
+static void UnpackBlock(const ShuffledPacked *packed, uint64_t *sorted_array, int count, int *ntop, int *nleaves)
+{
+	while (count>packed->leaf_max) {
+		sorted_array[count/2] = packed->top[(*ntop)++];
+		UnpackBlock(packed, sorted_array, count/2, ntop, nleaves);
+		sorted_array += count/2+1;
+		count = (count-1)/2;
+	}
+	if (count==0)
+		return;
+	const unsigned char *line = packed->leaves+(size_t)(*nleaves)++*SHUFFLE_PACKED_LINE;
+	if (line[0]==0) {
+		int per = line[1];
+		uint32_t split;
+		memcpy(&split, line+4, 4);
+		for (int c = 0; c*per<count; c++)
+			UnpackLine(packed->leaves+((size_t)split+c)*SHUFFLE_PACKED_LINE, sorted_array+c*per, count-c*per<per ? count-c*per : per);
+	} else
+		UnpackLine(line, sorted_array, count);
+}
+
+void ShuffledPackedUnpack(const ShuffledPacked *packed, uint64_t *sorted_array)
+{
+	int ntop = 0, nleaves = 0;
+	UnpackBlock(packed, sorted_array, packed->count, &ntop, &nleaves);
+}
+
+size_t ShuffledPackedBytes(const ShuffledPacked *packed)
+{
+	return (size_t)packed->nlines*SHUFFLE_PACKED_LINE+(size_t)packed->ntop*sizeof(uint64_t);
+}
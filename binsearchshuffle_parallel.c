@@ -0,0 +1,374 @@
+/*
+Parallel Shuffle
+
+ShuffleSortedArray rotates the middle value of the array to the front and then
+shuffles the lower half and the upper half, which don't share any values. So
+after the first rotation the two halves can be shuffled at the same time,
+after the second level of rotations there are four and so on.
+
+- void ShuffleSortedArrayParallel(int *array, int count, const ShuffleScheduler *scheduler)
+	- shuffles a sorted array in-place on multiple threads
+- void SortShuffledArrayParallel(int *array, int count, const ShuffleScheduler *scheduler)
+	- sorts a shuffled array in-place on multiple threads
+
+The top levels have few blocks so each block's rotation is split into chunks
+as well: a rotation by one is a memmove of each chunk by one, with the value
+that moves between two chunks saved before and stored after. Once there are
+SHUFFLE_TASKS_PER_WORKER blocks per worker the remaining blocks are shuffled
+by ShuffleSortedArray as one task each. Sorting is the same with the rotations
+in the other direction.
+
+Each run of the scheduler is a list of independent tasks. ShuffleThreadScheduler
+runs them on 'workers' threads that take the next task from a shared counter
+until all tasks are taken, so a thread that is done early takes more tasks and
+uneven tasks balance out. The threads are a pool shared by all built-in
+schedulers, started by the first run that needs them and then waiting for the
+next run, so a run costs a wake up instead of a thread start per worker. A run
+while another one has the pool, from another thread or from inside a task,
+starts threads of its own. To share threads with the rest of a program, set
+'run' to a function that hands the tasks to an existing job system.
+
+Arrays smaller than 2*SHUFFLE_PARALLEL_MIN are shuffled on the calling thread.
+*/
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle_parallel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifndef SHUFFLE_PARALLEL_MIN
+#define SHUFFLE_PARALLEL_MIN (1<<15)	// values per task, less is not worth a thread
+#endif
+
+#ifndef SHUFFLE_TASKS_PER_WORKER
+#define SHUFFLE_TASKS_PER_WORKER 8
+#endif
+
+typedef struct { int first, count; } ShuffleBlock;
+typedef struct { int first, count, saved; } ShuffleChunk;
+
+typedef struct {
+	int *array;
+	ShuffleBlock *blocks;
+	ShuffleChunk *chunks;
+	int sort;	// rotate left and call SortShuffledArray
+} ShuffleParallelJob;
+
+// move a chunk of a rotation by one, the value pushed out of the chunk is saved before
+static void RotateChunkTask(void *data, int task)
+{
+	ShuffleParallelJob *job = (ShuffleParallelJob*)data;
+	int *chunk = job->array + job->chunks[task].first;
+	int count = job->chunks[task].count;
+	if (job->sort)
+		memmove(chunk, chunk+1, sizeof(int) * (count-1));
+	else
+		memmove(chunk+1, chunk, sizeof(int) * (count-1));
+}
+
+static void ShuffleBlockTask(void *data, int task)
+{
+	ShuffleParallelJob *job = (ShuffleParallelJob*)data;
+	int *block = job->array + job->blocks[task].first;
+	if (job->sort)
+		SortShuffledArray(block, job->blocks[task].count);
+	else
+		ShuffleSortedArray(block, job->blocks[task].count);
+}
+
+// rotate values first to first+count/2 of each block on the scheduler, right
+// to shuffle (middle value first) or left to sort (first value to the middle)
+static void RotateBlocks(ShuffleParallelJob *job, int nblocks, int max_chunks, const ShuffleScheduler *scheduler)
+{
+	int *array = job->array;
+	long long moved = 0;
+	for (int b = 0; b<nblocks; b++)
+		moved += job->blocks[b].count/2 + 1;
+	// at most nblocks + max_chunks chunks
+	int chunk_size = (int)((moved+max_chunks-1) / max_chunks);
+	if (chunk_size<SHUFFLE_PARALLEL_MIN)
+		chunk_size = SHUFFLE_PARALLEL_MIN;
+	int nchunks = 0;
+	for (int b = 0; b<nblocks; b++) {
+		int first = job->blocks[b].first;
+		int end = first + job->blocks[b].count/2 + 1;
+		for (int a = first; a<end; a += chunk_size) {
+			ShuffleChunk *chunk = job->chunks + nchunks++;
+			chunk->first = a;
+			chunk->count = end-a<chunk_size ? end-a : chunk_size;
+			chunk->saved = job->sort ? array[a] : array[a+chunk->count-1];
+		}
+	}
+	scheduler->run(scheduler, RotateChunkTask, job, nchunks);
+	for (int c = 0, b = 0; c<nchunks; c++) {
+		ShuffleChunk *chunk = job->chunks + c;
+		int first = job->blocks[b].first;
+		int end = first + job->blocks[b].count/2 + 1;
+		if (job->sort)
+			array[chunk->first>first ? chunk->first-1 : end-1] = chunk->saved;
+		else
+			array[chunk->first+chunk->count<end ? chunk->first+chunk->count : first] = chunk->saved;
+		if (chunk->first+chunk->count==end)
+			b++;
+	}
+}
+
+static void ParallelShuffle(int *array, int count, const ShuffleScheduler *scheduler, int sort)
+{
+	ShuffleScheduler threads;
+	if (!scheduler) {
+		threads = ShuffleThreadScheduler(0);
+		scheduler = &threads;
+	}
+	int workers = scheduler->workers;
+	int max_blocks = (workers>0 ? workers : 1) * SHUFFLE_TASKS_PER_WORKER;
+	ShuffleParallelJob job;
+	job.array = array;
+	job.sort = sort;
+	job.blocks = NULL;
+	job.chunks = NULL;
+	if (workers>1 && scheduler->run && count>=2*SHUFFLE_PARALLEL_MIN) {
+		// the last level has less than 2*max_blocks blocks, rotations have less than 2*max_blocks chunks
+		job.blocks = (ShuffleBlock*)malloc(sizeof(ShuffleBlock) * 2 * max_blocks);
+		job.chunks = (ShuffleChunk*)malloc(sizeof(ShuffleChunk) * 2 * max_blocks);
+	}
+	if (!job.blocks || !job.chunks) {
+		free(job.blocks);
+		free(job.chunks);
+		if (sort)
+			SortShuffledArray(array, count);
+		else
+			ShuffleSortedArray(array, count);
+		return;
+	}
+
+	int nblocks = 1;
+	job.blocks[0].first = 0;
+	job.blocks[0].count = count;
+	// blocks on a level differ by at most one value so the last block is the smallest
+	while (nblocks<max_blocks && job.blocks[nblocks-1].count>=2*SHUFFLE_PARALLEL_MIN) {
+		RotateBlocks(&job, nblocks, max_blocks, scheduler);
+		// lower half after the middle value (shuffle) or before it (sort), then the upper half
+		for (int b = nblocks-1; b>=0; b--) {
+			int first = job.blocks[b].first;
+			int half = job.blocks[b].count;
+			job.blocks[2*b].first = sort ? first : first+1;
+			job.blocks[2*b].count = half/2;
+			job.blocks[2*b+1].first = first+half/2+1;
+			job.blocks[2*b+1].count = (half-1)/2;
+		}
+		nblocks *= 2;
+	}
+	scheduler->run(scheduler, ShuffleBlockTask, &job, nblocks);
+	free(job.chunks);
+	free(job.blocks);
+}
+
+void ShuffleSortedArrayParallel(int *array, int count, const ShuffleScheduler *scheduler)
+{
+	ParallelShuffle(array, count, scheduler, 0);
+}
+
+void SortShuffledArrayParallel(int *array, int count, const ShuffleScheduler *scheduler)
+{
+	ParallelShuffle(array, count, scheduler, 1);
+}
+
+// built-in threads
+
+typedef struct {
+	ShuffleTaskFunc func;
+	void *data;
+	int tasks;
+	volatile long next;
+} ShuffleTaskQueue;
+
+static int NextTask(ShuffleTaskQueue *queue)
+{
+#ifdef _WIN32
+	return (int)InterlockedIncrement(&queue->next) - 1;
+#else
+	return (int)__atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static void RunTasks(ShuffleTaskQueue *queue)
+{
+	for (int task = NextTask(queue); task<queue->tasks; task = NextTask(queue))
+		queue->func(queue->data, task);
+}
+
+#ifdef _WIN32
+typedef HANDLE ShuffleThread;
+static SRWLOCK s_pool_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE s_pool_start = CONDITION_VARIABLE_INIT;
+static CONDITION_VARIABLE s_pool_done = CONDITION_VARIABLE_INIT;
+#define POOL_LOCK() AcquireSRWLockExclusive(&s_pool_lock)
+#define POOL_UNLOCK() ReleaseSRWLockExclusive(&s_pool_lock)
+#define POOL_WAIT(c) SleepConditionVariableSRW(&(c), &s_pool_lock, INFINITE, 0)
+#define POOL_WAKE(c) WakeAllConditionVariable(&(c))
+#define THREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN return 0
+#else
+typedef pthread_t ShuffleThread;
+static pthread_mutex_t s_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t s_pool_done = PTHREAD_COND_INITIALIZER;
+#define POOL_LOCK() pthread_mutex_lock(&s_pool_lock)
+#define POOL_UNLOCK() pthread_mutex_unlock(&s_pool_lock)
+#define POOL_WAIT(c) pthread_cond_wait(&(c), &s_pool_lock)
+#define POOL_WAKE(c) pthread_cond_broadcast(&(c))
+#define THREAD_FUNC(name, arg) static void *name(void *arg)
+#define THREAD_RETURN return NULL
+#endif
+
+// the threads of all built-in schedulers, started on the first run that needs
+// them and kept for the next runs, one run at a time
+static struct {
+	ShuffleTaskQueue *queue;	// of the current run
+	long run;					// counts the runs, a thread waits until it changes
+	int threads;				// started
+	int wanted;					// threads the current run still takes
+	int active;					// threads of the current run that aren't done
+	int busy;					// a run has the pool
+} s_pool;
+
+THREAD_FUNC(PoolThread, unused)
+{
+	(void)unused;
+	long seen = 0;
+	POOL_LOCK();
+	for (;;) {
+		while (s_pool.run==seen)
+			POOL_WAIT(s_pool_start);
+		seen = s_pool.run;
+		if (s_pool.wanted>0) {
+			ShuffleTaskQueue *queue = s_pool.queue;
+			s_pool.wanted--;
+			POOL_UNLOCK();
+			RunTasks(queue);
+			POOL_LOCK();
+			if (--s_pool.active==0)
+				POOL_WAKE(s_pool_done);
+		}
+	}
+	THREAD_RETURN;
+}
+
+THREAD_FUNC(TaskThread, queue)
+{
+	RunTasks((ShuffleTaskQueue*)queue);
+	THREAD_RETURN;
+}
+
+// runs the queue on 'threads' threads of the pool and the calling thread, 0 if another run has the pool
+static int RunPool(ShuffleTaskQueue *queue, int threads)
+{
+	POOL_LOCK();
+	if (s_pool.busy) {
+		POOL_UNLOCK();
+		return 0;
+	}
+	s_pool.busy = 1;
+	for (; s_pool.threads<threads; s_pool.threads++) {
+#ifdef _WIN32
+		HANDLE thread = CreateThread(NULL, 0, PoolThread, NULL, 0, NULL);
+		if (!thread)
+			break;
+		CloseHandle(thread);
+#else
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, PoolThread, NULL))
+			break;
+		pthread_detach(thread);
+#endif
+	}
+	s_pool.queue = queue;
+	s_pool.wanted = s_pool.active = threads<s_pool.threads ? threads : s_pool.threads;
+	s_pool.run++;
+	POOL_WAKE(s_pool_start);
+	POOL_UNLOCK();
+
+	RunTasks(queue);	// any tasks threads that failed to start would have taken are done here
+
+	POOL_LOCK();
+	while (s_pool.active>0)
+		POOL_WAIT(s_pool_done);
+	s_pool.queue = NULL;
+	s_pool.busy = 0;
+	POOL_UNLOCK();
+	return 1;
+}
+
+static void RunThreads(const ShuffleScheduler *scheduler, ShuffleTaskFunc func, void *data, int tasks)
+{
+	ShuffleTaskQueue queue;
+	queue.func = func;
+	queue.data = data;
+	queue.tasks = tasks;
+	queue.next = 0;
+
+	int threads = (scheduler->workers<tasks ? scheduler->workers : tasks) - 1;	// the calling thread is a worker too
+	if (threads<=0) {
+		RunTasks(&queue);
+		return;
+	}
+	if (RunPool(&queue, threads))
+		return;
+
+	// a run from another thread or from one of the tasks has the pool, start threads for this one
+	ShuffleThread *handles = (ShuffleThread*)malloc(sizeof(ShuffleThread) * threads);
+	int started = 0;
+	if (handles) {
+		for (; started<threads; started++) {
+#ifdef _WIN32
+			if (!(handles[started] = CreateThread(NULL, 0, TaskThread, &queue, 0, NULL)))
+				break;
+#else
+			if (pthread_create(handles + started, NULL, TaskThread, &queue))
+				break;
+#endif
+		}
+	}
+	RunTasks(&queue);
+	for (int t = 0; t<started; t++) {
+#ifdef _WIN32
+		WaitForSingleObject(handles[t], INFINITE);
+		CloseHandle(handles[t]);
+#else
+		pthread_join(handles[t], NULL);
+#endif
+	}
+	free(handles);
+}
+
+int ShuffleCoreCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores>0 ? (int)cores : 1;
+#endif
+}
+
+ShuffleScheduler ShuffleThreadScheduler(int workers)
+{
+	ShuffleScheduler scheduler;
+	scheduler.run = RunThreads;
+	scheduler.user = NULL;
+	scheduler.workers = workers>0 ? workers : ShuffleCoreCount();
+	return scheduler;
+}
@@ -0,0 +1,32 @@
+#ifndef __BINSHUFFLE_PARALLEL_H__
+#define __BINSHUFFLE_PARALLEL_H__
+
+#include "binsearchshuffle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Multithreaded shuffle and sort, see binsearchshuffle_parallel.c
+
+// a task scheduler runs func(data, task) for task 0 to tasks-1 on any number of
+// threads and returns when all tasks are done, tasks of one run are independent
+typedef void (*ShuffleTaskFunc)(void *data, int task);
+typedef struct ShuffleScheduler {
+	void (*run)(const struct ShuffleScheduler *scheduler, ShuffleTaskFunc func, void *data, int tasks);
+	void *user;		// for the scheduler
+	int workers;	// number of threads the scheduler runs tasks on, the work is split by this
+} ShuffleScheduler;
+
+int ShuffleCoreCount(void); // number of cores online
+ShuffleScheduler ShuffleThreadScheduler(int workers); // built-in threads, 0 = one per core
+
+// same result as ShuffleSortedArray and SortShuffledArray, scheduler NULL = ShuffleThreadScheduler(0)
+void ShuffleSortedArrayParallel(int *array, int count, const ShuffleScheduler *scheduler);
+void SortShuffledArrayParallel(int *array, int count, const ShuffleScheduler *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
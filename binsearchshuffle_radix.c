@@ -0,0 +1,130 @@
+/*
+Radix Entry to a Shuffled Array
+
+ShuffledBinarySearch starts every search at the root, so with uniform keys the
+first levels all make the same choices for values that share their top bits.
+The radix table has an entry for each value of the top 'bits' bits of
+value-min, which is the smallest subtree of the shuffled array that holds
+every value with those bits, and the search starts there instead of at the
+root.
+
+- int ShuffledRadixInit(ShuffledRadix *radix, const int *shuffled_array, int count, int bits)
+	- builds the table for a shuffled array, bits 0 picks a size from 'count', 0 if out of memory
+- void ShuffledRadixFree(ShuffledRadix *radix)
+- int ShuffledRadixSearch(int value, const ShuffledRadix *radix, const int *shuffled_array, int count)
+	- the same result as ShuffledBinarySearch
+
+Buckets
+
+The values from min to max are split into 2^bits buckets of 2^shift values,
+with the shift the smallest that covers max-min. The entry of a bucket is found
+by descending from the root while the whole bucket is on one side of the
+middle value, so it is the first block whose middle value is in the bucket or,
+for a bucket without values, an empty block. With uniform keys and about
+count/2^bits values per bucket the search skips about bits-1 levels, as one
+read of the table. Clustered keys skip less where they cluster, but the
+search is never longer than ShuffledBinarySearch apart from the read of the
+table, which should stay in the caches: the default is at most
+SHUFFLE_RADIX_MAX_BITS bits, 8 bytes per entry.
+*/
+
+#include <stdlib.h>
+#include "binsearchshuffle.h"
+
+#ifndef SHUFFLE_RADIX_MAX_BITS
+#define SHUFFLE_RADIX_MAX_BITS 12	// 32 KB table
+#endif
+
+void ShuffledRadixFree(ShuffledRadix *radix)
+{
+	free(radix->table);
+	radix->table = NULL;
+	radix->bits = 0;
+}
+
+int ShuffledRadixInit(ShuffledRadix *radix, const int *shuffled_array, int count, int bits)
+{
+	radix->table = NULL;
+	radix->bits = 0;
+	radix->shift = 0;
+	radix->min = 0;
+	radix->max = -1;
+	if (count<=0)
+		return 1;	// every search misses
+
+	// the first and last values are at the ends of the left and right spines
+	int index = 0, block = count;
+	while (block/2) {
+		index++;
+		block /= 2;
+	}
+	radix->min = shuffled_array[index];
+	index = 0;
+	for (block = count; (block-1)/2; block = (block-1)/2)
+		index += block/2+1;
+	radix->max = shuffled_array[index];
+
+	if (bits<=0) {
+		// about 2 to 4 values per bucket
+		for (bits = 1; bits<SHUFFLE_RADIX_MAX_BITS && (2<<(bits+1))<=count; bits++);
+	}
+	if (bits>24)
+		bits = 24;
+	unsigned int range = (unsigned int)radix->max-(unsigned int)radix->min;
+	int shift = 0;
+	while (shift<32 && (range>>shift)>=(1u<<bits))
+		shift++;
+	while (bits>1 && (range>>shift)<(1u<<(bits-1)))
+		bits--;	// fewer buckets for a small range
+	radix->bits = bits;
+	radix->shift = shift;
+	radix->table = (int*)malloc(sizeof(int) * 2 * ((size_t)1<<bits));
+	if (!radix->table) {
+		radix->bits = 0;
+		return 0;
+	}
+
+	for (unsigned int bucket = 0; bucket<(1u<<bits); bucket++) {
+		// values min+(bucket<<shift) to min+((bucket+1)<<shift)-1 in 64 bits so nothing wraps
+		long long lo = (long long)radix->min+((long long)bucket<<shift);
+		long long hi = lo+((long long)1<<shift)-1;
+		index = 0;
+		block = count;
+		while (block) {
+			int read = shuffled_array[index];
+			if (hi<read) {
+				index++;
+				block /= 2;
+			} else if (lo>read) {
+				index += block/2+1;
+				block = (block-1)/2;
+			} else
+				break;
+		}
+		radix->table[2*bucket] = index;
+		radix->table[2*bucket+1] = block;
+	}
+	return 1;
+}
+
+int ShuffledRadixSearch(int value, const ShuffledRadix *radix, const int *shuffled_array, int count)
+{
+	if (value<radix->min || value>radix->max)
+		return -1;
+	unsigned int bucket = ((unsigned int)value-(unsigned int)radix->min)>>radix->shift;
+	int index = radix->table[2*bucket];
+	count = radix->table[2*bucket+1];
+	while (count>0) {
+		int read = shuffled_array[index];
+		if (value==read)
+			return index;
+		else if (value>read) {
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	return -1;	// index not found
+}
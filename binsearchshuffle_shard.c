@@ -0,0 +1,362 @@
+/*
+Sharded Shuffled Index
+
+One shuffled array is searched at the rate of the cores that can reach it and
+lives in the memory of one NUMA node. The sharded index splits sorted values
+into ranges of about the same size, and each range is a shuffled array in
+memory of its own node. A small shuffled array of fence values, the first
+value of every shard but the first, routes a value to its shard with
+ShuffledUpperBound.
+
+- int ShuffleNumaNodeCount(void)
+	- NUMA nodes of the machine, 1 without NUMA
+- int ShuffledShardInit(ShuffledShardIndex *index, const int *sorted_array, int count, int nshards, const int *nodes)
+	- copies sorted unique values into 'nshards' shards, 0 if out of memory
+- void ShuffledShardFree(ShuffledShardIndex *index)
+- int ShuffledShardOf(const ShuffledShardIndex *index, int value)
+	- shard a value is in or would be in
+- int ShuffledShardSearch(const ShuffledShardIndex *index, int value)
+	- linear index of a value in the sorted values (returns -1 if value was not found)
+- void ShuffledShardSearchBatch(const ShuffledShardIndex *index, const int *values, int nvalues, int *out_indices, const ShuffleScheduler *scheduler)
+	- ShuffledShardSearch of many values on the scheduler
+
+Placement
+
+Without 'nodes' the shards go round robin over the nodes, and with nshards 0
+there is one shard per node. On Linux the pages of a shard are bound to its
+node with mbind (MPOL_PREFERRED, so a full node falls back to another one)
+before they are written, on Windows they come from VirtualAllocExNuma. If the
+pages can't be placed the shard's node is -1.
+
+Batches
+
+A batch routes every value and sorts the values by shard with a counting sort,
+then each shard's values are searched in tasks of SHUFFLE_SHARD_TASK values
+with ShuffledBinarySearchBatchDeshuffled, which overlaps the memory reads. On
+a machine with more than one node a task moves its thread to the cores of the
+shard's node while it runs and back after, so the reads stay local to the
+node. The tasks are ordered by node so a thread mostly stays on one node.
+*/
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle_shard.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef ULONGLONG ShuffleCpuMask;
+#else
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#if defined(__linux__) && defined(CPU_SET)
+typedef cpu_set_t ShuffleCpuMask;
+#define SHARD_AFFINITY 1
+#endif
+#endif
+
+#define SHARD_MAX_NODES 1024
+#define MPOL_PREFERRED_MODE 1	// MPOL_PREFERRED from numaif.h, which is not always installed
+
+#if defined(__linux__)
+// calls 'item' for each number of a list like "0-3,8,10-11", returns 0 if the file can't be read
+static int ReadList(const char *path, void (*item)(void *context, int number), void *context)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return 0;
+	char line[4096];
+	int ok = fgets(line, sizeof(line), file)!=NULL;
+	fclose(file);
+	for (char *p = line; ok && *p>='0' && *p<='9';) {
+		int first = (int)strtol(p, &p, 10), last = first;
+		if (*p=='-')
+			last = (int)strtol(p+1, &p, 10);
+		for (int n = first; n<=last && n<SHARD_MAX_NODES*64; n++)
+			item(context, n);
+		if (*p==',')
+			p++;
+	}
+	return ok;
+}
+
+static void MaxItem(void *context, int number)
+{
+	if (number>=*(int*)context)
+		*(int*)context = number+1;
+}
+
+#ifdef SHARD_AFFINITY
+static void CpuItem(void *context, int number)
+{
+	if (number<CPU_SETSIZE)
+		CPU_SET(number, (cpu_set_t*)context);
+}
+#endif
+#endif
+
+int ShuffleNumaNodeCount(void)
+{
+#ifdef _WIN32
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest))
+		return 1;
+	return (int)highest+1;
+#elif defined(__linux__)
+	int nodes = 0;
+	if (!ReadList("/sys/devices/system/node/online", MaxItem, &nodes) || nodes<1)
+		return 1;
+	return nodes<SHARD_MAX_NODES ? nodes : SHARD_MAX_NODES;
+#else
+	return 1;
+#endif
+}
+
+// 'bytes' bytes on 'node' (-1 for any), *placed is the node the pages are bound to or -1
+static int *AllocOnNode(size_t bytes, int node, int *placed)
+{
+	*placed = -1;
+#ifdef _WIN32
+	void *memory = NULL;
+	if (node>=0) {
+		memory = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+		if (memory)
+			*placed = node;
+	}
+	if (!memory)
+		memory = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	return (int*)memory;
+#else
+	void *memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory==MAP_FAILED)
+		return NULL;
+#if defined(__linux__) && defined(SYS_mbind)
+	if (node>=0 && node<SHARD_MAX_NODES) {
+		unsigned long mask[SHARD_MAX_NODES/(8*sizeof(unsigned long))];
+		memset(mask, 0, sizeof(mask));
+		mask[node/(8*sizeof(unsigned long))] = 1ul<<(node%(8*sizeof(unsigned long)));
+		if (!syscall(SYS_mbind, memory, bytes, MPOL_PREFERRED_MODE, mask, (unsigned long)SHARD_MAX_NODES, 0))
+			*placed = node;
+	}
+#endif
+	return (int*)memory;
+#endif
+}
+
+static void FreeOnNode(int *values, size_t bytes)
+{
+	if (!values)
+		return;
+#ifdef _WIN32
+	(void)bytes;
+	VirtualFree(values, 0, MEM_RELEASE);
+#else
+	munmap(values, bytes);
+#endif
+}
+
+// cores of each node, NULL if there is one node or they can't be read
+static void *ReadNodeCpus(int nnodes)
+{
+	if (nnodes<2)
+		return NULL;
+#ifdef _WIN32
+	ShuffleCpuMask *cpus = (ShuffleCpuMask*)calloc(nnodes, sizeof(ShuffleCpuMask));
+	for (int n = 0; cpus && n<nnodes; n++)
+		GetNumaNodeProcessorMask((UCHAR)n, &cpus[n]);
+	return cpus;
+#elif defined(SHARD_AFFINITY)
+	ShuffleCpuMask *cpus = (ShuffleCpuMask*)calloc(nnodes, sizeof(ShuffleCpuMask));
+	for (int n = 0; cpus && n<nnodes; n++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+		CPU_ZERO(&cpus[n]);
+		ReadList(path, CpuItem, &cpus[n]);	// an offline node has no cores and its tasks aren't moved
+	}
+	return cpus;
+#else
+	return NULL;
+#endif
+}
+
+void ShuffledShardFree(ShuffledShardIndex *index)
+{
+	for (int s = 0; index->shards && s<index->nshards; s++)
+		FreeOnNode(index->shards[s].values, index->shards[s].bytes);
+	free(index->shards);
+	free(index->fences);
+	free(index->node_cpus);
+	memset(index, 0, sizeof(*index));
+}
+
+int ShuffledShardInit(ShuffledShardIndex *index, const int *sorted_array, int count, int nshards, const int *nodes)
+{
+	memset(index, 0, sizeof(*index));
+	index->nnodes = ShuffleNumaNodeCount();
+	if (nshards<=0)
+		nshards = index->nnodes;
+	if (nshards>count)
+		nshards = count>0 ? count : 1;	// no empty shards between fences
+	index->shards = (ShuffledShard*)calloc(nshards, sizeof(ShuffledShard));
+	index->fences = (int*)malloc(sizeof(int) * (nshards>1 ? nshards-1 : 1));
+	if (!index->shards || !index->fences) {
+		ShuffledShardFree(index);
+		return 0;
+	}
+	index->nshards = nshards;
+	index->count = count;
+
+	for (int s = 0; s<nshards; s++) {
+		ShuffledShard *shard = index->shards+s;
+		int first = (int)((long long)count*s/nshards);
+		int end = (int)((long long)count*(s+1)/nshards);
+		int node = nodes ? nodes[s] : (index->nnodes>1 ? s%index->nnodes : -1);
+		shard->first = first;
+		shard->count = end-first;
+		shard->node = -1;
+		if (shard->count) {
+			shard->bytes = sizeof(int) * shard->count;
+			shard->values = AllocOnNode(shard->bytes, node, &shard->node);
+			if (!shard->values) {
+				ShuffledShardFree(index);
+				return 0;
+			}
+			ShuffleSortedArrayCopy(shard->values, sorted_array+first, shard->count);
+		}
+		if (s)
+			index->fences[s-1] = sorted_array[first];
+	}
+	ShuffleSortedArray(index->fences, nshards-1);
+	index->node_cpus = ReadNodeCpus(index->nnodes);
+	return 1;
+}
+
+int ShuffledShardOf(const ShuffledShardIndex *index, int value)
+{
+	return ShuffledUpperBound(value, index->fences, index->nshards-1);
+}
+
+int ShuffledShardSearch(const ShuffledShardIndex *index, int value)
+{
+	const ShuffledShard *shard = index->shards+ShuffledShardOf(index, value);
+	int found = ShuffledBinarySearch(value, shard->values, shard->count);
+	return found>=0 ? shard->first+DeshuffleIndex(found, shard->count) : -1;
+}
+
+typedef struct { int shard, first, count; } ShardTask;
+
+typedef struct {
+	const ShuffledShardIndex *index;
+	const int *keys;		// values sorted by shard
+	const int *positions;	// position of each key in the batch
+	int *found;				// linear index of each key in its shard
+	int *out_indices;
+	ShardTask *tasks;
+} ShardJob;
+
+static void SearchShardTask(void *data, int task)
+{
+	ShardJob *job = (ShardJob*)data;
+	const ShardTask *t = job->tasks+task;
+	const ShuffledShard *shard = job->index->shards+t->shard;
+	int moved = 0;
+	int node = shard->node<job->index->nnodes ? shard->node : -1;
+#ifdef _WIN32
+	DWORD_PTR saved = 0;
+	if (job->index->node_cpus && node>=0 && ((ShuffleCpuMask*)job->index->node_cpus)[node])
+		moved = (saved = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)((ShuffleCpuMask*)job->index->node_cpus)[node]))!=0;
+#elif defined(SHARD_AFFINITY)
+	cpu_set_t saved;
+	if (job->index->node_cpus && node>=0 && CPU_COUNT(&((ShuffleCpuMask*)job->index->node_cpus)[node]))
+		moved = !sched_getaffinity(0, sizeof(saved), &saved) &&
+			!sched_setaffinity(0, sizeof(cpu_set_t), &((ShuffleCpuMask*)job->index->node_cpus)[node]);
+#endif
+
+	ShuffledBinarySearchBatchDeshuffled(job->keys+t->first, t->count, shard->values, shard->count, job->found+t->first);
+	for (int i = t->first; i<t->first+t->count; i++)
+		job->out_indices[job->positions[i]] = job->found[i]>=0 ? shard->first+job->found[i] : -1;
+
+	if (moved) {
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), saved);
+#elif defined(SHARD_AFFINITY)
+		sched_setaffinity(0, sizeof(saved), &saved);
+#endif
+	}
+}
+
+void ShuffledShardSearchBatch(const ShuffledShardIndex *index, const int *values, int nvalues, int *out_indices, const ShuffleScheduler *scheduler)
+{
+	int nshards = index->nshards;
+	int max_tasks = nshards + nvalues/SHUFFLE_SHARD_TASK + 1;
+	int *starts = (int*)calloc(nshards+1, sizeof(int));
+	int *scratch = (int*)malloc(sizeof(int) * 3 * (size_t)nvalues + 1);
+	ShardTask *tasks = (ShardTask*)malloc(sizeof(ShardTask) * max_tasks);
+	if (!starts || !scratch || !tasks) {
+		free(starts);
+		free(scratch);
+		free(tasks);
+		for (int i = 0; i<nvalues; i++)
+			out_indices[i] = ShuffledShardSearch(index, values[i]);
+		return;
+	}
+	ShuffleScheduler threads;
+	if (!scheduler) {
+		threads = ShuffleThreadScheduler(0);
+		scheduler = &threads;
+	}
+
+	// counting sort by shard, out_indices holds the shard of each value until the tasks run
+	for (int i = 0; i<nvalues; i++) {
+		out_indices[i] = ShuffledShardOf(index, values[i]);
+		starts[out_indices[i]+1]++;
+	}
+	for (int s = 0; s<nshards; s++)
+		starts[s+1] += starts[s];
+	int *keys = scratch, *positions = scratch+nvalues, *found = scratch+2*nvalues;
+	for (int i = 0; i<nvalues; i++) {
+		int at = starts[out_indices[i]]++;
+		keys[at] = values[i];
+		positions[at] = i;
+	}
+	// starts[s] is now the end of shard s, tasks of the shards of each node in order
+	int ntasks = 0;
+	for (int node = -1; node<index->nnodes; node++) {
+		for (int s = 0; s<nshards; s++) {
+			int shard_node = index->shards[s].node<index->nnodes ? index->shards[s].node : -1;
+			if (shard_node!=node)
+				continue;
+			for (int first = s ? starts[s-1] : 0; first<starts[s]; first += SHUFFLE_SHARD_TASK) {
+				tasks[ntasks].shard = s;
+				tasks[ntasks].first = first;
+				tasks[ntasks].count = starts[s]-first<SHUFFLE_SHARD_TASK ? starts[s]-first : SHUFFLE_SHARD_TASK;
+				ntasks++;
+			}
+		}
+	}
+
+	ShardJob job;
+	job.index = index;
+	job.keys = keys;
+	job.positions = positions;
+	job.found = found;
+	job.out_indices = out_indices;
+	job.tasks = tasks;
+	if (scheduler->run && scheduler->workers>1 && ntasks>1)
+		scheduler->run(scheduler, SearchShardTask, &job, ntasks);
+	else {
+		for (int t = 0; t<ntasks; t++)
+			SearchShardTask(&job, t);
+	}
+	free(tasks);
+	free(scratch);
+	free(starts);
+}
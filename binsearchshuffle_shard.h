@@ -0,0 +1,50 @@
+#ifndef __BINSHUFFLE_SHARD_H__
+#define __BINSHUFFLE_SHARD_H__
+
+#include "binsearchshuffle_parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Values range partitioned into shuffled arrays on NUMA nodes, see binsearchshuffle_shard.c
+
+#ifndef SHUFFLE_SHARD_TASK
+#define SHUFFLE_SHARD_TASK 4096		// lookups per task of a batch
+#endif
+
+// one range of the values in its own shuffled array
+typedef struct ShuffledShard {
+	int *values;		// 'count' shuffled values
+	int count;
+	int first;			// linear index of the first value in all values
+	int node;			// NUMA node the values are on, -1 if not placed
+	size_t bytes;		// bytes mapped for 'values'
+} ShuffledShard;
+
+typedef struct ShuffledShardIndex {
+	ShuffledShard *shards;
+	int nshards;
+	int *fences;		// the first value of shards 1 to nshards-1, shuffled
+	int count;			// values in all shards
+	int nnodes;			// NUMA nodes when the index was built
+	void *node_cpus;	// cores of each node, NULL if the threads are not moved
+} ShuffledShardIndex;
+
+int ShuffleNumaNodeCount(void); // 1 without NUMA
+
+// sorted unique values in 'nshards' shards (0 = one per node), nodes[shard] is the NUMA node of each shard or NULL for round robin
+int ShuffledShardInit(ShuffledShardIndex *index, const int *sorted_array, int count, int nshards, const int *nodes); // 0 if out of memory
+void ShuffledShardFree(ShuffledShardIndex *index);
+
+int ShuffledShardOf(const ShuffledShardIndex *index, int value); // shard the value belongs in
+int ShuffledShardSearch(const ShuffledShardIndex *index, int value); // linear index in all values, -1 if not found
+
+// linear indices of many values, each shard searches its values on the cores of its node, scheduler NULL = ShuffleThreadScheduler(0)
+void ShuffledShardSearchBatch(const ShuffledShardIndex *index, const int *values, int nvalues, int *out_indices, const ShuffleScheduler *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
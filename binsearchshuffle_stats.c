@@ -0,0 +1,241 @@
+/*
+Shuffled Binary Search Counters
+
+Why a layout or array size is fast or slow on a machine shows in how deep the
+searches go, how many bytes the shuffle moves and in the cache, branch and TLB
+misses. With SHUFFLE_STATS defined ShuffledBinarySearch, ShuffleSortedArray
+and SortShuffledArray count their calls, steps and moved bytes, and can read
+the Linux perf_event hardware counters of the calling thread around each call.
+
+- int ShuffleStatsEnable(int flags)
+	- SHUFFLE_STATS_SOFTWARE and/or SHUFFLE_STATS_HARDWARE, returns the flags that are available
+- void ShuffleStatsDisable(void)
+- void ShuffleStatsReset(void)
+- void ShuffleStatsGet(ShuffleStats *stats)
+	- totals of all threads since the last reset
+- void ShuffleStatsThreadExit(void)
+	- closes the hardware counters of a thread that searched, call before the thread exits
+- int ShuffleStatsFormat(const ShuffleStats *stats, char *buffer, size_t size)
+	- one "name value" line per counter for a metrics scraper
+
+Without SHUFFLE_STATS the functions are empty and the searches, shuffles and
+sorts have no extra code at all, so the counting costs nothing unless it is
+built in. Built in but disabled it is one load and branch per call.
+
+The hardware counters of a thread are opened the first time it is counted,
+as one perf_event group of cycles, last level cache misses, branch misses and
+data TLB read misses in user space. A counter the CPU or a virtual machine does
+not have is left out of the group. Reading the group is a system call that
+takes longer than a search in the cache, so only every SHUFFLE_STATS_SAMPLE'th
+search of a thread is read, divide by 'sampled' rather than 'calls' for the
+misses per search. Shuffles and sorts are always read.
+*/
+
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		// syscall
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "binsearchshuffle_stats.h"
+#include "binsearchshuffle_internal.h"
+
+#ifdef SHUFFLE_STATS
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define STATS_PERF 1
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#define ATOMIC_ADD(p, v) InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v))
+#define ATOMIC_LOAD(p) InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+#define ATOMIC_STORE(p, v) InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+#define ATOMIC_LOAD_INT(p) InterlockedCompareExchange((volatile LONG*)(p), 0, 0)
+#define ATOMIC_STORE_INT(p, v) InterlockedExchange((volatile LONG*)(p), (v))
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define ATOMIC_ADD(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD_INT(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define ATOMIC_STORE_INT(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define THREAD_LOCAL __thread
+#endif
+
+#define HW_COUNTERS 4	// cycles, cache misses, branch misses, TLB misses
+
+static int s_enabled;	// SHUFFLE_STATS_SOFTWARE and SHUFFLE_STATS_HARDWARE
+static ShuffleCounters s_counters[SHUFFLE_STATS_OPS];
+#define STATS_WORDS (SHUFFLE_STATS_OPS * sizeof(ShuffleCounters)/sizeof(uint64_t))	// reset and read as uint64_t
+
+// hardware counters of a thread
+typedef struct {
+	int state;				// 0 not opened yet, 1 open, -1 not available
+	int leader;				// group leader fd
+	int fds[HW_COUNTERS];	// -1 for a counter that could not be opened
+	int searches;			// for sampling
+} ThreadCounters;
+static THREAD_LOCAL ThreadCounters t_hw;
+
+#ifdef STATS_PERF
+static int OpenCounter(uint32_t type, uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = group<0;	// the group starts when the leader is enabled
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+static int OpenThreadCounters(void)
+{
+	if (t_hw.state)
+		return t_hw.state>0;
+	t_hw.state = -1;
+#ifdef STATS_PERF
+	static const struct { uint32_t type; uint64_t config; } events[HW_COUNTERS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16) },
+	};
+	t_hw.leader = -1;
+	for (int c = 0; c<HW_COUNTERS; c++) {
+		t_hw.fds[c] = OpenCounter(events[c].type, events[c].config, t_hw.leader);
+		if (t_hw.leader<0)
+			t_hw.leader = t_hw.fds[c];
+	}
+	if (t_hw.leader<0)
+		return 0;
+	ioctl(t_hw.leader, PERF_EVENT_IOC_ENABLE, 0);
+	t_hw.state = 1;
+#endif
+	return t_hw.state>0;
+}
+
+// current values of the counters, 0 for counters that are not open
+static int ReadThreadCounters(uint64_t *values)
+{
+#ifdef STATS_PERF
+	uint64_t group[1+HW_COUNTERS];	// number of counters and the values in the order they were opened
+	if (read(t_hw.leader, group, sizeof(group))<(ssize_t)sizeof(uint64_t))
+		return 0;
+	int next = 1;
+	for (int c = 0; c<HW_COUNTERS; c++)
+		values[c] = t_hw.fds[c]>=0 && next<=(int)group[0] ? group[next++] : 0;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void ShuffleStatsThreadExit(void)
+{
+#ifdef STATS_PERF
+	if (t_hw.state>0) {
+		for (int c = 0; c<HW_COUNTERS; c++) {
+			if (t_hw.fds[c]>=0)
+				close(t_hw.fds[c]);
+		}
+	}
+#endif
+	t_hw.state = 0;
+}
+
+int ShuffleStatsEnable(int flags)
+{
+	flags &= SHUFFLE_STATS_SOFTWARE | SHUFFLE_STATS_HARDWARE;
+	if ((flags & SHUFFLE_STATS_HARDWARE) && !OpenThreadCounters())
+		flags &= ~SHUFFLE_STATS_HARDWARE;
+	ATOMIC_STORE_INT(&s_enabled, flags);
+	return flags;
+}
+
+void ShuffleStatsDisable(void)
+{
+	ATOMIC_STORE_INT(&s_enabled, 0);
+}
+
+void ShuffleStatsReset(void)
+{
+	uint64_t *counters = (uint64_t*)s_counters;
+	for (size_t i = 0; i<STATS_WORDS; i++)
+		ATOMIC_STORE(&counters[i], 0);
+}
+
+void ShuffleStatsGet(ShuffleStats *stats)
+{
+	const uint64_t *counters = (const uint64_t*)s_counters;
+	uint64_t *copy = (uint64_t*)stats->ops;
+	for (size_t i = 0; i<STATS_WORDS; i++)
+		copy[i] = (uint64_t)ATOMIC_LOAD(&counters[i]);
+	stats->enabled = ATOMIC_LOAD_INT(&s_enabled);
+}
+
+void ShuffleStatsEnter(ShuffleStatsScope *scope, int op)
+{
+	int enabled = ATOMIC_LOAD_INT(&s_enabled);
+	scope->op = enabled ? op : -1;
+	scope->sampled = 0;
+	if (!(enabled & SHUFFLE_STATS_HARDWARE))
+		return;
+	if (op==SHUFFLE_STATS_SEARCH && (t_hw.searches++ % SHUFFLE_STATS_SAMPLE))
+		return;
+	if (OpenThreadCounters())
+		scope->sampled = ReadThreadCounters(scope->start);
+}
+
+void ShuffleStatsLeave(ShuffleStatsScope *scope, uint64_t steps, uint64_t moved_bytes)
+{
+	if (scope->op<0)
+		return;
+	ShuffleCounters *counters = &s_counters[scope->op];
+	uint64_t end[HW_COUNTERS];
+	if (scope->sampled && ReadThreadCounters(end)) {
+		ATOMIC_ADD(&counters->sampled, 1);
+		ATOMIC_ADD(&counters->cycles, end[0]-scope->start[0]);
+		ATOMIC_ADD(&counters->cache_misses, end[1]-scope->start[1]);
+		ATOMIC_ADD(&counters->branch_misses, end[2]-scope->start[2]);
+		ATOMIC_ADD(&counters->tlb_misses, end[3]-scope->start[3]);
+	}
+	ATOMIC_ADD(&counters->calls, 1);
+	if (steps)
+		ATOMIC_ADD(&counters->steps, steps);
+	if (moved_bytes)
+		ATOMIC_ADD(&counters->moved_bytes, moved_bytes);
+}
+
+#else
+
+int ShuffleStatsEnable(int flags) { (void)flags; return 0; }
+void ShuffleStatsDisable(void) {}
+void ShuffleStatsReset(void) {}
+void ShuffleStatsGet(ShuffleStats *stats) { memset(stats, 0, sizeof(*stats)); }
+void ShuffleStatsThreadExit(void) {}
+
+#endif
+
+int ShuffleStatsFormat(const ShuffleStats *stats, char *buffer, size_t size)
+{
+	static const char *ops[SHUFFLE_STATS_OPS] = { "search", "shuffle", "sort" };
+	static const char *names[8] = { "calls", "steps", "moved_bytes", "sampled", "cycles", "cache_misses", "branch_misses", "tlb_misses" };
+	int length = 0;
+	for (int op = 0; op<SHUFFLE_STATS_OPS; op++) {
+		const uint64_t *values = (const uint64_t*)&stats->ops[op];
+		for (int n = 0; n<8; n++) {
+			size_t left = (size_t)length<size ? size-length : 0;
+			length += snprintf(buffer && left ? buffer+length : NULL, left, "shuffle_%s_%s %llu\n", ops[op], names[n], (unsigned long long)values[n]);
+		}
+	}
+	return length;
+}
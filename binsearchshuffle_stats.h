@@ -0,0 +1,60 @@
+#ifndef __BINSHUFFLE_STATS_H__
+#define __BINSHUFFLE_STATS_H__
+
+#include <stddef.h>
+#include "binsearchshuffle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Counters for ShuffledBinarySearch, ShuffleSortedArray and SortShuffledArray,
+// see binsearchshuffle_stats.c. The counting is only compiled in with
+// SHUFFLE_STATS defined, without it the functions below report nothing.
+
+// operations
+#define SHUFFLE_STATS_SEARCH 0	// ShuffledBinarySearch
+#define SHUFFLE_STATS_SHUFFLE 1	// ShuffleSortedArray
+#define SHUFFLE_STATS_SORT 2	// SortShuffledArray
+#define SHUFFLE_STATS_OPS 3
+
+// enable flags
+#define SHUFFLE_STATS_SOFTWARE 1	// calls, search steps, bytes moved
+#define SHUFFLE_STATS_HARDWARE 2	// perf_event counters (Linux)
+
+// hardware counters are read on every SHUFFLE_STATS_SAMPLE'th search of a thread,
+// and on every shuffle and sort
+#ifndef SHUFFLE_STATS_SAMPLE
+#define SHUFFLE_STATS_SAMPLE 16
+#endif
+
+typedef struct ShuffleCounters {
+	uint64_t calls;
+	uint64_t steps;			// values compared by searches, steps/calls is the average depth
+	uint64_t moved_bytes;	// bytes moved with memmove
+	uint64_t sampled;		// calls the hardware counters below were read for
+	uint64_t cycles;
+	uint64_t cache_misses;	// last level cache
+	uint64_t branch_misses;
+	uint64_t tlb_misses;	// data TLB read misses
+} ShuffleCounters;
+
+typedef struct ShuffleStats {
+	ShuffleCounters ops[SHUFFLE_STATS_OPS];
+	int enabled;			// SHUFFLE_STATS_SOFTWARE and SHUFFLE_STATS_HARDWARE flags
+} ShuffleStats;
+
+int ShuffleStatsEnable(int flags); // returns the flags that could be enabled, 0 if compiled out
+void ShuffleStatsDisable(void);
+void ShuffleStatsReset(void);
+void ShuffleStatsGet(ShuffleStats *stats); // totals of all threads since the last reset
+void ShuffleStatsThreadExit(void); // closes the hardware counters of the calling thread
+
+// "name value" lines, e.g. "shuffle_search_calls 100", returns the length like snprintf
+int ShuffleStatsFormat(const ShuffleStats *stats, char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
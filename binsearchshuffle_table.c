@@ -0,0 +1,229 @@
+/*
+Shuffled Table
+
+InsertShuffledArrayValue changes the array in place so lookups from other
+threads need a lock around them. The table instead publishes immutable
+snapshots: a writer copies the current snapshot, applies a batch of updates
+to the copy and swaps the pointer to it. Readers only load the pointer and
+search, they never wait for a writer and a rebuild does not slow them down.
+
+- int ShuffledTableInit(ShuffledTable *table, const int *sorted_array, int count)
+- void ShuffledTableFree(ShuffledTable *table)
+- int ShuffledTableAddReader(ShuffledTable *table) / void ShuffledTableRemoveReader(ShuffledTable *table, int reader)
+	- each reading thread takes one of SHUFFLE_TABLE_READERS reader slots
+- const ShuffledSnapshot *ShuffledTablePin(ShuffledTable *table, int reader) / void ShuffledTableUnpin(ShuffledTable *table, int reader)
+	- the pinned snapshot is not freed until it is unpinned
+- int ShuffledTableContains(ShuffledTable *table, int reader, int value)
+- int ShuffledTableUpdate(ShuffledTable *table, const int *inserts, int ninserts, const int *removes, int nremoves)
+	- applies sorted batches of removes and inserts with ShuffledArrayBulkUpdate
+- int ShuffledTableReplace(ShuffledTable *table, const int *unsorted, int count)
+	- publishes a new snapshot built with BuildShuffledArrayScratch
+
+Epochs
+
+A snapshot is freed when no reader can still be reading it. Pinning stores
+the global epoch in the reader's slot and then loads the snapshot pointer,
+unpinning stores 0. A writer swaps the pointer, tags the old snapshot with the
+global epoch and then increments it. A reader that loaded the old pointer
+stored its epoch before that and the epoch was not greater than the tag, so
+the old snapshot is freed once every reader slot is 0 or greater than the tag.
+Pin and unpin are a few stores and loads without loops, so readers are
+wait-free. Writers take a lock so only one builds a snapshot at a time.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "binsearchshuffle_table.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define ATOMIC_LOAD(p) InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+#define ATOMIC_STORE(p, v) InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+#define ATOMIC_LOAD_PTR(p) InterlockedCompareExchangePointer((PVOID volatile*)(p), NULL, NULL)
+#define ATOMIC_STORE_PTR(p, v) InterlockedExchangePointer((PVOID volatile*)(p), (v))
+#define ATOMIC_CLAIM(p) (InterlockedCompareExchange((volatile LONG*)(p), 1, 0)==0)
+#define ATOMIC_RELEASE_INT(p) InterlockedExchange((volatile LONG*)(p), 0)
+typedef CRITICAL_SECTION ShuffleLock;
+#define LOCK_INIT(l) InitializeCriticalSection(l)
+#define LOCK_DESTROY(l) DeleteCriticalSection(l)
+#define LOCK(l) EnterCriticalSection(l)
+#define UNLOCK(l) LeaveCriticalSection(l)
+#else
+#include <pthread.h>
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_PTR(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_PTR(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define ATOMIC_CLAIM(p) ClaimSlot(p)
+static int ClaimSlot(int *used)
+{
+	int expected = 0;
+	return __atomic_compare_exchange_n(used, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#define ATOMIC_RELEASE_INT(p) __atomic_store_n(p, 0, __ATOMIC_RELEASE)
+typedef pthread_mutex_t ShuffleLock;
+#define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+static ShuffledSnapshot *NewSnapshot(int count)
+{
+	ShuffledSnapshot *snapshot = (ShuffledSnapshot*)malloc(sizeof(ShuffledSnapshot) + (count>1 ? count-1 : 0) * sizeof(int));
+	if (snapshot) {
+		snapshot->retired_next = NULL;
+		snapshot->retired_epoch = 0;
+		snapshot->count = count;
+	}
+	return snapshot;
+}
+
+int ShuffledTableInit(ShuffledTable *table, const int *sorted_array, int count)
+{
+	memset(table, 0, sizeof(*table));
+	table->epoch = 1;
+	table->lock = malloc(sizeof(ShuffleLock));
+	table->current = NewSnapshot(count);
+	if (!table->lock || !table->current) {
+		free(table->lock);
+		free(table->current);
+		return 0;
+	}
+	LOCK_INIT((ShuffleLock*)table->lock);
+	if (count)
+		memcpy(table->current->values, sorted_array, count * sizeof(int));
+	ShuffleSortedArray(table->current->values, count);
+	return 1;
+}
+
+void ShuffledTableFree(ShuffledTable *table)
+{
+	while (table->retired) {
+		ShuffledSnapshot *next = table->retired->retired_next;
+		free(table->retired);
+		table->retired = next;
+	}
+	free(table->current);
+	table->current = NULL;
+	if (table->lock) {
+		LOCK_DESTROY((ShuffleLock*)table->lock);
+		free(table->lock);
+		table->lock = NULL;
+	}
+}
+
+int ShuffledTableAddReader(ShuffledTable *table)
+{
+	for (int reader = 0; reader<SHUFFLE_TABLE_READERS; reader++) {
+		if (ATOMIC_CLAIM(&table->readers[reader].used))
+			return reader;
+	}
+	return -1;
+}
+
+void ShuffledTableRemoveReader(ShuffledTable *table, int reader)
+{
+	ATOMIC_STORE(&table->readers[reader].epoch, 0);
+	ATOMIC_RELEASE_INT(&table->readers[reader].used);
+}
+
+const ShuffledSnapshot *ShuffledTablePin(ShuffledTable *table, int reader)
+{
+	ATOMIC_STORE(&table->readers[reader].epoch, ATOMIC_LOAD(&table->epoch));
+	return (const ShuffledSnapshot*)ATOMIC_LOAD_PTR(&table->current);
+}
+
+void ShuffledTableUnpin(ShuffledTable *table, int reader)
+{
+	ATOMIC_STORE(&table->readers[reader].epoch, 0);
+}
+
+int ShuffledTableContains(ShuffledTable *table, int reader, int value)
+{
+	const ShuffledSnapshot *snapshot = ShuffledTablePin(table, reader);
+	int found = ShuffledBinarySearchFast(value, snapshot->values, snapshot->count)>=0;
+	ShuffledTableUnpin(table, reader);
+	return found;
+}
+
+// free the retired snapshots no reader has pinned, called with the lock held
+static void Reclaim(ShuffledTable *table)
+{
+	uint64_t oldest = UINT64_MAX;	// oldest pinned epoch
+	for (int reader = 0; reader<SHUFFLE_TABLE_READERS; reader++) {
+		uint64_t epoch = (uint64_t)ATOMIC_LOAD(&table->readers[reader].epoch);
+		if (epoch && epoch<oldest)
+			oldest = epoch;
+	}
+	ShuffledSnapshot **link = &table->retired;
+	while (*link) {
+		ShuffledSnapshot *snapshot = *link;
+		if (snapshot->retired_epoch<oldest) {
+			*link = snapshot->retired_next;
+			free(snapshot);
+		} else
+			link = &snapshot->retired_next;
+	}
+}
+
+// publish a new snapshot and retire the current one, called with the lock held
+static void Publish(ShuffledTable *table, ShuffledSnapshot *snapshot)
+{
+	ShuffledSnapshot *old = table->current;
+	ATOMIC_STORE_PTR(&table->current, snapshot);
+	old->retired_epoch = (uint64_t)ATOMIC_LOAD(&table->epoch);
+	old->retired_next = table->retired;
+	table->retired = old;
+	ATOMIC_STORE(&table->epoch, old->retired_epoch+1);
+	Reclaim(table);
+}
+
+void ShuffledTableReclaim(ShuffledTable *table)
+{
+	LOCK((ShuffleLock*)table->lock);
+	Reclaim(table);
+	UNLOCK((ShuffleLock*)table->lock);
+}
+
+int ShuffledTableUpdate(ShuffledTable *table, const int *inserts, int ninserts, const int *removes, int nremoves)
+{
+	LOCK((ShuffleLock*)table->lock);
+	const ShuffledSnapshot *current = table->current;
+	int count = current->count;
+	ShuffledSnapshot *snapshot = NewSnapshot(count+ninserts);
+	int *scratch = (int*)malloc((count+ninserts+1) * sizeof(int));
+	if (snapshot && scratch) {
+		memcpy(snapshot->values, current->values, count * sizeof(int));
+		snapshot->count = ShuffledArrayBulkUpdate(snapshot->values, count, inserts, ninserts, removes, nremoves, scratch);
+		count = snapshot->count;
+		Publish(table, snapshot);
+	} else {
+		free(snapshot);
+		count = -1;
+	}
+	free(scratch);
+	UNLOCK((ShuffleLock*)table->lock);
+	return count;
+}
+
+int ShuffledTableReplace(ShuffledTable *table, const int *unsorted, int count)
+{
+	ShuffledSnapshot *snapshot = NewSnapshot(count);
+	int *scratch = (int*)malloc((count+1) * sizeof(int));
+	if (!snapshot || !scratch) {
+		free(snapshot);
+		free(scratch);
+		return -1;
+	}
+	// the build does not need the lock, only publishing does
+	if (count)
+		memcpy(snapshot->values, unsorted, count * sizeof(int));
+	snapshot->count = BuildShuffledArrayScratch(snapshot->values, count, scratch, SHUFFLE_BUILD_UNIQUE);
+	count = snapshot->count;
+	free(scratch);
+	LOCK((ShuffleLock*)table->lock);
+	Publish(table, snapshot);
+	UNLOCK((ShuffleLock*)table->lock);
+	return count;
+}
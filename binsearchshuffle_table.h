@@ -0,0 +1,56 @@
+#ifndef __BINSHUFFLE_TABLE_H__
+#define __BINSHUFFLE_TABLE_H__
+
+#include "binsearchshuffle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shuffled table for lookups from many threads while it is updated, see binsearchshuffle_table.c
+
+#ifndef SHUFFLE_TABLE_READERS
+#define SHUFFLE_TABLE_READERS 64
+#endif
+
+// an immutable shuffled array, readers only see published snapshots
+typedef struct ShuffledSnapshot {
+	struct ShuffledSnapshot *retired_next;	// retired snapshots waiting for readers
+	uint64_t retired_epoch;
+	int count;
+	int values[1];	// 'count' shuffled values
+} ShuffledSnapshot;
+
+typedef struct ShuffledTable {
+	ShuffledSnapshot *current;	// published snapshot, atomic
+	uint64_t epoch;				// global epoch, atomic
+	ShuffledSnapshot *retired;	// writer only
+	void *lock;					// serializes writers
+	struct {
+		uint64_t epoch;			// epoch pinned by the reader, 0 if not reading
+		int used;				// reader slot is taken
+		char pad[64-sizeof(uint64_t)-sizeof(int)];	// one cache line per reader
+	} readers[SHUFFLE_TABLE_READERS];
+} ShuffledTable;
+
+int ShuffledTableInit(ShuffledTable *table, const int *sorted_array, int count); // 0 if out of memory
+void ShuffledTableFree(ShuffledTable *table); // no readers or writers may be using the table
+
+int ShuffledTableAddReader(ShuffledTable *table); // reader id for a reading thread, -1 if all are taken
+void ShuffledTableRemoveReader(ShuffledTable *table, int reader);
+
+// readers, wait-free
+const ShuffledSnapshot *ShuffledTablePin(ShuffledTable *table, int reader); // snapshot stays valid until unpin
+void ShuffledTableUnpin(ShuffledTable *table, int reader);
+int ShuffledTableContains(ShuffledTable *table, int reader, int value); // pin, search, unpin
+
+// writers, build a new snapshot off to the side and publish it
+int ShuffledTableUpdate(ShuffledTable *table, const int *inserts, int ninserts, const int *removes, int nremoves); // sorted batches, returns new count or -1
+int ShuffledTableReplace(ShuffledTable *table, const int *unsorted, int count); // returns new count or -1
+void ShuffledTableReclaim(ShuffledTable *table); // free retired snapshots no reader has pinned, every update does it, takes the writer lock
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
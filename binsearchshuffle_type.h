@@ -0,0 +1,252 @@
+/*
+Shuffled Binary Search for other key types
+
+This file is a template, it generates the shuffle, search, sort, insert and
+remove functions for one key type each time it is included. Set SHUFFLE_KEY to
+the key type and SHUFFLE_NAME(name) to decorate the function names:
+
+	#define SHUFFLE_KEY uint64_t
+	#define SHUFFLE_NAME(name) name##_u64
+	#include "binsearchshuffle_type.h"
+
+generates ShuffleSortedArray_u64, ShuffledBinarySearch_u64, SortShuffledArray_u64,
+RemoveShuffledArrayValue_u64 and InsertShuffledArrayValue_u64.
+
+Optional settings:
+- SHUFFLE_LESS(a, b) compares two keys, defaults to a<b. Equality is tested as
+	!SHUFFLE_LESS(a, b) && !SHUFFLE_LESS(b, a) so structs only need a less.
+- SHUFFLE_STORAGE is put in front of each function, for example static to keep
+	a struct key instantiation local to a file.
+
+The code is the same as the int version in binsearchshuffle.c so a fixed key
+type compiles to the same loop. binsearchshuffle.c instantiates this for
+int32_t, uint32_t, int64_t, uint64_t, float and double. Floats are ordered by
+'<' so arrays with NaN values can not be searched.
+
+DeshuffleIndex does not depend on the key type and works for all of these.
+*/
+
+#include <string.h>
+#include "binsearchshuffle.h"
+
+#ifndef SHUFFLE_KEY
+#error "define SHUFFLE_KEY before including binsearchshuffle_type.h"
+#endif
+
+#ifndef SHUFFLE_NAME
+#error "define SHUFFLE_NAME(name) before including binsearchshuffle_type.h"
+#endif
+
+#ifndef SHUFFLE_LESS
+#define SHUFFLE_LESS(a, b) ((a)<(b))
+#define SHUFFLE_EQUAL(a, b) ((a)==(b))
+#else
+#define SHUFFLE_EQUAL(a, b) (!SHUFFLE_LESS(a, b) && !SHUFFLE_LESS(b, a))
+#endif
+
+#ifndef SHUFFLE_STORAGE
+#define SHUFFLE_STORAGE
+#endif
+
+#ifndef SHUFFLE_TYPE_STACK_LOG2
+#define SHUFFLE_TYPE_STACK_LOG2 64
+#endif
+
+SHUFFLE_STORAGE void SHUFFLE_NAME(ShuffleSortedArray)(SHUFFLE_KEY *array, int count)
+{
+	struct { int first, count; } aStack[SHUFFLE_TYPE_STACK_LOG2];
+	int stk = 0;
+
+	int first = 0;		// current section of the array
+	SHUFFLE_KEY tmp;	// temporary value for swapping elements
+
+	while (count>1 || stk) {
+		if (count<=1) {	// count 1 does not need to be shuffled
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+		}
+
+		switch (count) {
+			case 2:
+			case 3:
+				tmp = array[first];
+				array[first] = array[first+1];
+				array[first+1] = tmp;
+				count = 0;
+				break;
+			case 4:
+				tmp = array[first];
+				array[first] = array[first+2];
+				array[first+2] = tmp;
+				count = 0;
+				break;
+			case 5:
+				tmp = array[first];
+				array[first] = array[first+2];
+				array[first+2] = tmp;
+				tmp = array[first+3];
+				array[first+3] = array[first+4];
+				array[first+4] = tmp;
+				count = 0;
+				break;
+			case 6:
+			case 7:
+				tmp = array[first];
+				array[first] = array[first+3];
+				array[first+3] = array[first+2];
+				array[first+2] = tmp;
+				tmp = array[first+4];
+				array[first+4] = array[first+5];
+				array[first+5] = tmp;
+				count = 0;
+				break;
+			case 8:
+				tmp = array[first];
+				array[first] = array[first+4];
+				array[first+4] = array[first+3];
+				array[first+3] = tmp;
+				tmp = array[first+1];
+				array[first+1] = array[first+2];
+				array[first+2] = tmp;
+				tmp = array[first+5];
+				array[first+5] = array[first+6];
+				array[first+6] = tmp;
+				count = 0;
+				break;
+			default:
+				tmp = array[first+count/2];
+				memmove(&array[first+1], &array[first], sizeof(array[0]) * (count/2));
+				array[first] = tmp;
+				first++;
+				aStack[stk].first = first+count/2;
+				aStack[stk].count = (count-1)/2;
+				stk++;
+				count = count/2;
+				break;
+		}
+	}
+}
+
+SHUFFLE_STORAGE int SHUFFLE_NAME(ShuffledBinarySearch)(SHUFFLE_KEY value, const SHUFFLE_KEY *shuffled_array, int count)
+{
+	int index = 0;
+	while (count) {
+		SHUFFLE_KEY read = shuffled_array[index];
+		if (SHUFFLE_EQUAL(value, read))
+			return index;
+		else if (SHUFFLE_LESS(read, value)) {
+			index += count/2+1;
+			count = (count-1)/2;
+		} else {
+			index++;
+			count /= 2;
+		}
+	}
+	return -1;	// index not found
+}
+
+SHUFFLE_STORAGE void SHUFFLE_NAME(SortShuffledArray)(SHUFFLE_KEY *array, int count)
+{
+	struct { int first, count; } aStack[SHUFFLE_TYPE_STACK_LOG2];
+	int stk = 0;
+
+	int first = 0;		// current section of the array
+	SHUFFLE_KEY tmp;	// temporary value for swapping elements
+
+	while (count>1 || stk) {
+		if (count<=1) {	// count 1 does not need to be shuffled
+			stk--;
+			first = aStack[stk].first;
+			count = aStack[stk].count;
+		}
+
+		switch (count) {
+			case 2:
+			case 3:
+				tmp = array[first];
+				array[first] = array[first+1];
+				array[first+1] = tmp;
+				count = 0;
+				break;
+			case 4:
+				tmp = array[first];
+				array[first] = array[first+2];
+				array[first+2] = tmp;
+				count = 0;
+				break;
+			case 5:
+				tmp = array[first];
+				array[first] = array[first+2];
+				array[first+2] = tmp;
+				tmp = array[first+3];
+				array[first+3] = array[first+4];
+				array[first+4] = tmp;
+				count = 0;
+				break;
+			case 6:
+			case 7:
+				tmp = array[first];
+				array[first] = array[first+2];
+				array[first+2] = array[first+3];
+				array[first+3] = tmp;
+				tmp = array[first+4];
+				array[first+4] = array[first+5];
+				array[first+5] = tmp;
+				count = 0;
+				break;
+			default:
+				tmp = array[first];
+				memmove(&array[first], &array[first+1], sizeof(array[0]) * (count/2));
+				array[first+count/2] = tmp;
+				aStack[stk].first = first+1+count/2;
+				aStack[stk].count = (count-1)/2;
+				stk++;
+				count = count/2;
+				break;
+		}
+	}
+}
+
+SHUFFLE_STORAGE int SHUFFLE_NAME(RemoveShuffledArrayValue)(SHUFFLE_KEY value, SHUFFLE_KEY *shuffled_array, int count)
+{
+	int index = SHUFFLE_NAME(ShuffledBinarySearch)(value, shuffled_array, count);
+	if (index>=0) {
+		SHUFFLE_NAME(SortShuffledArray)(shuffled_array, count);
+		int deshuf = DeshuffleIndex(index, count);
+		if (deshuf<(count-1))
+			memmove(shuffled_array+deshuf, shuffled_array+deshuf+1, (count-1-deshuf) * sizeof(SHUFFLE_KEY));
+		count--;
+		SHUFFLE_NAME(ShuffleSortedArray)(shuffled_array, count);
+	}
+	return count;
+}
+
+SHUFFLE_STORAGE int SHUFFLE_NAME(InsertShuffledArrayValue)(SHUFFLE_KEY value, SHUFFLE_KEY *shuffled_array, int count)
+{
+	int found = SHUFFLE_NAME(ShuffledBinarySearch)(value, shuffled_array, count);
+	if (found<0) {
+		SHUFFLE_NAME(SortShuffledArray)(shuffled_array, count);	// make array linear
+		int first = 0;
+		int end = count;
+		while (end!=first) {	// first value greater than 'value' is the insertion slot
+			int index = (first+end)/2;
+			if (SHUFFLE_LESS(shuffled_array[index], value))
+				first = index+1;
+			else
+				end = index;
+		}
+		if (first<count)
+			memmove(shuffled_array+first+1, shuffled_array+first, (count-first) * sizeof(SHUFFLE_KEY));
+		shuffled_array[first] = value;
+		count++;
+		SHUFFLE_NAME(ShuffleSortedArray)(shuffled_array, count);
+	}
+	return count;
+}
+
+#undef SHUFFLE_KEY
+#undef SHUFFLE_NAME
+#undef SHUFFLE_LESS
+#undef SHUFFLE_EQUAL
+#undef SHUFFLE_STORAGE
@@ -0,0 +1,708 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <limits.h>
+#include "binsearchshuffle.h"
+#include "binsearchshuffle_shard.h"
+#include "binsearchshuffle_internal.h"	// SHUFFLE_NEON
+
+// Differential stress test of every search variant and layout against
+// RegularBinarySearch on the sorted array, for random array sizes up to
+// hundreds of millions of values. Each size gets new random values with random
+// gaps and lookups that hit, miss between values and miss below and above all
+// values. The found indices are deshuffled and compared with the regular
+// search, the layouts are sorted back and compared with the sorted array, and
+// arrays up to -update-max values get random inserts and removes in the
+// shuffled, delta and gapped arrays that are checked against a sorted copy. A
+// copy with repeated values checks the equal range, the count and the inserts
+// that keep repeats. The typed searches get the values widened or mapped to
+// their type in the same order and the generic search gets them as 64-bit
+// keys. Each search variant is timed so a throughput regression shows up next
+// to the correctness check.
+// usage: stress_binsearchshuffle [options]
+//	-max <count>		largest array, default 2^24, 400000000 needs about 10 GB
+//	-rounds <n>			random sizes, default 20
+//	-lookups <n>		lookups per size, default 200000
+//	-updates <n>		inserts and removes per size, default 200
+//	-update-max <count>	largest array that is updated, default 2^20
+//	-seed <n>			random seed, default from the time
+//	-slowdown <x>		fail if a variant takes more than x times the regular search (arrays of 2^12 or more)
+//	-csv				one row per measurement: count, variant, ns per lookup
+// Problems are printed on stderr and the exit code is 1 if there were any.
+//
+// Built with -DSHUFFLE_FUZZER it is a libFuzzer target instead:
+//	clang -g -O1 -fsanitize=fuzzer,address,undefined -DSHUFFLE_FUZZER stress_binsearchshuffle.c binsearchshuffle*.c -lm -lpthread
+// the input is ints, sorted and made unique they are the array, each of them
+// and its neighbours are looked up and they are inserted and removed again.
+
+typedef struct StressBuffers {
+	int max;			// largest count
+	int max_lookups;
+	int max_updates;
+	int *sorted;		// room for max+max_updates values
+	int *shuffled;
+	int *layout;		// block, Eytzinger and hybrid arrays, and the updated array
+	int *check;			// sorted back from a layout
+	uint64_t *wide;		// values of the packed array
+	int *lookups;
+	int *expected;		// linear index of each lookup, -1 if missed
+	int *found;
+	int *deltas;		// inserts and removes of the delta array
+} StressBuffers;
+
+typedef struct StressVariant {
+	const char *name;
+	ShuffledSearchFunc search;
+	int (*deshuffle)(int index, int count);	// NULL for linear indices
+	int layout;
+} StressVariant;
+
+#define STRESS_SORTED 0
+#define STRESS_SHUFFLED 1
+#define STRESS_BLOCK 2
+#define STRESS_EYTZINGER 3
+#define STRESS_HYBRID 4
+
+#define STRESS_DELTA 32		// updates in the delta before it is merged
+
+static int s_csv = 0;
+static int s_rows = 0;
+static double s_slowdown = 0;
+
+static uint64_t s_seed = 1;
+static uint64_t Random()
+{
+	// xorshift64*
+	s_seed ^= s_seed>>12;
+	s_seed ^= s_seed<<25;
+	s_seed ^= s_seed>>27;
+	return s_seed * 2685821657736338717ull;
+}
+
+static double Seconds(clock_t start)
+{
+	return (double)(clock()-start) / CLOCKS_PER_SEC;
+}
+
+static int Regular(int value, const int *sorted_array, int count) { return RegularBinarySearch(value, (int*)sorted_array, count); }
+static int Shuffled(int value, const int *shuffled_array, int count) { return ShuffledBinarySearch(value, (int*)shuffled_array, count); }
+
+static int LowerBound(int value, const int *sorted_array, int count)
+{
+	int first = 0;
+	while (count>0) {
+		int half = count/2;
+		if (sorted_array[first+half]<value) {
+			first += half+1;
+			count -= half+1;
+		} else
+			count = half;
+	}
+	return first;
+}
+
+static uint64_t Widen(int value)
+{
+	return (uint64_t)((uint32_t)value ^ 0x80000000u);	// same order as the ints
+}
+
+static int CompareWide(const void *a, const void *b) { return (*(const uint64_t*)a > *(const uint64_t*)b) - (*(const uint64_t*)a < *(const uint64_t*)b); }
+
+static int Mismatch(const char *variant, int count, int value, int found, int expected)
+{
+	fprintf(stderr, "Problem: %s of %d in %d values found %d, expected %d\n", variant, value, count, found, expected);
+	return 1;
+}
+
+static void Report(const char *variant, int count, double seconds, int lookups)
+{
+	double ns = seconds * 1e9 / lookups;
+	if (s_csv) {
+		if (!s_rows)
+			printf("count,variant,ns_per_lookup\n");
+		printf("%d,%s,%.2f\n", count, variant, ns);
+	} else {
+		if (!s_rows)
+			printf("%10s %-18s %10s\n", "count", "variant", "ns/lookup");
+		printf("%10d %-18s %10.2f\n", count, variant, ns);
+	}
+	s_rows++;
+}
+
+// compares the linear indices of a variant with the regular search, the time is checked against regular_seconds
+static int CheckFound(const StressBuffers *b, const char *variant, int count, int nlookups, double seconds, double regular_seconds, int timed)
+{
+	int problems = 0;
+	for (int i = 0; i<nlookups && problems<10; i++) {
+		if (b->found[i]!=b->expected[i])
+			problems += Mismatch(variant, count, b->lookups[i], b->found[i], b->expected[i]);
+	}
+	if (timed) {
+		Report(variant, count, seconds, nlookups);
+		if (s_slowdown>0 && count>=4096 && seconds>s_slowdown*regular_seconds) {
+			fprintf(stderr, "Problem: %s took %.2f ns per lookup in %d values, more than %gx the regular search\n", variant,
+				seconds*1e9/nlookups, count, s_slowdown);
+			problems++;
+		}
+	}
+	return problems;
+}
+
+// shuffled indices in b->found to linear indices
+static void DeshuffleFound(StressBuffers *b, int count, int nlookups)
+{
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = b->found[i]<0 ? -1 : DeshuffleIndex(b->found[i], count);
+}
+
+// the typed and generic searches on b->sorted in their own types, same order so the same linear indices
+static int CheckTypes(StressBuffers *b, int count, int nlookups, double regular, int timed)
+{
+	int problems = 0;
+	clock_t start;
+	int32_t *i32 = (int32_t*)b->layout;
+	memcpy(i32, b->sorted, count*sizeof(int));
+	ShuffleSortedArray_i32(i32, count);
+	start = clock();
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledBinarySearch_i32(b->lookups[i], i32, count);
+	double seconds = Seconds(start);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "i32", count, nlookups, seconds, regular, timed);
+
+	uint32_t *u32 = (uint32_t*)b->layout;
+	for (int i = 0; i<count; i++)
+		u32[i] = (uint32_t)Widen(b->sorted[i]);
+	ShuffleSortedArray_u32(u32, count);
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledBinarySearch_u32((uint32_t)Widen(b->lookups[i]), u32, count);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "u32", count, nlookups, 0, regular, 0);
+
+	// 64-bit values spread out past 32 bits
+	int64_t *i64 = (int64_t*)b->wide;
+	for (int i = 0; i<count; i++)
+		i64[i] = (int64_t)b->sorted[i]*1048576;
+	ShuffleSortedArray_i64(i64, count);
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledBinarySearch_i64((int64_t)b->lookups[i]*1048576, i64, count);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "i64", count, nlookups, 0, regular, 0);
+
+	for (int i = 0; i<count; i++)
+		b->wide[i] = Widen(b->sorted[i])<<20;
+	ShuffleSortedArray_u64(b->wide, count);
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledBinarySearch_u64(Widen(b->lookups[i])<<20, b->wide, count);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "u64", count, nlookups, 0, regular, 0);
+
+	double *f64 = (double*)b->wide;
+	for (int i = 0; i<count; i++)
+		f64[i] = b->sorted[i];
+	ShuffleSortedArray_f64(f64, count);
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledBinarySearch_f64(b->lookups[i], f64, count);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "f64", count, nlookups, 0, regular, 0);
+
+	// a float only holds 24 bits so it gets the even numbers 2*index, a miss looks up the odd number before its lower bound
+	if (count<=(1<<23)) {
+		float *f32 = (float*)b->wide;
+		for (int i = 0; i<count; i++)
+			f32[i] = (float)(2*i);
+		ShuffleSortedArray_f32(f32, count);
+		for (int i = 0; i<nlookups; i++) {
+			int value = b->expected[i]>=0 ? 2*b->expected[i] : 2*LowerBound(b->lookups[i], b->sorted, count)-1;
+			b->found[i] = ShuffledBinarySearch_f32((float)value, f32, count);
+		}
+		DeshuffleFound(b, count, nlookups);
+		problems += CheckFound(b, "f32", count, nlookups, 0, regular, 0);
+	}
+
+	for (int i = 0; i<count; i++)
+		b->wide[i] = Widen(b->sorted[i]);
+	ShuffleSortedArrayGeneric(b->wide, count, sizeof(uint64_t));
+	start = clock();
+	for (int i = 0; i<nlookups; i++) {
+		uint64_t value = Widen(b->lookups[i]);
+		b->found[i] = ShuffledBinarySearchGeneric(&value, b->wide, count, sizeof(uint64_t), CompareWide);
+	}
+	seconds = Seconds(start);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "generic", count, nlookups, seconds, regular, timed);
+	return problems;
+}
+
+// linear indices of the values the gapped array found, -2 if the slot has another value
+static void GappedFound(StressBuffers *b, const ShuffledGapped *gapped, int count, int nlookups)
+{
+	for (int i = 0; i<nlookups; i++) {
+		int slot = b->found[i];
+		if (slot>=0)
+			b->found[i] = gapped->slots[slot]==b->lookups[i] ? LowerBound(b->lookups[i], b->sorted, count) : -2;
+	}
+}
+
+// random inserts and removes of an array copied to b->layout, of a delta array in b->check and of the gapped array if
+// there is one, b->sorted is kept as the sorted copy
+static int CheckUpdates(StressBuffers *b, int count, int nlookups, int updates, ShuffledGapped *gapped)
+{
+	int problems = 0;
+	memcpy(b->layout, b->shuffled, count*sizeof(int));
+	memcpy(b->check, b->shuffled, count*sizeof(int));
+	ShuffledDelta delta;
+	ShuffledDeltaInit(&delta, b->check, count, b->max+b->max_updates, b->deltas, STRESS_DELTA, NULL);
+	for (int u = 0; u<updates && !problems; u++) {
+		if (count && Random()%2) {
+			int value = b->sorted[Random()%count];
+			int linear = LowerBound(value, b->sorted, count);
+			memmove(b->sorted+linear, b->sorted+linear+1, (count-linear-1)*sizeof(int));
+			int removed = RemoveShuffledArrayValue(value, b->layout, count);
+			count--;
+			if (removed!=count || ShuffledBinarySearch(value, b->layout, count)>=0)
+				problems += Mismatch("remove", count, value, removed, count);
+			int result = ShuffledDeltaRemove(&delta, value);
+			if (result!=1)
+				problems += Mismatch("delta remove", count, value, result, 1);
+			else if (ShuffledDeltaContains(&delta, value))
+				problems += Mismatch("delta contains", count, value, 1, 0);
+			if (gapped) {
+				result = ShuffledGappedRemove(gapped, value);
+				if (result!=1)
+					problems += Mismatch("gapped remove", count, value, result, 1);
+				else if (ShuffledGappedSearch(value, gapped)>=0)
+					problems += Mismatch("gapped search", count, value, ShuffledGappedSearch(value, gapped), -1);
+			}
+		} else {
+			if (count>=b->max+b->max_updates)
+				continue;
+			int value = (int)Random();
+			int linear = LowerBound(value, b->sorted, count);
+			if (linear<count && b->sorted[linear]==value)
+				continue;
+			memmove(b->sorted+linear+1, b->sorted+linear, (count-linear)*sizeof(int));
+			b->sorted[linear] = value;
+			int inserted = InsertShuffledArrayValue(value, b->layout, count);
+			count++;
+			int index = ShuffledBinarySearch(value, b->layout, count);
+			if (inserted!=count || index<0 || DeshuffleIndex(index, count)!=linear)
+				problems += Mismatch("insert", count, value, index<0 ? index : DeshuffleIndex(index, count), linear);
+			int result = ShuffledDeltaInsert(&delta, value);
+			if (result!=1)
+				problems += Mismatch("delta insert", count, value, result, 1);
+			else if (!ShuffledDeltaContains(&delta, value))
+				problems += Mismatch("delta contains", count, value, 0, 1);
+			if (gapped) {
+				result = ShuffledGappedInsert(gapped, value);
+				int slot = ShuffledGappedSearch(value, gapped);
+				if (result!=1)
+					problems += Mismatch("gapped insert", count, value, result, 1);
+				else if (slot<0 || gapped->slots[slot]!=value)
+					problems += Mismatch("gapped search", count, value, slot<0 ? slot : gapped->slots[slot], value);
+			}
+		}
+	}
+	SortShuffledArray(b->layout, count);
+	if (!problems && memcmp(b->layout, b->sorted, count*sizeof(int))) {
+		fprintf(stderr, "Problem: updated array of %d values does not sort back\n", count);
+		problems++;
+	}
+
+	// the lookups again on the updated values
+	for (int i = 0; i<nlookups; i++) {
+		int linear = LowerBound(b->lookups[i], b->sorted, count);
+		b->expected[i] = linear<count && b->sorted[linear]==b->lookups[i] ? linear : -1;
+	}
+	if (gapped) {
+		if (!problems && gapped->count!=count)
+			problems += Mismatch("gapped count", count, 0, gapped->count, count);
+		for (int i = 0; i<nlookups; i++)
+			b->found[i] = ShuffledGappedSearch(b->lookups[i], gapped);
+		GappedFound(b, gapped, count, nlookups);
+		problems += CheckFound(b, "gapped updated", count, nlookups, 0, 0, 0);
+	}
+	if (!problems && ShuffledDeltaCount(&delta)!=count)
+		problems += Mismatch("delta count", count, 0, ShuffledDeltaCount(&delta), count);
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledDeltaContains(&delta, b->lookups[i]) ? LowerBound(b->lookups[i], b->sorted, count) : -1;
+	problems += CheckFound(b, "delta contains", count, nlookups, 0, 0, 0);
+	ShuffledDeltaMerge(&delta);
+	SortShuffledArray(b->check, delta.count);
+	if (!problems && (delta.count!=count || memcmp(b->check, b->sorted, count*sizeof(int)))) {
+		fprintf(stderr, "Problem: merged delta array of %d values does not sort back\n", count);
+		problems++;
+	}
+	return problems;
+}
+
+// every variant on b->sorted with 'count' values and b->lookups, then updates if there are any
+static int CheckArrays(StressBuffers *b, int count, int nlookups, int updates, int timed)
+{
+	StressVariant variants[16];
+	int nvariants = 0;
+	variants[nvariants].name = "regular"; variants[nvariants].search = Regular; variants[nvariants].deshuffle = NULL; variants[nvariants++].layout = STRESS_SORTED;
+	variants[nvariants].name = "shuffled"; variants[nvariants].search = Shuffled; variants[nvariants].deshuffle = DeshuffleIndex; variants[nvariants++].layout = STRESS_SHUFFLED;
+	variants[nvariants].name = "branchless"; variants[nvariants].search = ShuffledBinarySearchBranchless; variants[nvariants].deshuffle = DeshuffleIndexBranchless; variants[nvariants++].layout = STRESS_SHUFFLED;
+#if defined(SHUFFLE_NEON)
+	variants[nvariants].name = "neon"; variants[nvariants].search = ShuffledBinarySearchNEON; variants[nvariants].deshuffle = DeshuffleIndex; variants[nvariants++].layout = STRESS_SHUFFLED;
+#endif
+	variants[nvariants].name = "fast"; variants[nvariants].search = ShuffledBinarySearchFast; variants[nvariants].deshuffle = DeshuffleIndex; variants[nvariants++].layout = STRESS_SHUFFLED;
+	variants[nvariants].name = "block"; variants[nvariants].search = BlockShuffledBinarySearch; variants[nvariants].deshuffle = BlockDeshuffleIndex; variants[nvariants++].layout = STRESS_BLOCK;
+	variants[nvariants].name = "eytzinger"; variants[nvariants].search = EytzingerBinarySearch; variants[nvariants].deshuffle = EytzingerDeshuffleIndex; variants[nvariants++].layout = STRESS_EYTZINGER;
+	variants[nvariants].name = "hybrid"; variants[nvariants].search = HybridShuffledBinarySearch; variants[nvariants].deshuffle = HybridDeshuffleIndex; variants[nvariants++].layout = STRESS_HYBRID;
+
+	int problems = 0;
+	double regular = 0;
+	clock_t start;
+	for (int i = 0; i<nlookups; i++)
+		b->expected[i] = Regular(b->lookups[i], b->sorted, count);
+	memcpy(b->shuffled, b->sorted, count*sizeof(int));
+	ShuffleSortedArray(b->shuffled, count);
+
+	int layout = -1;
+	for (int v = 0; v<nvariants; v++) {
+		const int *array = b->sorted;
+		if (variants[v].layout==STRESS_SHUFFLED)
+			array = b->shuffled;
+		else if (variants[v].layout!=STRESS_SORTED) {
+			array = b->layout;
+			if (layout!=variants[v].layout) {
+				// build the layout and check that it sorts back
+				layout = variants[v].layout;
+				if (layout==STRESS_BLOCK) {
+					BlockShuffleSortedArray(b->layout, b->sorted, count);
+					BlockSortShuffledArray(b->check, b->layout, count);
+				} else {
+					memcpy(b->layout, b->sorted, count*sizeof(int));
+					memcpy(b->check, b->sorted, count*sizeof(int));
+					if (layout==STRESS_EYTZINGER) {
+						EytzingerShuffleSortedArray(b->layout, count);
+						memcpy(b->check, b->layout, count*sizeof(int));
+						EytzingerSortShuffledArray(b->check, count);
+					} else {
+						HybridShuffleSortedArray(b->layout, count);
+						memcpy(b->check, b->layout, count*sizeof(int));
+						HybridSortShuffledArray(b->check, count);
+					}
+				}
+				if (memcmp(b->check, b->sorted, count*sizeof(int))) {
+					fprintf(stderr, "Problem: %s array of %d values does not sort back\n", variants[v].name, count);
+					problems++;
+				}
+			}
+		}
+		ShuffledSearchFunc search = variants[v].search;
+		start = clock();
+		for (int i = 0; i<nlookups; i++)
+			b->found[i] = search(b->lookups[i], array, count);
+		double seconds = Seconds(start);
+		if (v==0)
+			regular = seconds;
+		for (int i = 0; variants[v].deshuffle && i<nlookups; i++) {
+			if (b->found[i]>=0)
+				b->found[i] = variants[v].deshuffle(b->found[i], count);
+		}
+		problems += CheckFound(b, variants[v].name, count, nlookups, seconds, regular, timed);
+	}
+
+	// searches with their own calls
+	start = clock();
+	ShuffledBinarySearchBatchDeshuffled(b->lookups, nlookups, b->shuffled, count, b->found);
+	problems += CheckFound(b, "batch", count, nlookups, Seconds(start), regular, timed);
+	ShuffledBinarySearchBatch(b->lookups, nlookups, b->shuffled, count, b->found);
+	DeshuffleFound(b, count, nlookups);
+	problems += CheckFound(b, "batch-shuffled", count, nlookups, 0, regular, 0);
+
+	ShuffledRadix radix;
+	if (ShuffledRadixInit(&radix, b->shuffled, count, 0)) {
+		start = clock();
+		for (int i = 0; i<nlookups; i++)
+			b->found[i] = ShuffledRadixSearch(b->lookups[i], &radix, b->shuffled, count);
+		double seconds = Seconds(start);
+		DeshuffleFound(b, count, nlookups);
+		problems += CheckFound(b, "radix-entry", count, nlookups, seconds, regular, timed);
+		ShuffledRadixFree(&radix);
+	}
+
+	start = clock();
+	for (int i = 0; i<nlookups; i++) {
+		int64_t index = ShuffledBinarySearch64(b->lookups[i], b->shuffled, count);
+		b->found[i] = index<0 ? -1 : (int)DeshuffleIndex64(index, count);
+	}
+	problems += CheckFound(b, "shuffled-64", count, nlookups, Seconds(start), regular, timed);
+
+	for (int i = 0; i<count; i++)
+		b->wide[i] = Widen(b->sorted[i]);
+	ShuffledPacked packed;
+	if (ShuffledPackedBuild(&packed, b->wide, count)) {
+		start = clock();
+		for (int i = 0; i<nlookups; i++)
+			b->found[i] = ShuffledPackedSearch(Widen(b->lookups[i]), &packed);
+		problems += CheckFound(b, "packed", count, nlookups, Seconds(start), regular, timed);
+		ShuffledPackedUnpack(&packed, b->wide);
+		for (int i = 0; i<count && problems<10; i++) {
+			if (b->wide[i]!=Widen(b->sorted[i]))
+				problems += Mismatch("packed unpack", count, b->sorted[i], i, i);
+		}
+		ShuffledPackedFree(&packed);
+	}
+
+	// up to 7 shards, 0 is one per NUMA node
+	ShuffledShardIndex shards;
+	if (ShuffledShardInit(&shards, b->sorted, count, (int)(Random()%8), NULL)) {
+		start = clock();
+		for (int i = 0; i<nlookups; i++)
+			b->found[i] = ShuffledShardSearch(&shards, b->lookups[i]);
+		problems += CheckFound(b, "shard", count, nlookups, Seconds(start), regular, timed);
+		ShuffledShardSearchBatch(&shards, b->lookups, nlookups, b->found, NULL);
+		problems += CheckFound(b, "shard-batch", count, nlookups, 0, regular, 0);
+		ShuffledShardFree(&shards);
+	}
+
+	// slots of the gapped array are not linear indices, a found value is given the index it has in b->sorted
+	ShuffledGapped gapped;
+	int has_gapped = ShuffledGappedInit(&gapped, b->sorted, count);
+	if (has_gapped) {
+		start = clock();
+		for (int i = 0; i<nlookups; i++)
+			b->found[i] = ShuffledGappedSearch(b->lookups[i], &gapped);
+		double seconds = Seconds(start);
+		GappedFound(b, &gapped, count, nlookups);
+		problems += CheckFound(b, "gapped", count, nlookups, seconds, regular, timed);
+	}
+
+	problems += CheckTypes(b, count, nlookups, regular, timed);
+
+	// bounds are linear indices of the first value not less or greater, 'count' if none
+	start = clock();
+	for (int i = 0; i<nlookups; i++)
+		b->found[i] = ShuffledLowerBound(b->lookups[i], b->shuffled, count);
+	double seconds = Seconds(start);
+	for (int i = 0; i<nlookups; i++)
+		b->expected[i] = LowerBound(b->lookups[i], b->sorted, count);
+	problems += CheckFound(b, "lower-bound", count, nlookups, seconds, regular, timed);
+	for (int i = 0; i<nlookups; i++) {
+		b->found[i] = ShuffledUpperBound(b->lookups[i], b->shuffled, count);
+		b->expected[i] = b->lookups[i]==INT_MAX ? count : LowerBound(b->lookups[i]+1, b->sorted, count);
+	}
+	problems += CheckFound(b, "upper-bound", count, nlookups, 0, regular, 0);
+
+	memcpy(b->check, b->shuffled, count*sizeof(int));
+	SortShuffledArray(b->check, count);
+	if (memcmp(b->check, b->sorted, count*sizeof(int))) {
+		fprintf(stderr, "Problem: shuffled array of %d values does not sort back\n", count);
+		problems++;
+	}
+	for (int i = 0; i<count && problems<10; i++) {
+		if (ShuffleIndex(DeshuffleIndex(i, count), count)!=i)
+			problems += Mismatch("ShuffleIndex", count, i, ShuffleIndex(DeshuffleIndex(i, count), count), i);
+	}
+
+	// runs of repeated values from b->sorted in b->check, shuffled in b->layout
+	for (int i = 0; i<count; i++)
+		b->check[i] = i && Random()%2 ? b->check[i-1] : b->sorted[i];
+	memcpy(b->layout, b->check, count*sizeof(int));
+	ShuffleSortedArray(b->layout, count);
+	for (int i = 0; i<nlookups && problems<10; i++) {
+		int value = b->lookups[i];
+		int first, end;
+		int n = ShuffledEqualRange(value, b->layout, count, &first, &end);
+		int lower = LowerBound(value, b->check, count);
+		int upper = value==INT_MAX ? count : LowerBound(value+1, b->check, count);
+		if (first!=lower || end!=upper)
+			problems += Mismatch("equal-range", count, value, first!=lower ? first : end, first!=lower ? lower : upper);
+		else if (n!=end-first || ShuffledCount(value, b->layout, count)!=n)
+			problems += Mismatch("count", count, value, n!=end-first ? n : ShuffledCount(value, b->layout, count), end-first);
+	}
+	if (updates && count<=b->max) {
+		// inserts after the equal values, half of them repeat a value
+		int repeated = count;
+		for (int u = 0; u<updates && repeated<b->max+b->max_updates && !problems; u++) {
+			int value = repeated && Random()%2 ? b->check[Random()%repeated] : (int)Random();
+			int upper = value==INT_MAX ? repeated : LowerBound(value+1, b->check, repeated);
+			memmove(b->check+upper+1, b->check+upper, (repeated-upper)*sizeof(int));
+			b->check[upper] = value;
+			int inserted = InsertShuffledArrayValueMulti(value, b->layout, repeated);
+			repeated++;
+			if (inserted!=repeated || ShuffledCount(value, b->layout, repeated)!=upper+1-LowerBound(value, b->check, repeated))
+				problems += Mismatch("insert-multi", repeated, value, ShuffledCount(value, b->layout, repeated), upper+1-LowerBound(value, b->check, repeated));
+		}
+		SortShuffledArray(b->layout, repeated);
+		if (!problems && memcmp(b->layout, b->check, repeated*sizeof(int))) {
+			fprintf(stderr, "Problem: array of %d repeated values does not sort back\n", repeated);
+			problems++;
+		}
+		problems += CheckUpdates(b, count, nlookups, updates, has_gapped ? &gapped : NULL);
+	}
+	if (has_gapped)
+		ShuffledGappedFree(&gapped);
+	return problems;
+}
+
+static int AllocBuffers(StressBuffers *b, int max, int max_lookups, int max_updates)
+{
+	size_t room = (size_t)max+max_updates;
+	size_t block = (size_t)BlockShuffledArraySize(max)>room ? (size_t)BlockShuffledArraySize(max) : room;
+	b->max = max;
+	b->max_lookups = max_lookups;
+	b->max_updates = max_updates;
+	b->sorted = (int*)malloc(room * sizeof(int));
+	b->shuffled = (int*)malloc(room * sizeof(int));
+	b->layout = (int*)malloc(block * sizeof(int));
+	b->check = (int*)malloc(room * sizeof(int));
+	b->wide = (uint64_t*)malloc(room * sizeof(uint64_t));
+	b->lookups = (int*)malloc(max_lookups * sizeof(int));
+	b->expected = (int*)malloc(max_lookups * sizeof(int));
+	b->found = (int*)malloc(max_lookups * sizeof(int));
+	b->deltas = (int*)malloc(2 * STRESS_DELTA * sizeof(int));
+	return b->sorted && b->shuffled && b->layout && b->check && b->wide && b->lookups && b->expected && b->found && b->deltas;
+}
+
+#ifdef SHUFFLE_FUZZER
+
+#define FUZZ_MAX (1<<16)
+#define FUZZ_UPDATES 64
+
+static int CompareInts(const void *a, const void *b) { return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b); }
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static StressBuffers b;
+	if (!b.sorted && !AllocBuffers(&b, FUZZ_MAX, 3*FUZZ_MAX, FUZZ_UPDATES))
+		abort();
+	int n = (int)(size/sizeof(int));
+	if (n>FUZZ_MAX)
+		n = FUZZ_MAX;
+	memcpy(b.sorted, data, n*sizeof(int));
+	for (int i = 0; i<n; i++) {
+		b.lookups[3*i] = b.sorted[i];
+		b.lookups[3*i+1] = (int)((unsigned int)b.sorted[i]-1);
+		b.lookups[3*i+2] = (int)((unsigned int)b.sorted[i]+1);
+	}
+	qsort(b.sorted, n, sizeof(int), CompareInts);
+	int count = 0;
+	for (int i = 0; i<n; i++) {
+		if (!count || b.sorted[i]!=b.sorted[count-1])
+			b.sorted[count++] = b.sorted[i];
+	}
+	// the inserts are random from a seed of the input so a crash can be repeated
+	s_seed = 1;
+	for (int i = 0; i<n; i++)
+		s_seed = s_seed*31 + (uint32_t)b.lookups[3*i];
+	if (!s_seed)
+		s_seed = 1;
+	if (CheckArrays(&b, count, 3*n, FUZZ_UPDATES, 0))
+		abort();
+	return 0;
+}
+
+#else
+
+static void FreeBuffers(StressBuffers *b)
+{
+	free(b->sorted);
+	free(b->shuffled);
+	free(b->layout);
+	free(b->check);
+	free(b->wide);
+	free(b->lookups);
+	free(b->expected);
+	free(b->found);
+	free(b->deltas);
+}
+
+int main(int argc, char **argv)
+{
+	int max = 1<<24;
+	int rounds = 20;
+	int lookups = 200000;
+	int updates = 200;
+	int update_max = 1<<20;
+	s_seed = (uint64_t)time(NULL);
+	for (int a = 1; a<argc; a++) {
+		if (!strcmp(argv[a], "-max") && a+1<argc)
+			max = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-rounds") && a+1<argc)
+			rounds = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-lookups") && a+1<argc)
+			lookups = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-updates") && a+1<argc)
+			updates = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-update-max") && a+1<argc)
+			update_max = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-seed") && a+1<argc)
+			s_seed = strtoull(argv[++a], NULL, 10);
+		else if (!strcmp(argv[a], "-slowdown") && a+1<argc)
+			s_slowdown = atof(argv[++a]);
+		else if (!strcmp(argv[a], "-csv"))
+			s_csv = 1;
+		else {
+			printf("usage: stress_binsearchshuffle [-max count] [-rounds n] [-lookups n] [-updates n] [-update-max count] [-seed n] [-slowdown x] [-csv]\n");
+			return 1;
+		}
+	}
+	if (max<1 || rounds<1 || lookups<1 || updates<0 || max>INT_MAX-updates) {
+		printf("max, rounds and lookups must be at least 1\n");
+		return 1;
+	}
+	if (!s_seed)
+		s_seed = 1;
+	fprintf(stderr, "seed %llu\n", (unsigned long long)s_seed);
+
+	StressBuffers b;
+	if (!AllocBuffers(&b, max, lookups, updates)) {
+		printf("Not enough memory for %d values\n", max);
+		FreeBuffers(&b);
+		return 1;
+	}
+	int problems = 0;
+	for (int r = 0; r<rounds && !problems; r++) {
+		// sizes are spread evenly over the powers of two, the last round is the largest
+		int count = max;
+		if (r<rounds-1) {
+			int bits = 0;
+			while (bits<31 && ((int64_t)1<<bits)<=max)
+				bits++;
+			count = (int)(Random() % ((uint64_t)1<<(Random()%bits+1)));
+			if (count>max)
+				count = max;
+		}
+		// gaps from 1 to a random limit, the values fit in 32 bits however many there are
+		uint64_t max_gap = (uint64_t)1<<(Random()%33);
+		if (max_gap>4000000000ull/((uint64_t)count+1))
+			max_gap = 4000000000ull/((uint64_t)count+1);
+		if (!max_gap)
+			max_gap = 1;
+		uint64_t span = 0;
+		for (int i = 0; i<count; i++) {
+			span += i ? 1+Random()%max_gap : 0;
+			b.wide[i] = span;
+		}
+		int64_t base = (int64_t)INT_MIN + (int64_t)(Random() % (4294967296ull-span));
+		for (int i = 0; i<count; i++)
+			b.sorted[i] = (int)(base + (int64_t)b.wide[i]);
+
+		// a third hit, a third are next to a value and the rest are anywhere
+		for (int i = 0; i<lookups; i++) {
+			int kind = (int)(Random()%3);
+			if (count && kind<2) {
+				unsigned int value = (unsigned int)b.sorted[Random()%count];
+				b.lookups[i] = (int)(kind ? value+(Random()%2 ? 1u : -1u) : value);
+			} else
+				b.lookups[i] = (int)Random();
+		}
+		if (lookups>1) {
+			b.lookups[0] = INT_MIN;
+			b.lookups[1] = INT_MAX;
+		}
+		problems += CheckArrays(&b, count, lookups, count<=update_max ? updates : 0, 1);
+	}
+	FreeBuffers(&b);
+	if (problems)
+		fprintf(stderr, "%d problems\n", problems);
+	return problems ? 1 : 0;
+}
+
+#endif
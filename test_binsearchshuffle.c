@@ -3,9 +3,16 @@
 #include <time.h>
 #include <string.h>
 #include "binsearchshuffle.h"
+#include "binsearchshuffle_parallel.h"
+#include "binsearchshuffle_table.h"
+#include "binsearchshuffle_file.h"
+#include "binsearchshuffle_stats.h"
+#include "binsearchshuffle_arena.h"
+#include "binsearchshuffle_shard.h"
+#include "binsearchshuffle_offload.h"
 
 #define MAX_ARRAY_SIZE 1024
-static int qsortInts(const void *a, const void *b) { return *(const int*)a - *(const int*)b; }
+static int qsortInts(const void *a, const void *b) { return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b); }
 
 int TestShuffle()
 {
@@ -48,11 +55,1690 @@ int TestShuffle()
 	return success;
 }
 
+// sorted random values without repeats, from 0 to RAND_MAX/2+count so a value
+// one past either end is an int too
+static void RandomSortedValues(int *values, int count)
+{
+	for (int i = 0; i<count; i++)
+		values[i] = rand()/2;
+	qsort(values, count, sizeof(int), qsortInts);
+	for (int i = 1; i<count; i++) {
+		if (values[i]<=values[i-1])
+			values[i] = values[i-1]+1;
+	}
+}
+
+int TestSearchKernels()
+{
+	int values[MAX_ARRAY_SIZE];
+	int shuffled[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	ShuffledSearchFunc best = ShuffledBinarySearchBest();
+	for (int count = 1; count<MAX_ARRAY_SIZE; count++) {
+		RandomSortedValues(values, count);
+		memcpy(shuffled, values, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+
+		// every value and the values around it, misses between keys and past both ends
+		for (int i = 0; i<count; i++) {
+			for (int value = values[i]-1; value<=values[i]+1; value++) {
+				int index = ShuffledBinarySearch(value, shuffled, count);
+				int fast = ShuffledBinarySearchFast(value, shuffled, count);
+				int branchless = ShuffledBinarySearchBranchless(value, shuffled, count);
+				int neon = ShuffledBinarySearchNEON(value, shuffled, count);
+				if (fast!=index || branchless!=index || neon!=index || best(value, shuffled, count)!=index) {
+					success = 0;
+					printf("Problem: count=%d value=%d shuffled index=%d, fast=%d, branchless=%d, neon=%d\n", count, value, index, fast, branchless, neon);
+				}
+			}
+		}
+	}
+	return success;
+}
+
+// the O(n) versions make the same arrays as ShuffleSortedArray and SortShuffledArray
+int TestShuffleCopy()
+{
+	int values[MAX_ARRAY_SIZE];
+	int shuffled[MAX_ARRAY_SIZE];
+	int copy[MAX_ARRAY_SIZE], scratch[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 1; count<MAX_ARRAY_SIZE; count++) {
+		RandomSortedValues(values, count);
+		memcpy(shuffled, values, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+
+		ShuffleSortedArrayCopy(copy, values, count);
+		if (memcmp(copy, shuffled, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: shuffle copy count=%d\n", count);
+		}
+		SortShuffledArrayScratch(copy, count, scratch);
+		if (memcmp(copy, values, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: sort with scratch count=%d\n", count);
+		}
+		SortShuffledArrayCopy(copy, shuffled, count);
+		if (memcmp(copy, values, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: sort copy count=%d\n", count);
+		}
+		ShuffleSortedArrayScratch(copy, count, scratch);
+		if (memcmp(copy, shuffled, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: shuffle with scratch count=%d\n", count);
+		}
+	}
+	return success;
+}
+
+int TestBatchSearch()
+{
+	int values[MAX_ARRAY_SIZE];
+	int shuffled[MAX_ARRAY_SIZE];
+	static int lookups[3*MAX_ARRAY_SIZE], batch[3*MAX_ARRAY_SIZE], linear[3*MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 1; count<MAX_ARRAY_SIZE; count++) {
+		RandomSortedValues(values, count);
+		memcpy(shuffled, values, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+
+		// each value, the value below it (between keys or before the first) and one past the last, shuffled
+		int nlookups = 0;
+		for (int i = 0; i<count; i++) {
+			lookups[nlookups++] = values[i];
+			lookups[nlookups++] = values[i]-1;
+		}
+		lookups[nlookups++] = values[count-1]+1;
+		for (int i = nlookups-1; i>0; i--) {
+			int j = rand()%(i+1), t = lookups[i];
+			lookups[i] = lookups[j];
+			lookups[j] = t;
+		}
+		ShuffledBinarySearchBatch(lookups, nlookups, shuffled, count, batch);
+		ShuffledBinarySearchBatchDeshuffled(lookups, nlookups, shuffled, count, linear);
+		for (int i = 0; i<nlookups; i++) {
+			int index = ShuffledBinarySearch(lookups[i], shuffled, count);
+			int expected = index<0 ? -1 : DeshuffleIndex(index, count);
+			if (batch[i]!=index || linear[i]!=expected) {
+				success = 0;
+				printf("Problem: batch search count=%d value=%d found index %d linear %d, expected %d linear %d\n", count, lookups[i], batch[i], linear[i], index, expected);
+				break;
+			}
+		}
+	}
+	return success;
+}
+
+// same results as the int versions, compile with -DSHUFFLE_MAX_INT_COUNT=100 to
+// test the 64-bit steps on small arrays
+int TestShuffle64()
+{
+	int sorted[MAX_ARRAY_SIZE];
+	int shuffled[MAX_ARRAY_SIZE];
+	int shuffled64[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 0; count<MAX_ARRAY_SIZE; count++) {
+		for (int i = 0; i<count; i++)
+			sorted[i] = i*2;
+		memcpy(shuffled, sorted, count*sizeof(int));
+		memcpy(shuffled64, sorted, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+		ShuffleSortedArray64(shuffled64, count);
+		if (memcmp(shuffled, shuffled64, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: shuffle64 count=%d\n", count);
+		}
+		for (int i = 0; i<count; i++) {
+			int64_t index = ShuffledBinarySearch64(sorted[i], shuffled64, count);
+			if (index<0 || DeshuffleIndex64(index, count)!=i || shuffled64[index]!=sorted[i] ||
+				ShuffledBinarySearch64(sorted[i]+1, shuffled64, count)>=0) {
+				success = 0;
+				printf("Problem: search64 count=%d index=%d\n", count, i);
+				break;
+			}
+		}
+		SortShuffledArray64(shuffled64, count);
+		if (memcmp(shuffled64, sorted, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: sort64 count=%d\n", count);
+		}
+	}
+	return success;
+}
+
+int TestInsertRemove()
+{
+	static int sorted[MAX_ARRAY_SIZE];
+	static int shuffled[MAX_ARRAY_SIZE];
+	int count = 0;
+
+	int success = 1;
+
+	// random inserts and removes checked against a sorted copy, with lookups that miss
+	for (int op = 0; op<4*MAX_ARRAY_SIZE && success; op++) {
+		int value = rand() % (2*MAX_ARRAY_SIZE);
+		int linear = 0;
+		while (linear<count && sorted[linear]<value)
+			linear++;
+		int found = linear<count && sorted[linear]==value;
+		if (found && (rand()&1)) {
+			memmove(sorted+linear, sorted+linear+1, (count-linear-1)*sizeof(int));
+			count = RemoveShuffledArrayValue(value, shuffled, count);
+			found = 0;
+		} else if (!found && count<MAX_ARRAY_SIZE) {
+			memmove(sorted+linear+1, sorted+linear, (count-linear)*sizeof(int));
+			sorted[linear] = value;
+			count = InsertShuffledArrayValue(value, shuffled, count);
+			found = 1;
+		}
+		int index = ShuffledBinarySearch(value, shuffled, count);
+		if (found ? index<0 || DeshuffleIndex(index, count)!=linear : index>=0) {
+			success = 0;
+			printf("Problem: value %d found at %d after an update (count %d)\n", value, index, count);
+		}
+	}
+	SortShuffledArray(shuffled, count);
+	if (success && memcmp(shuffled, sorted, count*sizeof(int))) {
+		success = 0;
+		printf("Problem: updated array does not sort back\n");
+	}
+	return success;
+}
+
+int TestIndexConversion()
+{
+	static int indices[MAX_ARRAY_SIZE+4], converted[MAX_ARRAY_SIZE+4], back[MAX_ARRAY_SIZE+4];
+
+	int success = 1;
+
+	for (int count = 0; count<=MAX_ARRAY_SIZE && success; count++) {
+		int n = count+4;	// and some out of range
+		for (int i = 0; i<n; i++)
+			indices[i] = i-2;
+		DeshuffleIndices(indices, n, count, converted);
+		ShuffleIndices(converted, n, count, back);
+		for (int i = 0; i<n; i++) {
+			int index = indices[i];
+			int linear = DeshuffleIndex(index, count);
+			if (DeshuffleIndexBranchless(index, count)!=linear || converted[i]!=linear ||
+				ShuffleIndex(linear, count)!=(linear<0 ? -1 : index) || back[i]!=(linear<0 ? -1 : index)) {
+				success = 0;
+				printf("Problem: index conversion count=%d index=%d linear=%d branchless=%d batch=%d back=%d\n", count, index, linear,
+					DeshuffleIndexBranchless(index, count), converted[i], back[i]);
+				break;
+			}
+		}
+	}
+	// large counts, 2^31-1 is a full tree
+	int counts[3] = { 0x7fffffff, 0x7ffffffe, 1000003 };
+	for (int c = 0; c<3; c++) {
+		for (int i = 0; i<MAX_ARRAY_SIZE; i++)
+			indices[i] = (int)(((unsigned int)rand()<<16 ^ (unsigned int)rand()) % (unsigned int)counts[c]);
+		DeshuffleIndices(indices, MAX_ARRAY_SIZE, counts[c], converted);
+		ShuffleIndices(converted, MAX_ARRAY_SIZE, counts[c], back);
+		for (int i = 0; i<MAX_ARRAY_SIZE; i++) {
+			if (converted[i]!=DeshuffleIndex(indices[i], counts[c]) || back[i]!=indices[i]) {
+				success = 0;
+				printf("Problem: index conversion count=%d index=%d\n", counts[c], indices[i]);
+				break;
+			}
+		}
+	}
+	return success;
+}
+
+int TestShuffledRange()
+{
+	int values[MAX_ARRAY_SIZE];
+	int shuffled[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 0; count<MAX_ARRAY_SIZE; count += 1+count/16) {
+		for (int i = 0; i<count; i++)
+			values[i] = i*2;	// odd values are between the values
+		memcpy(shuffled, values, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+
+		for (int v = -1; v<=count*2; v++) {
+			int lower = ShuffledLowerBound(v, shuffled, count);
+			int upper = ShuffledUpperBound(v, shuffled, count);
+			int expected_lower = v<0 ? 0 : (v+1)/2;
+			int expected_upper = v<0 ? 0 : (v/2+1<count ? v/2+1 : count);
+			if (lower!=expected_lower || upper!=expected_upper) {
+				success = 0;
+				printf("Problem: bounds count=%d value=%d lower=%d upper=%d\n", count, v, lower, upper);
+			}
+		}
+
+		// walk a few ranges in sorted order
+		for (int min = -3; min<count*2; min += 1+count/3) {
+			int max = min + count/2;
+			int first, end;
+			int n = ShuffledRange(min, max, shuffled, count, &first, &end);
+			ShuffledIterator it;
+			ShuffledIteratorBegin(&it, shuffled, count, first, end);
+			int walked = 0;
+			for (int index; (index = ShuffledIteratorNext(&it))>=0; walked++) {
+				if (shuffled[index]!=values[first+walked] || shuffled[index]<min || shuffled[index]>max) {
+					success = 0;
+					printf("Problem: iterator count=%d range %d-%d step %d index %d\n", count, min, max, walked, index);
+					break;
+				}
+			}
+			if (walked!=n) {
+				success = 0;
+				printf("Problem: iterator count=%d range %d-%d walked %d of %d\n", count, min, max, walked, n);
+			}
+		}
+	}
+	return success;
+}
+
+int TestRadix()
+{
+	static int sorted[20000], shuffled[20000];
+	ShuffledRadix radix;
+
+	int success = 1;
+
+	for (int kind = 0; kind<4 && success; kind++) {
+		for (int count = 0; count<=20000 && success; count += count<64 ? 1 : 1999) {
+			// uniform over all ints, small steps, clusters, and values at the ends of the range
+			int value = kind==0 ? -0x7fffffff-1 : -1000;
+			for (int i = 0; i<count; i++) {
+				sorted[i] = value;
+				if (kind==0)
+					value = (int)((unsigned int)value + 1 + ((unsigned int)rand()*0x10001u) % (0xfffffffeu/(unsigned int)count));
+				else if (kind==1)
+					value += 1 + rand()%3;
+				else if (kind==2)
+					value += (i%100)==99 ? 1000000 : 1;
+				else if (i<count-1)
+					value = i==count-2 ? 0x7fffffff : value+1;
+			}
+			memcpy(shuffled, sorted, count*sizeof(int));
+			ShuffleSortedArray(shuffled, count);
+			for (int bits = 0; bits<=16 && success; bits += 4) {
+				if (!ShuffledRadixInit(&radix, shuffled, count, bits)) {
+					printf("Problem: radix init out of memory\n");
+					return 0;
+				}
+				for (int i = 0; i<count; i++) {
+					int index = ShuffledBinarySearch(sorted[i], shuffled, count);
+					if (ShuffledRadixSearch(sorted[i], &radix, shuffled, count)!=index ||
+						(sorted[i]<0x7fffffff && ShuffledRadixSearch(sorted[i]+1, &radix, shuffled, count)!=ShuffledBinarySearch(sorted[i]+1, shuffled, count))) {
+						success = 0;
+						printf("Problem: radix kind=%d count=%d bits=%d value=%d\n", kind, count, bits, sorted[i]);
+						break;
+					}
+				}
+				if (ShuffledRadixSearch(-0x7fffffff-1, &radix, shuffled, count)!=ShuffledBinarySearch(-0x7fffffff-1, shuffled, count) ||
+					ShuffledRadixSearch(0x7fffffff, &radix, shuffled, count)!=ShuffledBinarySearch(0x7fffffff, shuffled, count)) {
+					success = 0;
+					printf("Problem: radix kind=%d count=%d bits=%d smallest or largest int\n", kind, count, bits);
+				}
+				ShuffledRadixFree(&radix);
+			}
+		}
+	}
+	return success;
+}
+
+int TestDuplicates()
+{
+	int sorted[MAX_ARRAY_SIZE], shuffled[MAX_ARRAY_SIZE], expected[MAX_ARRAY_SIZE], scratch[MAX_ARRAY_SIZE];
+	int inserts[64], removes[64];
+
+	int success = 1;
+
+	for (int count = 0; count<300 && success; count++) {
+		int range = 1 + count/8;	// about 8 of each value
+		for (int i = 0; i<count; i++)
+			sorted[i] = rand() % range;
+		qsort(sorted, count, sizeof(int), qsortInts);
+		memcpy(shuffled, sorted, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+		for (int value = -1; value<=range; value++) {
+			int first = 0, end;
+			while (first<count && sorted[first]<value)
+				first++;
+			for (end = first; end<count && sorted[end]==value; end++);
+			int found_first = -1, found_end = -1;
+			int n = ShuffledEqualRange(value, shuffled, count, &found_first, &found_end);
+			if (n!=end-first || found_first!=first || found_end!=end || ShuffledCount(value, shuffled, count)!=n) {
+				success = 0;
+				printf("Problem: equal range of %d in %d values is [%d, %d) should be [%d, %d)\n", value, count, found_first, found_end, first, end);
+				break;
+			}
+		}
+
+		// inserts keep the repeats
+		int value = rand() % range;
+		int n = InsertShuffledArrayValueMulti(value, shuffled, count);
+		if (n!=count+1) {
+			success = 0;
+			printf("Problem: insert multi count=%d\n", count);
+		}
+		memcpy(expected, sorted, count*sizeof(int));
+		expected[count] = value;
+		qsort(expected, count+1, sizeof(int), qsortInts);
+		SortShuffledArray(shuffled, n);
+		if (memcmp(shuffled, expected, n*sizeof(int))) {
+			success = 0;
+			printf("Problem: insert multi count=%d value=%d\n", count, value);
+		}
+
+		// a remove takes out one value, repeated removes take out more
+		int ninserts = rand() % 32, nremoves = rand() % 32;
+		for (int i = 0; i<ninserts; i++)
+			inserts[i] = rand() % range;
+		for (int i = 0; i<nremoves; i++)
+			removes[i] = rand() % (range+1);
+		qsort(inserts, ninserts, sizeof(int), qsortInts);
+		qsort(removes, nremoves, sizeof(int), qsortInts);
+		int nexpected = 0;
+		for (int i = 0, r = 0; i<count; i++) {
+			while (r<nremoves && removes[r]<sorted[i])
+				r++;
+			if (r<nremoves && removes[r]==sorted[i])
+				r++;
+			else
+				expected[nexpected++] = sorted[i];
+		}
+		memcpy(expected+nexpected, inserts, ninserts*sizeof(int));
+		nexpected += ninserts;
+		qsort(expected, nexpected, sizeof(int), qsortInts);
+		for (int pass = 0; pass<2; pass++) {
+			memcpy(shuffled, sorted, count*sizeof(int));
+			ShuffleSortedArray(shuffled, count);
+			n = ShuffledArrayBulkUpdateMulti(shuffled, count, inserts, ninserts, removes, nremoves, pass ? scratch : NULL);
+			SortShuffledArray(shuffled, n);
+			if (n!=nexpected || memcmp(shuffled, expected, n*sizeof(int))) {
+				success = 0;
+				printf("Problem: bulk update multi count=%d inserts=%d removes=%d %s scratch\n", count, ninserts, nremoves, pass ? "with" : "without");
+			}
+		}
+	}
+	return success;
+}
+
+int TestBlockShuffle()
+{
+	static int sorted[MAX_ARRAY_SIZE*20];
+	static int block[MAX_ARRAY_SIZE*20+64];
+	static int unshuffled[MAX_ARRAY_SIZE*20];
+
+	int success = 1;
+
+	for (int count = 1; count<MAX_ARRAY_SIZE*20; count += 1+count/8) {
+		for (int i = 0; i<count; i++)
+			sorted[i] = i*3 - count;	// gaps between values to search for misses
+		if (count&1)
+			sorted[count-1] = 0x7fffffff;	// same as the padding
+		BlockShuffleSortedArray(block, sorted, count);
+
+		for (int i = 0; i<count; i++) {
+			int index = BlockShuffledBinarySearch(sorted[i], block, count);
+			int linear = BlockDeshuffleIndex(index, count);
+			if (index<0 || block[index]!=sorted[i] || linear!=i) {
+				success = 0;
+				printf("Problem: block search count=%d linear index=%d, block index=%d, deshuffled index=%d\n", count, i, index, linear);
+			}
+			if (sorted[i]<0x7fffffff && BlockShuffledBinarySearch(sorted[i]+1, block, count)>=0 && (i==count-1 || sorted[i]+1!=sorted[i+1])) {
+				success = 0;
+				printf("Problem: block search count=%d found missing value %d\n", count, sorted[i]+1);
+			}
+		}
+		BlockSortShuffledArray(unshuffled, block, count);
+		if (memcmp(unshuffled, sorted, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: block sort count=%d\n", count);
+		}
+	}
+	// the size of the largest counts is rounded up without overflowing
+	int keys = BlockShuffledArraySize(1);	// per node
+	int large[] = { 0x7fffffff, 0x7fffffff-keys+1, 0x7fffffff/keys*keys, 0x7fffffff/keys*keys-1 };
+	for (int l = 0; l<(int)(sizeof(large)/sizeof(large[0])); l++) {
+		long long size = ((long long)large[l]+keys-1) / keys * keys;
+		if (BlockShuffledArraySize(large[l])!=(size>0x7fffffff ? 0 : size)) {
+			success = 0;
+			printf("Problem: block size count=%d is %d\n", large[l], BlockShuffledArraySize(large[l]));
+		}
+	}
+	return success;
+}
+
+int TestEytzinger()
+{
+	int sorted[MAX_ARRAY_SIZE];
+	int eytzinger[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 1; count<MAX_ARRAY_SIZE; count++) {
+		for (int i = 0; i<count; i++)
+			sorted[i] = i*2;
+		memcpy(eytzinger, sorted, count*sizeof(int));
+		EytzingerShuffleSortedArray(eytzinger, count);
+
+		for (int i = 0; i<count; i++) {
+			int index = EytzingerBinarySearch(sorted[i], eytzinger, count);
+			int linear = EytzingerDeshuffleIndex(index, count);
+			if (index<0 || linear!=i || EytzingerBinarySearch(sorted[i]+1, eytzinger, count)>=0) {
+				success = 0;
+				printf("Problem: eytzinger count=%d linear index=%d, index=%d, deshuffled index=%d\n", count, i, index, linear);
+			}
+		}
+		if (EytzingerBinarySearch(-1, eytzinger, count)>=0) {
+			success = 0;
+			printf("Problem: eytzinger count=%d found value before first\n", count);
+		}
+		EytzingerSortShuffledArray(eytzinger, count);
+		if (memcmp(eytzinger, sorted, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: eytzinger sort count=%d\n", count);
+		}
+	}
+	return success;
+}
+
+int TestHybrid()
+{
+	int sorted[MAX_ARRAY_SIZE];
+	int hybrid[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 0; count<MAX_ARRAY_SIZE; count++) {
+		for (int i = 0; i<count; i++)
+			sorted[i] = i*2;
+		memcpy(hybrid, sorted, count*sizeof(int));
+		HybridShuffleSortedArray(hybrid, count);
+
+		for (int i = 0; i<count; i++) {
+			int index = HybridShuffledBinarySearch(sorted[i], hybrid, count);
+			int linear = HybridDeshuffleIndex(index, count);
+			if (index<0 || linear!=i || hybrid[index]!=sorted[i] || HybridShuffledBinarySearch(sorted[i]+1, hybrid, count)>=0) {
+				success = 0;
+				printf("Problem: hybrid count=%d linear index=%d, index=%d, deshuffled index=%d\n", count, i, index, linear);
+				break;
+			}
+		}
+		if (HybridShuffledBinarySearch(-1, hybrid, count)>=0) {
+			success = 0;
+			printf("Problem: hybrid count=%d found value before first\n", count);
+		}
+		HybridSortShuffledArray(hybrid, count);
+		if (memcmp(hybrid, sorted, count*sizeof(int))) {
+			success = 0;
+			printf("Problem: hybrid sort count=%d\n", count);
+		}
+	}
+	return success;
+}
+
+typedef struct { uint64_t hi, lo; } CompositeKey;
+static int CompareComposite(const void *a, const void *b)
+{
+	const CompositeKey *ka = (const CompositeKey*)a, *kb = (const CompositeKey*)b;
+	if (ka->hi!=kb->hi)
+		return ka->hi<kb->hi ? -1 : 1;
+	return ka->lo<kb->lo ? -1 : (ka->lo>kb->lo ? 1 : 0);
+}
+
+int TestShuffleTypes()
+{
+	uint64_t keys64[MAX_ARRAY_SIZE+1];
+	float keysf[MAX_ARRAY_SIZE+1];
+	CompositeKey keysc[MAX_ARRAY_SIZE+1];
+
+	int success = 1;
+
+	for (int count = 1; count<MAX_ARRAY_SIZE; count += 7) {
+		// strictly increasing keys so there are no duplicates
+		uint64_t v = 0;
+		for (int i = 0; i<count; i++) {
+			v += 1 + ((uint64_t)rand() << 20);
+			keys64[i] = v;
+			keysf[i] = (float)i * 0.5f - 100.0f;
+			keysc[i].hi = (uint64_t)i / 3;
+			keysc[i].lo = v;
+		}
+		ShuffleSortedArray_u64(keys64, count);
+		ShuffleSortedArray_f32(keysf, count);
+		ShuffleSortedArrayGeneric(keysc, count, sizeof(CompositeKey));
+
+		for (int i = 0; i<count; i++) {
+			int index = ShuffledBinarySearch_u64(keys64[i], keys64, count);
+			int indexf = ShuffledBinarySearch_f32(keysf[i], keysf, count);
+			int indexc = ShuffledBinarySearchGeneric(&keysc[i], keysc, count, sizeof(CompositeKey), CompareComposite);
+			if (index!=i || indexf!=i || indexc!=i) {
+				success = 0;
+				printf("Problem: typed search count=%d index=%d found u64=%d f32=%d generic=%d\n", count, i, index, indexf, indexc);
+			}
+		}
+
+		// remove and reinsert a key, the array should come back the same
+		CompositeKey key = keysc[count/2];
+		int removed = RemoveShuffledArrayValueGeneric(&key, keysc, count, sizeof(CompositeKey), CompareComposite);
+		int inserted = InsertShuffledArrayValueGeneric(&key, keysc, removed, sizeof(CompositeKey), CompareComposite);
+		uint64_t key64 = keys64[count/2];
+		RemoveShuffledArrayValue_u64(key64, keys64, count);
+		InsertShuffledArrayValue_u64(key64, keys64, count-1);
+		if (removed!=count-1 || inserted!=count ||
+			ShuffledBinarySearchGeneric(&key, keysc, count, sizeof(CompositeKey), CompareComposite)!=count/2 ||
+			ShuffledBinarySearch_u64(key64, keys64, count)!=count/2) {
+			success = 0;
+			printf("Problem: typed insert/remove count=%d\n", count);
+		}
+
+		SortShuffledArray_u64(keys64, count);
+		SortShuffledArrayGeneric(keysc, count, sizeof(CompositeKey));
+		for (int i = 1; i<count; i++) {
+			if (keys64[i-1]>=keys64[i] || CompareComposite(&keysc[i-1], &keysc[i])>=0) {
+				success = 0;
+				printf("Problem: typed sort count=%d index=%d\n", count, i);
+				break;
+			}
+		}
+	}
+	return success;
+}
+
+typedef struct { int key; char name[44]; } TestRecord;	// 48 byte values
+
+int TestKeyValues()
+{
+	int keys[MAX_ARRAY_SIZE];
+	TestRecord records[MAX_ARRAY_SIZE];
+	short shorts[MAX_ARRAY_SIZE];
+	static int copy_keys[MAX_ARRAY_SIZE], scratch_keys[MAX_ARRAY_SIZE];
+	static TestRecord copy_records[MAX_ARRAY_SIZE], scratch_records[MAX_ARRAY_SIZE], scratch[MAX_ARRAY_SIZE];
+	static short copy_shorts[MAX_ARRAY_SIZE], scratch_shorts[MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 1; count<MAX_ARRAY_SIZE; count += 1+count/8) {
+		for (int i = 0; i<count; i++) {
+			keys[i] = i*3;
+			records[i].key = i*3;
+			sprintf(records[i].name, "record %d", i*3);
+			shorts[i] = (short)i;
+		}
+		void *values[2] = { records, shorts };
+		size_t sizes[2] = { sizeof(TestRecord), sizeof(short) };
+		// the O(n) versions make the same arrays from the sorted ones
+		void *copy_values[2] = { copy_records, copy_shorts };
+		void *scratch_values[2] = { scratch_records, scratch_shorts };
+		const void *sorted_values[2] = { records, shorts };
+		ShuffleSortedArrayValuesCopy(copy_keys, copy_values, keys, sorted_values, count, sizes, 2);
+		memcpy(scratch_keys, keys, count*sizeof(int));
+		memcpy(scratch_records, records, count*sizeof(TestRecord));
+		memcpy(scratch_shorts, shorts, count*sizeof(short));
+		ShuffleSortedArrayValuesScratch(scratch_keys, count, scratch_values, sizes, 2, scratch);
+		ShuffleSortedArrayValues(keys, count, values, sizes, 2);
+		if (memcmp(copy_keys, keys, count*sizeof(int)) || memcmp(copy_records, records, count*sizeof(TestRecord)) ||
+			memcmp(copy_shorts, shorts, count*sizeof(short)) || memcmp(scratch_keys, keys, count*sizeof(int)) ||
+			memcmp(scratch_records, records, count*sizeof(TestRecord)) || memcmp(scratch_shorts, shorts, count*sizeof(short))) {
+			success = 0;
+			printf("Problem: key/value copy or scratch shuffle count=%d\n", count);
+		}
+		const void *shuffled_values[2] = { records, shorts };
+		SortShuffledArrayValuesCopy(copy_keys, copy_values, keys, shuffled_values, count, sizes, 2);
+		SortShuffledArrayValuesScratch(scratch_keys, count, scratch_values, sizes, 2, scratch);
+
+		for (int i = 0; i<count; i++) {
+			const TestRecord *record = (const TestRecord*)ShuffledLookupValue(i*3, keys, count, records, sizeof(TestRecord));
+			int index = ShuffledBinarySearch(i*3, keys, count);
+			if (!record || record->key!=i*3 || keys[index]!=records[index].key || shorts[index]!=i) {
+				success = 0;
+				printf("Problem: key/value count=%d key=%d\n", count, i*3);
+			}
+		}
+		if (ShuffledLookupValue(1, keys, count, records, sizeof(TestRecord))) {
+			success = 0;
+			printf("Problem: key/value count=%d found a missing key\n", count);
+		}
+		SortShuffledArrayValues(keys, count, values, sizes, 2);
+		for (int i = 0; i<count; i++) {
+			if (keys[i]!=i*3 || records[i].key!=i*3 || shorts[i]!=i || copy_keys[i]!=i*3 || copy_records[i].key!=i*3 ||
+				copy_shorts[i]!=i || scratch_keys[i]!=i*3 || scratch_records[i].key!=i*3 || scratch_shorts[i]!=i) {
+				success = 0;
+				printf("Problem: key/value sort count=%d index=%d\n", count, i);
+				break;
+			}
+		}
+	}
+
+	// char values with scratch sized as documented, count ints is the larger
+	for (int count = 1; count<MAX_ARRAY_SIZE; count += 1+count/8) {
+		int *scratch_ints = (int*)malloc(count*sizeof(int));
+		char *chars = (char*)malloc(count);
+		if (!scratch_ints || !chars) {
+			free(scratch_ints);
+			free(chars);
+			continue;
+		}
+		for (int i = 0; i<count; i++) {
+			keys[i] = i*3;
+			chars[i] = (char)i;
+		}
+		void *values[1] = { chars };
+		size_t sizes[1] = { sizeof(char) };
+		ShuffleSortedArrayValuesScratch(keys, count, values, sizes, 1, scratch_ints);
+		for (int i = 0; i<count; i++) {
+			int index = ShuffledBinarySearch(i*3, keys, count);
+			if (index<0 || chars[index]!=(char)i) {
+				success = 0;
+				printf("Problem: key/value char scratch count=%d key=%d\n", count, i*3);
+				break;
+			}
+		}
+		SortShuffledArrayValuesScratch(keys, count, values, sizes, 1, scratch_ints);
+		for (int i = 0; i<count; i++) {
+			if (keys[i]!=i*3 || chars[i]!=(char)i) {
+				success = 0;
+				printf("Problem: key/value char scratch sort count=%d index=%d\n", count, i);
+				break;
+			}
+		}
+		free(scratch_ints);
+		free(chars);
+	}
+	return success;
+}
+
+int TestBulkUpdate()
+{
+	int values[MAX_ARRAY_SIZE];
+	int shuffled[2*MAX_ARRAY_SIZE];
+	int expected[2*MAX_ARRAY_SIZE];
+	int inserts[MAX_ARRAY_SIZE];
+	int removes[MAX_ARRAY_SIZE];
+	int scratch[2*MAX_ARRAY_SIZE];
+
+	int success = 1;
+
+	for (int count = 0; count<MAX_ARRAY_SIZE; count += 1+count/4) {
+		for (int pass = 0; pass<2; pass++) {	// in-place and with scratch
+			// even values in the array, inserts and removes are any values with repeats
+			for (int i = 0; i<count; i++)
+				values[i] = i*2;
+			memcpy(shuffled, values, count*sizeof(int));
+			ShuffleSortedArray(shuffled, count);
+			int ninserts = rand() % (count+2);
+			int nremoves = rand() % (count+2);
+			for (int i = 0; i<ninserts; i++)
+				inserts[i] = rand() % (2*count+4) - 2;
+			for (int i = 0; i<nremoves; i++)
+				removes[i] = rand() % (2*count+4) - 2;
+			qsort(inserts, ninserts, sizeof(int), qsortInts);
+			qsort(removes, nremoves, sizeof(int), qsortInts);
+
+			// expected: mark what is left in a table of all values
+			int range = 2*count+4;
+			unsigned char present[2*MAX_ARRAY_SIZE+4];
+			memset(present, 0, range);
+			for (int i = 0; i<count; i++)
+				present[values[i]+2] = 1;
+			for (int i = 0; i<nremoves; i++)
+				present[removes[i]+2] = 0;
+			for (int i = 0; i<ninserts; i++)
+				present[inserts[i]+2] = 1;
+			int nexpected = 0;
+			for (int v = 0; v<range; v++) {
+				if (present[v])
+					expected[nexpected++] = v-2;
+			}
+			ShuffleSortedArray(expected, nexpected);
+
+			int updated = ShuffledArrayBulkUpdate(shuffled, count, inserts, ninserts, removes, nremoves, pass ? scratch : NULL);
+			if (updated!=nexpected || memcmp(shuffled, expected, nexpected*sizeof(int))) {
+				success = 0;
+				printf("Problem: bulk update count=%d inserts=%d removes=%d scratch=%d\n", count, ninserts, nremoves, pass);
+			}
+		}
+	}
+
+	// random trickle of updates through a delta, checked against a table
+	int delta_buffer[2*16];
+	unsigned char present[MAX_ARRAY_SIZE];
+	ShuffledDelta delta;
+	memset(present, 0, sizeof(present));
+	ShuffledDeltaInit(&delta, shuffled, 0, MAX_ARRAY_SIZE/2, delta_buffer, 16, scratch);
+	int total = 0;
+	for (int i = 0; i<20000; i++) {
+		int value = rand() % MAX_ARRAY_SIZE;
+		if (rand() & 1) {
+			int result = ShuffledDeltaInsert(&delta, value);
+			int expect = present[value] ? 0 : (total<MAX_ARRAY_SIZE/2 ? 1 : -1);
+			if (result!=expect) {
+				success = 0;
+				printf("Problem: delta insert %d returned %d\n", value, result);
+			}
+			if (result>0) {
+				present[value] = 1;
+				total++;
+			}
+		} else {
+			int result = ShuffledDeltaRemove(&delta, value);
+			if (result!=present[value]) {
+				success = 0;
+				printf("Problem: delta remove %d returned %d\n", value, result);
+			}
+			total -= present[value];
+			present[value] = 0;
+		}
+		int probe = rand() % MAX_ARRAY_SIZE;
+		if (ShuffledDeltaContains(&delta, probe)!=present[probe] || ShuffledDeltaCount(&delta)!=total) {
+			success = 0;
+			printf("Problem: delta contains %d or count %d\n", probe, total);
+		}
+	}
+	ShuffledDeltaMerge(&delta);
+	for (int v = 0; v<MAX_ARRAY_SIZE; v++) {
+		if ((ShuffledBinarySearch(v, shuffled, delta.count)>=0)!=present[v]) {
+			success = 0;
+			printf("Problem: delta merge value %d\n", v);
+		}
+	}
+	return success;
+}
+
+int TestGapped()
+{
+	static unsigned char present[1<<16];
+	int sorted[MAX_ARRAY_SIZE];
+	ShuffledGapped gapped;
+
+	int success = 1;
+
+	for (int i = 0; i<MAX_ARRAY_SIZE; i++)
+		sorted[i] = i*64;
+	memset(present, 0, sizeof(present));
+	for (int i = 0; i<MAX_ARRAY_SIZE; i++)
+		present[i*64] = 1;
+	if (!ShuffledGappedInit(&gapped, sorted, MAX_ARRAY_SIZE)) {
+		printf("Problem: gapped init out of memory\n");
+		return 0;
+	}
+
+	// grow and shrink with runs of inserts and removes in random orders
+	int total = MAX_ARRAY_SIZE;
+	for (int round = 0; round<40 && success; round++) {
+		int inserting = (round%8)<4;
+		for (int i = 0; i<2000; i++) {
+			int value = (round&1) ? rand() % (1<<16) : (rand() % 256) + (round%4)*1024;	// spread out or clustered
+			int result = inserting ? ShuffledGappedInsert(&gapped, value) : ShuffledGappedRemove(&gapped, value);
+			int expect = inserting ? !present[value] : present[value];
+			if (result!=expect) {
+				success = 0;
+				printf("Problem: gapped %s %d returned %d\n", inserting ? "insert" : "remove", value, result);
+				break;
+			}
+			if (result)
+				total += inserting ? 1 : -1;
+			present[value] = (unsigned char)inserting;
+		}
+		if (gapped.count!=total) {
+			success = 0;
+			printf("Problem: gapped count %d should be %d\n", gapped.count, total);
+		}
+		for (int v = 0; v<(1<<16); v++) {
+			int index = ShuffledGappedSearch(v, &gapped);
+			if ((index>=0)!=present[v] || (index>=0 && gapped.slots[index]!=v)) {
+				success = 0;
+				printf("Problem: gapped search value %d round %d capacity %d\n", v, round, gapped.capacity);
+				break;
+			}
+		}
+	}
+	// contiguous removes from the top leave no long runs of gaps to copy into
+	for (int v = (1<<16)-1; v>=(1<<15) && success; v--) {
+		if (ShuffledGappedRemove(&gapped, v)!=present[v]) {
+			success = 0;
+			printf("Problem: gapped remove %d from the top\n", v);
+		}
+		present[v] = 0;
+		if (!(v & 1023)) {
+			for (int w = 0; w<(1<<16); w++) {
+				int index = ShuffledGappedSearch(w, &gapped);
+				if ((index>=0)!=present[w]) {
+					success = 0;
+					printf("Problem: gapped search value %d after removing from %d down\n", w, v);
+					break;
+				}
+			}
+		}
+	}
+	// remove everything
+	for (int v = 0; v<(1<<16); v++) {
+		if (present[v])
+			ShuffledGappedRemove(&gapped, v);
+	}
+	if (gapped.count || ShuffledGappedSearch(0, &gapped)>=0 || ShuffledGappedInsert(&gapped, 7)!=1 || ShuffledGappedSearch(7, &gapped)<0) {
+		success = 0;
+		printf("Problem: gapped empty array\n");
+	}
+	ShuffledGappedFree(&gapped);
+	return success;
+}
+
+int TestPacked()
+{
+	static uint64_t sorted[100000], unpacked[100000];
+	static const uint64_t steps[] = { 1, 4, 1000, 100000, 1ull<<40, 4 };	// offsets of 1, 1, 2, 4, 8 and 1 bytes, the last in two clusters
+	ShuffledPacked packed;
+
+	int success = 1;
+
+	for (int s = 0; s<6 && success; s++) {
+		for (int count = 0; count<=300 && success; count += (count<100 ? 1 : 40)) {
+			int n = count==300 ? 100000 : count;
+			uint64_t value = (1ull<<40) + (uint64_t)(rand() % 1000);
+			for (int i = 0; i<n; i++) {
+				sorted[i] = value;
+				value += 1 + (uint64_t)rand() % steps[s];	// dense IDs with random holes
+				if (s==5 && i==n/2)
+					value += 1ull<<50;
+			}
+			if (!ShuffledPackedBuild(&packed, sorted, n)) {
+				printf("Problem: packed build out of memory\n");
+				return 0;
+			}
+			for (int i = 0; i<n; i++) {
+				if (ShuffledPackedSearch(sorted[i], &packed)!=i ||
+					((i+1==n || sorted[i]+1!=sorted[i+1]) && ShuffledPackedSearch(sorted[i]+1, &packed)>=0)) {
+					success = 0;
+					printf("Problem: packed count=%d step=%d linear index=%d\n", n, (int)steps[s], i);
+					break;
+				}
+			}
+			if (ShuffledPackedSearch(0, &packed)>=0 || ShuffledPackedSearch(value, &packed)>=0 || ShuffledPackedSearch(~(uint64_t)0, &packed)>=0) {
+				success = 0;
+				printf("Problem: packed count=%d found value outside the array\n", n);
+			}
+			ShuffledPackedUnpack(&packed, unpacked);
+			if (memcmp(unpacked, sorted, n*sizeof(uint64_t))) {
+				success = 0;
+				printf("Problem: packed unpack count=%d\n", n);
+			}
+			// the leaves of each width are more than half full
+			int width = steps[s]<8 ? 1 : steps[s]<2000 ? 2 : steps[s]<200000 ? 4 : 8;
+			if (n==100000 && ShuffledPackedBytes(&packed)>(size_t)n*width*2) {
+				success = 0;
+				printf("Problem: packed array of %d values with step %d uses %d bytes\n", n, (int)steps[s], (int)ShuffledPackedBytes(&packed));
+			}
+			ShuffledPackedFree(&packed);
+		}
+	}
+	return success;
+}
+
+int TestShards()
+{
+	static int sorted[20000], values[30000], batch[30000];
+	static const int counts[] = { 0, 1, 5, 1000, 20000 };
+	static const int nodes[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	ShuffleScheduler scheduler = ShuffleThreadScheduler(4);
+	ShuffledShardIndex index;
+
+	int success = 1;
+
+	for (int c = 0; c<5; c++) {
+		int count = counts[c];
+		for (int i = 0; i<count; i++)
+			sorted[i] = i*3 - 5000;
+		for (int nshards = 0; nshards<=8 && success; nshards++) {
+			if (!ShuffledShardInit(&index, sorted, count, nshards, nshards==8 ? nodes : NULL)) {
+				printf("Problem: shard init out of memory\n");
+				return 0;
+			}
+			int total = 0;
+			for (int s = 0; s<index.nshards; s++) {
+				if (index.shards[s].first!=total || (count && !index.shards[s].count))
+					success = 0;
+				total += index.shards[s].count;
+			}
+			if (total!=count) {
+				success = 0;
+				printf("Problem: %d shards of %d values hold %d values\n", index.nshards, count, total);
+			}
+			for (int i = 0; i<count; i++) {
+				int shard = ShuffledShardOf(&index, sorted[i]);
+				if (ShuffledShardSearch(&index, sorted[i])!=i || ShuffledShardSearch(&index, sorted[i]+1)>=0 ||
+					i<index.shards[shard].first || i>=index.shards[shard].first+index.shards[shard].count) {
+					success = 0;
+					printf("Problem: %d shards of %d values, linear index %d\n", index.nshards, count, i);
+					break;
+				}
+			}
+			// random hits and misses in one batch, more values than one task
+			int nvalues = count ? 30000 : 10;
+			for (int i = 0; i<nvalues; i++)
+				values[i] = rand() % (3*count+20) - 5010;
+			ShuffledShardSearchBatch(&index, values, nvalues, batch, &scheduler);
+			for (int i = 0; i<nvalues; i++) {
+				if (batch[i]!=ShuffledShardSearch(&index, values[i])) {
+					success = 0;
+					printf("Problem: %d shards of %d values, batch value %d\n", index.nshards, count, values[i]);
+					break;
+				}
+			}
+			ShuffledShardFree(&index);
+		}
+	}
+	return success;
+}
+
+int TestBuildShuffled()
+{
+	static const int counts[] = { 0, 1, 2, 63, 64, 1000, 4097, 100000 };
+	int max_count = 100000;
+	int *unsorted = (int*)malloc(max_count * sizeof(int));
+	int *expected = (int*)malloc(max_count * sizeof(int));
+	int *scratch = (int*)malloc(max_count * sizeof(int));
+
+	int success = 1;
+
+	for (int c = 0; c<(int)(sizeof(counts)/sizeof(counts[0])); c++) {
+		int count = counts[c];
+		for (int range = 0; range<3; range++) {	// small values, negative values, all bits
+			for (int i = 0; i<count; i++) {
+				int value = (int)((unsigned int)rand() ^ ((unsigned int)rand()<<15) ^ ((unsigned int)rand()<<30));
+				unsorted[i] = range==0 ? value & 1023 : (range==1 ? (value & 0xfffff) - 0x80000 : value);
+			}
+			memcpy(expected, unsorted, count*sizeof(int));
+			qsort(expected, count, sizeof(int), qsortInts);
+			ShuffleSortedArray(expected, count);
+			memcpy(scratch, unsorted, count*sizeof(int));	// keep the input, unsorted is overwritten
+			if (BuildShuffledArray(unsorted, count)!=count || memcmp(unsorted, expected, count*sizeof(int))) {
+				success = 0;
+				printf("Problem: build count=%d range=%d\n", count, range);
+			}
+
+			memcpy(unsorted, scratch, count*sizeof(int));
+			qsort(expected, count, sizeof(int), qsortInts);	// sorted array is all the same values
+			int unique = 0;
+			for (int i = 0; i<count; i++) {
+				if (!unique || expected[i]!=expected[unique-1])
+					expected[unique++] = expected[i];
+			}
+			ShuffleSortedArray(expected, unique);
+			if (BuildShuffledArrayScratch(unsorted, count, scratch, SHUFFLE_BUILD_UNIQUE)!=unique || memcmp(unsorted, expected, unique*sizeof(int))) {
+				success = 0;
+				printf("Problem: build unique count=%d range=%d\n", count, range);
+			}
+		}
+	}
+	free(scratch);
+	free(expected);
+	free(unsorted);
+	return success;
+}
+
+// runs the tasks backwards on the calling thread, any order must give the same result
+static void RunTasksBackwards(const ShuffleScheduler *scheduler, ShuffleTaskFunc func, void *data, int tasks)
+{
+	(void)scheduler;
+	while (tasks--)
+		func(data, tasks);
+}
+
+static void CountTask(void *data, int task)
+{
+	((int*)data)[task]++;
+}
+
+// each task runs 8 tasks of its own on the built-in threads while the outer run has the pool
+static void NestedTask(void *data, int task)
+{
+	ShuffleScheduler threads = ShuffleThreadScheduler(3);
+	threads.run(&threads, CountTask, (int*)data + 8*task, 8);
+}
+
+int TestParallelShuffle()
+{
+	static const int counts[] = { 1000, 65536, 100003, (1<<20)+7 };
+	int max_count = (1<<20)+7;
+	int *sorted = (int*)malloc(max_count * sizeof(int));
+	int *shuffled = (int*)malloc(max_count * sizeof(int));
+	int *parallel = (int*)malloc(max_count * sizeof(int));
+
+	ShuffleScheduler schedulers[2];
+	schedulers[0] = ShuffleThreadScheduler(4);
+	schedulers[1].run = RunTasksBackwards;
+	schedulers[1].user = NULL;
+	schedulers[1].workers = 3;
+
+	int success = 1;
+
+	for (int c = 0; c<(int)(sizeof(counts)/sizeof(counts[0])); c++) {
+		int count = counts[c];
+		for (int i = 0; i<count; i++)
+			sorted[i] = i;
+		memcpy(shuffled, sorted, count*sizeof(int));
+		ShuffleSortedArray(shuffled, count);
+		for (int s = 0; s<2; s++) {
+			memcpy(parallel, sorted, count*sizeof(int));
+			ShuffleSortedArrayParallel(parallel, count, &schedulers[s]);
+			if (memcmp(parallel, shuffled, count*sizeof(int))) {
+				success = 0;
+				printf("Problem: parallel shuffle count=%d scheduler=%d\n", count, s);
+			}
+			SortShuffledArrayParallel(parallel, count, s ? &schedulers[s] : NULL);
+			if (memcmp(parallel, sorted, count*sizeof(int))) {
+				success = 0;
+				printf("Problem: parallel sort count=%d scheduler=%d\n", count, s);
+			}
+		}
+	}
+	// the pool runs every task once, again and again and with runs inside its tasks
+	int runs[64], expected[64];
+	memset(runs, 0, sizeof(runs));
+	memset(expected, 0, sizeof(expected));
+	for (int r = 0; r<100; r++) {
+		schedulers[0].run(&schedulers[0], CountTask, runs, 1+r%64);
+		for (int t = 0; t<=r%64; t++)
+			expected[t]++;
+	}
+	schedulers[0].run(&schedulers[0], NestedTask, runs, 8);
+	for (int t = 0; t<64; t++)
+		expected[t]++;
+	if (memcmp(runs, expected, sizeof(runs))) {
+		success = 0;
+		printf("Problem: thread scheduler did not run every task once\n");
+	}
+	free(parallel);
+	free(shuffled);
+	free(sorted);
+	return success;
+}
+
+// task 0 updates the table with odd values while the other tasks look up the
+// even values which are always there
+typedef struct { ShuffledTable table; int failed; } TableTest;
+
+static void TableTestTask(void *data, int task)
+{
+	TableTest *test = (TableTest*)data;
+	if (!task) {
+		for (int i = 0; i<200; i++) {
+			int odd[64];
+			for (int o = 0; o<64; o++)
+				odd[o] = ((i*64+o)%4096)*2+1;
+			if (i&1)
+				ShuffledTableUpdate(&test->table, NULL, 0, odd, 64);
+			else
+				ShuffledTableUpdate(&test->table, odd, 64, NULL, 0);
+		}
+		return;
+	}
+	int reader = ShuffledTableAddReader(&test->table);
+	unsigned int seed = (unsigned int)task;	// rand() is not for threads
+	for (int i = 0; i<200000; i++) {
+		seed = seed*1103515245u + 12345u;
+		int value = (int)((seed>>16) % 4096) * 2;
+		if (!ShuffledTableContains(&test->table, reader, value))
+			test->failed = 1;
+	}
+	ShuffledTableRemoveReader(&test->table, reader);
+}
+
+int TestTable()
+{
+	static TableTest test;
+	int values[4096];
+	for (int i = 0; i<4096; i++)
+		values[i] = i*2;
+
+	int success = 1;
+
+	if (!ShuffledTableInit(&test.table, values, 4096)) {
+		printf("Problem: table init out of memory\n");
+		return 0;
+	}
+	int inserts[3] = { -5, 1, 3 };
+	int removes[2] = { 0, 3 };
+	int reader = ShuffledTableAddReader(&test.table);
+	if (ShuffledTableUpdate(&test.table, inserts, 3, removes, 2)!=4098 || ShuffledTableContains(&test.table, reader, 0) ||
+		!ShuffledTableContains(&test.table, reader, -5) || !ShuffledTableContains(&test.table, reader, 3)) {
+		success = 0;
+		printf("Problem: table update\n");
+	}
+	const ShuffledSnapshot *pinned = ShuffledTablePin(&test.table, reader);
+	if (ShuffledTableReplace(&test.table, values, 4096)!=4096 || pinned->count!=4098 ||
+		ShuffledBinarySearchFast(-5, pinned->values, pinned->count)<0 || !test.table.retired) {
+		success = 0;
+		printf("Problem: table replace while pinned\n");
+	}
+	ShuffledTableUnpin(&test.table, reader);
+	ShuffledTableRemoveReader(&test.table, reader);
+	ShuffledTableReclaim(&test.table);
+	if (test.table.retired) {
+		success = 0;
+		printf("Problem: table retired snapshots not freed\n");
+	}
+
+	ShuffleScheduler threads = ShuffleThreadScheduler(4);
+	test.failed = 0;
+	threads.run(&threads, TableTestTask, &test, 4);
+	if (test.failed) {
+		success = 0;
+		printf("Problem: table lookup failed during updates\n");
+	}
+	ShuffledTableFree(&test.table);
+	return success;
+}
+
+int TestOffload()
+{
+	static int shuffled[20000], values[30000], first[30000], second[30000], expected[30000];
+	static const int counts[] = { 0, 1, 6, 1000, 20000 };
+	ShuffleScheduler threads = ShuffleThreadScheduler(2);
+	ShuffleOffload offload;
+
+	int success = 1;
+
+	for (int c = 0; c<5 && success; c++) {
+		int count = counts[c];
+		for (int i = 0; i<count; i++)
+			shuffled[i] = i*2;
+		ShuffleSortedArray(shuffled, count);
+		for (int i = 0; i<30000; i++)
+			values[i] = rand() % (2*count+4) - 2;
+		for (int f = 0; f<4 && success; f++) {
+			// with and without a device if there is one, on the default and on a two thread scheduler
+			int backend = ShuffleOffloadInit(&offload, shuffled, count, f & SHUFFLE_OFFLOAD_FORCE_CPU, f & 2 ? &threads : NULL);
+			if ((f & SHUFFLE_OFFLOAD_FORCE_CPU) && backend!=SHUFFLE_OFFLOAD_CPU) {
+				success = 0;
+				printf("Problem: offload with SHUFFLE_OFFLOAD_FORCE_CPU has backend %d\n", backend);
+			}
+			// two batches in flight before one wait, the second one split in two submits
+			ShuffleOffloadSubmit(&offload, values, 30000, first, 0);
+			ShuffleOffloadSubmit(&offload, values, 10000, second, SHUFFLE_OFFLOAD_LINEAR);
+			ShuffleOffloadSubmit(&offload, values+10000, 20000, second+10000, SHUFFLE_OFFLOAD_LINEAR);
+			if (!ShuffleOffloadWait(&offload))
+				printf("Warning: offload device failed, the batches were searched on the CPU\n");
+			ShuffledBinarySearchBatch(values, 30000, shuffled, count, expected);
+			if (memcmp(first, expected, sizeof(first))) {
+				success = 0;
+				printf("Problem: offload backend %d of %d values has other shuffled indices than the batch search\n", backend, count);
+			}
+			ShuffledBinarySearchBatchDeshuffled(values, 30000, shuffled, count, expected);
+			if (memcmp(second, expected, sizeof(second))) {
+				success = 0;
+				printf("Problem: offload backend %d of %d values has other linear indices than the batch search\n", backend, count);
+			}
+			ShuffleOffloadSearch(&offload, values, 7, first, SHUFFLE_OFFLOAD_LINEAR);
+			if (memcmp(first, expected, 7*sizeof(int))) {
+				success = 0;
+				printf("Problem: offload search of a small batch\n");
+			}
+			ShuffleOffloadFree(&offload);
+		}
+	}
+
+	return success;
+}
+
+int TestShuffleFile()
+{
+	static const char *path = "test_binsearchshuffle.tmp";
+	static int sorted[MAX_ARRAY_SIZE];
+	static int keys[MAX_ARRAY_SIZE+16];
+	static double doubles[MAX_ARRAY_SIZE];
+	static short shorts[MAX_ARRAY_SIZE];
+	int count = MAX_ARRAY_SIZE-7;
+
+	int success = 1;
+
+	for (int i = 0; i<count; i++) {
+		sorted[i] = i*2-100;
+		doubles[i] = i*0.5;
+		shorts[i] = (short)(i*3);
+	}
+	for (int layout = SHUFFLE_LAYOUT_SHUFFLED; layout<=SHUFFLE_LAYOUT_EYTZINGER; layout++) {
+		if (layout==SHUFFLE_LAYOUT_BLOCK)
+			BlockShuffleSortedArray(keys, sorted, count);
+		else {
+			memcpy(keys, sorted, count*sizeof(int));
+			if (layout==SHUFFLE_LAYOUT_SHUFFLED)
+				ShuffleSortedArray(keys, count);
+			else
+				EytzingerShuffleSortedArray(keys, count);
+		}
+		const void *values[2] = { doubles, shorts };
+		size_t sizes[2] = { sizeof(double), sizeof(short) };
+		ShuffleFile file;
+		int error = ShuffleFileWrite(path, keys, count, SHUFFLE_KEY_I32, layout, values, sizes, 2);
+		if (!error)
+			error = ShuffleFileOpen(&file, path, SHUFFLE_FILE_VERIFY | SHUFFLE_FILE_RANDOM | SHUFFLE_FILE_HUGEPAGES);
+		if (error) {
+			printf("Problem: file layout=%d error %d\n", layout, error);
+			remove(path);
+			return 0;
+		}
+		for (int i = 0; i<count; i++) {
+			const double *d = (const double*)ShuffleFileLookupValue(&file, sorted[i], 0);
+			const short *h = (const short*)ShuffleFileLookupValue(&file, sorted[i], 1);
+			if (!d || !h || *d!=i*0.5 || *h!=i*3 || ShuffleFileSearch(&file, sorted[i]+1)>=0) {
+				success = 0;
+				printf("Problem: file layout=%d value %d\n", layout, sorted[i]);
+				break;
+			}
+		}
+		ShuffleFileClose(&file);
+	}
+
+	// headers that don't describe their keys are rejected before any key is read
+	for (int c = 0; c<7; c++) {
+		ShuffleFileHeader header;
+		FILE *f = fopen(path, "r+b");
+		if (!f || fread(&header, sizeof(header), 1, f)!=1) {
+			if (f)
+				fclose(f);
+			continue;
+		}
+		ShuffleFileHeader corrupt = header;
+		if (c==0)
+			corrupt.key_type = corrupt.key_size = 0;
+		else if (c==1)
+			corrupt.layout = 0;
+		else if (c==2)
+			corrupt.layout = SHUFFLE_LAYOUT_EYTZINGER+1;
+		else if (c==3)
+			corrupt.keys = corrupt.count+1;
+		else if (c==4)
+			corrupt.alignment = 12;
+		else if (c==5)
+			corrupt.keys_offset += 2;	// keys not aligned to their size
+		else
+			corrupt.keys_offset = 0;	// keys in the header
+		fseek(f, 0, SEEK_SET);
+		fwrite(&corrupt, sizeof(corrupt), 1, f);
+		fclose(f);
+		ShuffleFile file;
+		if (ShuffleFileOpen(&file, path, 0)!=SHUFFLE_FILE_ERROR_FORMAT) {
+			success = 0;
+			printf("Problem: file with corrupt header %d was opened\n", c);
+			ShuffleFileClose(&file);
+		}
+		f = fopen(path, "r+b");
+		if (f) {
+			fwrite(&header, sizeof(header), 1, f);
+			fclose(f);
+		}
+	}
+
+	// only the current version is read
+	for (int v = 0; v<2; v++) {
+		ShuffleFileHeader header;
+		FILE *f = fopen(path, "r+b");
+		if (!f || fread(&header, sizeof(header), 1, f)!=1) {
+			if (f)
+				fclose(f);
+			continue;
+		}
+		ShuffleFileHeader other = header;
+		other.version = v ? SHUFFLE_FILE_VERSION+1 : 0;
+		fseek(f, 0, SEEK_SET);
+		fwrite(&other, sizeof(other), 1, f);
+		fclose(f);
+		ShuffleFile file;
+		if (ShuffleFileOpen(&file, path, 0)!=SHUFFLE_FILE_ERROR_VERSION) {
+			success = 0;
+			printf("Problem: file of version %u was opened\n", other.version);
+			ShuffleFileClose(&file);
+		}
+		f = fopen(path, "r+b");
+		if (f) {
+			fwrite(&header, sizeof(header), 1, f);
+			fclose(f);
+		}
+	}
+
+	// a changed byte is found by the checksum, in the keys or in a value size in the array table
+	static const long changed[] = { SHUFFLE_FILE_ALIGNMENT+5, sizeof(ShuffleFileHeader)+8 };
+	for (int c = 0; c<2; c++) {
+		FILE *f = fopen(path, "r+b");
+		if (!f)
+			continue;
+		fseek(f, changed[c], SEEK_SET);
+		int byte = fgetc(f);
+		fseek(f, changed[c], SEEK_SET);
+		fputc(byte ^ 12, f);	// a value size of 8 is 4, which the header check allows
+		fclose(f);
+		ShuffleFile file;
+		int opened = ShuffleFileOpen(&file, path, 0)==SHUFFLE_FILE_OK;
+		if (opened)
+			ShuffleFileClose(&file);
+		if (!opened || ShuffleFileOpen(&file, path, SHUFFLE_FILE_VERIFY)!=SHUFFLE_FILE_ERROR_CHECKSUM) {
+			success = 0;
+			printf("Problem: file checksum did not catch a changed byte at %ld\n", changed[c]);
+		}
+		f = fopen(path, "r+b");
+		if (f) {
+			fseek(f, changed[c], SEEK_SET);
+			fputc(byte, f);
+			fclose(f);
+		}
+	}
+	remove(path);
+	return success;
+}
+
+static long ReadTestFile(const char *path, unsigned char *data, long size)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return -1;
+	long read = (long)fread(data, 1, size, f);
+	fclose(f);
+	return read;
+}
+
+int TestShuffleFileStream()
+{
+	static const char *path = "test_binsearchshuffle.tmp";
+	static const char *stream_path = "test_binsearchshuffle_stream.tmp";
+	static int sorted[MAX_ARRAY_SIZE];
+	static int keys[MAX_ARRAY_SIZE];
+	static double doubles[MAX_ARRAY_SIZE];
+	static short shorts[MAX_ARRAY_SIZE];
+	static unsigned char written[8*SHUFFLE_FILE_ALIGNMENT], streamed[8*SHUFFLE_FILE_ALIGNMENT];
+	static const int counts[] = { MAX_ARRAY_SIZE-7, 1, 0, 100 };
+	static const int buffers[] = { 1, 7, 64, 0 };
+
+	int success = 1;
+
+	for (int i = 0; i<MAX_ARRAY_SIZE; i++) {
+		sorted[i] = i*3-500;
+		doubles[i] = i*0.25;
+		shorts[i] = (short)(i*5);
+	}
+	const void *values[2] = { doubles, shorts };
+	size_t sizes[2] = { sizeof(double), sizeof(short) };
+	for (int c = 0; c<(int)(sizeof(counts)/sizeof(counts[0])); c++) {
+		int count = counts[c];
+		memcpy(keys, sorted, count*sizeof(int));
+		ShuffleSortedArray(keys, count);
+		int error = ShuffleFileWrite(path, keys, count, SHUFFLE_KEY_I32, SHUFFLE_LAYOUT_SHUFFLED, values, sizes, 2);
+		long size = ReadTestFile(path, written, sizeof(written));
+		for (int b = 0; !error && b<(int)(sizeof(buffers)/sizeof(buffers[0])); b++) {
+			// the same file from the sorted keys added a few at a time
+			ShuffleFileStream stream;
+			error = ShuffleFileStreamBegin(&stream, stream_path, count, SHUFFLE_KEY_I32, sizes, 2, buffers[b]);
+			for (int i = 0, n = 1; !error && i<count; i += n, n = n*2%13+1) {
+				if (n>count-i)
+					n = count-i;
+				const void *at[2] = { doubles+i, shorts+i };
+				error = ShuffleFileStreamAdd(&stream, sorted+i, n, at);
+			}
+			if (!error)
+				error = ShuffleFileStreamEnd(&stream);
+			if (error || ReadTestFile(stream_path, streamed, sizeof(streamed))!=size || memcmp(written, streamed, size)) {
+				success = 0;
+				printf("Problem: stream count=%d buffer=%d error %d\n", count, buffers[b], error);
+				break;
+			}
+			ShuffleFile file;
+			error = ShuffleFileOpen(&file, stream_path, SHUFFLE_FILE_VERIFY);
+			for (int i = 0; !error && i<count; i++) {
+				const double *d = (const double*)ShuffleFileLookupValue(&file, sorted[i], 0);
+				if (!d || *d!=i*0.25) {
+					success = 0;
+					printf("Problem: stream count=%d value %d\n", count, sorted[i]);
+					break;
+				}
+			}
+			if (!error)
+				ShuffleFileClose(&file);
+		}
+		if (error) {
+			success = 0;
+			printf("Problem: stream count=%d error %d\n", count, error);
+			break;
+		}
+	}
+
+	// keys out of order and too few keys are errors and leave no file
+	ShuffleFileStream stream;
+	int reversed[3] = { 5, 4, 3 };
+	const void *none[1] = { NULL };
+	size_t no_sizes[1] = { 0 };
+	ShuffleFileStreamBegin(&stream, stream_path, 3, SHUFFLE_KEY_I32, no_sizes, 0, 0);
+	if (ShuffleFileStreamAdd(&stream, reversed, 3, none)!=SHUFFLE_FILE_ERROR_ORDER || ShuffleFileStreamEnd(&stream)!=SHUFFLE_FILE_ERROR_ORDER) {
+		success = 0;
+		printf("Problem: stream keys out of order\n");
+	}
+	ShuffleFileStreamBegin(&stream, stream_path, 3, SHUFFLE_KEY_I32, no_sizes, 0, 0);
+	ShuffleFileStreamAdd(&stream, sorted, 2, none);
+	if (ShuffleFileStreamEnd(&stream)!=SHUFFLE_FILE_ERROR_ORDER || ReadTestFile(stream_path, streamed, 1)>=0) {
+		success = 0;
+		printf("Problem: stream with missing keys\n");
+	}
+
+	remove(path);
+	remove(stream_path);
+	return success;
+}
+
+int TestArena()
+{
+	static int values[3000];
+	for (int i = 0; i<3000; i++)
+		values[i] = i*2;
+
+	int success = 1;
+
+	ShuffleArena arena;
+	if (!ShuffleArenaInit(&arena, 0)) {
+		printf("Problem: arena init failed\n");
+		return 0;
+	}
+	size_t capacity;
+	void *small = ShuffleArenaAlloc(&arena, 100, &capacity);
+	if (!small || ((uintptr_t)small % SHUFFLE_ARENA_ALIGN) || capacity!=128) {
+		success = 0;
+		printf("Problem: arena buffer not aligned or wrong size class\n");
+	}
+	ShuffleArenaRelease(&arena, small, capacity);
+	if (ShuffleArenaAlloc(&arena, 128, &capacity)!=small) {
+		success = 0;
+		printf("Problem: arena released buffer not reused\n");
+	}
+	ShuffleArenaRelease(&arena, small, capacity);
+	void *large = ShuffleArenaAlloc(&arena, 3<<20, &capacity);
+	if (!large || capacity<(3<<20) || ((uintptr_t)large % SHUFFLE_ARENA_ALIGN)) {
+		success = 0;
+		printf("Problem: arena large buffer\n");
+	} else
+		memset(large, 1, capacity);
+	ShuffleArenaRelease(&arena, large, capacity);
+
+	ShuffledHandle handle;
+	if (!ShuffledHandleInit(&handle, &arena, values, 1000)) {
+		printf("Problem: arena handle init failed\n");
+		ShuffleArenaFree(&arena);
+		return 0;
+	}
+	// odd values grow the buffer a few times
+	for (int i = 0; i<1000 && success; i++) {
+		if (ShuffledHandleInsert(&handle, i*2+1)!=1 || ShuffledHandleInsert(&handle, i*2+1)!=0) {
+			success = 0;
+			printf("Problem: arena handle insert %d\n", i*2+1);
+		}
+	}
+	if (handle.count!=2000 || handle.capacity<2000 || ShuffledHandleRemove(&handle, 5)!=1 || ShuffledHandleRemove(&handle, 5)!=0) {
+		success = 0;
+		printf("Problem: arena handle count %d capacity %d\n", handle.count, handle.capacity);
+	}
+	for (int i = 0; i<2000 && success; i++) {
+		int index = ShuffledHandleSearch(&handle, i);
+		if ((index<0)!=(i==5) || (index>=0 && handle.values[index]!=i)) {
+			success = 0;
+			printf("Problem: arena handle search %d\n", i);
+		}
+	}
+	// the second rebuild of the same size reuses the buffers of the first
+	int unsorted[3000];
+	for (int i = 0; i<3000; i++)
+		unsorted[i] = values[(i*7)%3000];
+	ShuffledHandleRebuild(&handle, unsorted, 3000);
+	size_t mapped = arena.mapped;
+	const int *first = handle.values;
+	if (ShuffledHandleRebuild(&handle, unsorted, 3000)!=3000 || ShuffledHandleRebuild(&handle, unsorted, 3000)!=3000 ||
+		arena.mapped!=mapped || handle.values!=first) {
+		success = 0;
+		printf("Problem: arena rebuild did not reuse buffers\n");
+	}
+	for (int i = 0; i<3000 && success; i++) {
+		if (ShuffledHandleSearch(&handle, values[i])<0) {
+			success = 0;
+			printf("Problem: arena rebuild lost %d\n", values[i]);
+		}
+	}
+	ShuffledHandleFree(&handle);
+	if (arena.used) {
+		success = 0;
+		printf("Problem: arena has %d bytes in use after free\n", (int)arena.used);
+	}
+	ShuffleArenaFree(&arena);
+	return success;
+}
+
+// number of values a search compares to find the value at a shuffled index
+static int DepthOfIndex(int index, int count)
+{
+	int depth = 1;
+	while (index) {
+		if (index>count/2) {
+			index -= count/2+1;
+			count = (count-1)/2;
+		} else {
+			index--;
+			count /= 2;
+		}
+		depth++;
+	}
+	return depth;
+}
+
+int TestStats()
+{
+	static int array[1000];
+	for (int i = 0; i<1000; i++)
+		array[i] = i;
+
+	int success = 1;
+
+	// counts are only built in with SHUFFLE_STATS
+	int enabled = ShuffleStatsEnable(SHUFFLE_STATS_SOFTWARE | SHUFFLE_STATS_HARDWARE);
+	ShuffleStatsReset();
+	ShuffleSortedArray(array, 1000);
+	int steps = 0;
+	for (int i = 0; i<1000; i++) {
+		int index = ShuffledBinarySearch(i, array, 1000);
+		steps += DepthOfIndex(index, 1000);
+	}
+	SortShuffledArray(array, 1000);
+	ShuffleStats stats;
+	ShuffleStatsGet(&stats);
+	ShuffleStatsDisable();
+	ShuffleStatsThreadExit();
+	if (enabled) {
+		const ShuffleCounters *search = &stats.ops[SHUFFLE_STATS_SEARCH];
+		if (search->calls!=1000 || search->steps!=(uint64_t)steps || stats.ops[SHUFFLE_STATS_SHUFFLE].calls!=1 ||
+			stats.ops[SHUFFLE_STATS_SORT].calls!=1 || !stats.ops[SHUFFLE_STATS_SHUFFLE].moved_bytes ||
+			!stats.ops[SHUFFLE_STATS_SORT].moved_bytes) {
+			success = 0;
+			printf("Problem: stats counted %d searches %d steps\n", (int)search->calls, (int)search->steps);
+		}
+		if ((enabled & SHUFFLE_STATS_HARDWARE) && (!search->sampled || search->sampled>search->calls ||
+			stats.ops[SHUFFLE_STATS_SHUFFLE].sampled!=1 || !stats.ops[SHUFFLE_STATS_SHUFFLE].cycles)) {
+			success = 0;
+			printf("Problem: stats hardware counters\n");
+		}
+	} else if (stats.ops[SHUFFLE_STATS_SEARCH].calls || stats.enabled) {
+		success = 0;
+		printf("Problem: stats counted without SHUFFLE_STATS\n");
+	}
+	char text[2048];
+	int length = ShuffleStatsFormat(&stats, text, sizeof(text));
+	if (length!=ShuffleStatsFormat(&stats, NULL, 0) || length>=(int)sizeof(text) || !strstr(text, "shuffle_search_calls ")) {
+		success = 0;
+		printf("Problem: stats format\n");
+	}
+	return success;
+}
 
 int main(int argc, char **argv)
 {
 	srand((unsigned int)time(NULL));
 	if (!TestShuffle())
 		return 1;
+	if (!TestSearchKernels())
+		return 1;
+	if (!TestShuffleCopy())
+		return 1;
+	if (!TestBatchSearch())
+		return 1;
+	if (!TestShuffleTypes())
+		return 1;
+	if (!TestShuffle64())
+		return 1;
+	if (!TestInsertRemove())
+		return 1;
+	if (!TestIndexConversion())
+		return 1;
+	if (!TestShuffledRange())
+		return 1;
+	if (!TestRadix())
+		return 1;
+	if (!TestDuplicates())
+		return 1;
+	if (!TestBlockShuffle())
+		return 1;
+	if (!TestEytzinger())
+		return 1;
+	if (!TestHybrid())
+		return 1;
+	if (!TestKeyValues())
+		return 1;
+	if (!TestBulkUpdate())
+		return 1;
+	if (!TestGapped())
+		return 1;
+	if (!TestPacked())
+		return 1;
+	if (!TestBuildShuffled())
+		return 1;
+	if (!TestParallelShuffle())
+		return 1;
+	if (!TestTable())
+		return 1;
+	if (!TestShards())
+		return 1;
+	if (!TestOffload())
+		return 1;
+	if (!TestShuffleFile())
+		return 1;
+	if (!TestShuffleFileStream())
+		return 1;
+	if (!TestArena())
+		return 1;
+	if (!TestStats())
+		return 1;
 	return 0;
 }
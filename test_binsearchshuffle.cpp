@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "binsearchshuffle.h"
+#include "binsearchshuffle.hpp"
+#if defined(__cpp_impl_coroutine) && __cplusplus>=202002L
+#include "binsearchshuffle_coro.hpp"
+#define TEST_COROUTINES 1
+#endif
+
+// tests of the C++ interface, the C functions are tested by test_binsearchshuffle.c
+
+enum Field { FIELD_NONE = 0, FIELD_HOST = 3, FIELD_PATH = 7, FIELD_PORT = 12, FIELD_USER = 40, FIELD_DATE = 41, FIELD_LAST = 90 };
+
+constexpr std::array<int, 7> s_fields = { FIELD_NONE, FIELD_HOST, FIELD_PATH, FIELD_PORT, FIELD_USER, FIELD_DATE, FIELD_LAST };
+constexpr shuffle::ShuffledTable<int, 7> s_field_table(s_fields);
+
+// searched at compile time
+static_assert(s_field_table.Contains(FIELD_PORT), "");
+static_assert(!s_field_table.Contains(13), "");
+static_assert(s_field_table.FindLinear(FIELD_USER)==4, "");
+static_assert(s_field_table[s_field_table.Find(FIELD_DATE)]==FIELD_DATE, "");
+static_assert(shuffle::DeshuffleIndex(0, 7)==3, "");
+
+template<std::size_t N>
+static int TestShuffledTableSize()
+{
+	constexpr std::array<int, N> sorted = [] {
+		std::array<int, N> values{};
+		for (std::size_t i = 0; i<N; i++)
+			values[i] = (int)i*3-10;
+		return values;
+	}();
+	constexpr shuffle::ShuffledTable<int, N> table(sorted);
+
+	// the same order as ShuffleSortedArray
+	int shuffled[N ? N : 1];
+	memcpy(shuffled, sorted.data(), N * sizeof(int));
+	ShuffleSortedArray(shuffled, (int)N);
+	if (N && memcmp(shuffled, table.data(), N * sizeof(int))) {
+		printf("Problem: constexpr table of %d values is not shuffled like ShuffleSortedArray\n", (int)N);
+		return 0;
+	}
+	for (int i = 0; i<(int)N; i++) {
+		int index = table.Find(sorted[i]);
+		if (index!=ShuffledBinarySearch(sorted[i], shuffled, (int)N) || table.FindLinear(sorted[i])!=i ||
+			shuffle::DeshuffleIndex(index, (int)N)!=DeshuffleIndex(index, (int)N) || table.Contains(sorted[i]+1)) {
+			printf("Problem: constexpr table of %d values, value %d\n", (int)N, sorted[i]);
+			return 0;
+		}
+	}
+	return !table.Contains(-11) && !table.Contains(3*(int)N);
+}
+
+int TestShuffledTable()
+{
+	int success = TestShuffledTableSize<0>() && TestShuffledTableSize<1>() && TestShuffledTableSize<2>() &&
+		TestShuffledTableSize<8>() && TestShuffledTableSize<31>() && TestShuffledTableSize<100>() && TestShuffledTableSize<257>();
+	if (!success)
+		printf("Problem: constexpr table\n");
+	return success;
+}
+
+// shuffled_set against std::set with random inserts, erases and lookups
+int TestShuffledSet()
+{
+	int success = 1;
+	std::set<long long> expect;
+	shuffle::shuffled_set<long long> set;
+	set.reserve(600);
+	const long long *data = set.data();
+	for (int i = 0; i<2000 && success; i++) {
+		long long value = rand() % 1000;
+		if (rand() % 3) {
+			bool inserted = set.insert(value).second;
+			if (inserted!=expect.insert(value).second) {
+				printf("Problem: shuffled_set insert %lld\n", value);
+				success = 0;
+			}
+		} else if (set.erase(value)!=expect.erase(value)) {
+			printf("Problem: shuffled_set erase %lld\n", value);
+			success = 0;
+		}
+		if (set.size()!=expect.size() || !std::equal(set.begin(), set.end(), expect.begin(), expect.end())) {
+			printf("Problem: shuffled_set has different values than std::set after %d updates\n", i);
+			success = 0;
+		}
+		long long probe = rand() % 1002 - 1;
+		auto lower = set.lower_bound(probe), upper = set.upper_bound(probe);
+		if ((set.find(probe)!=set.end())!=(expect.count(probe)==1) || set.count(probe)!=expect.count(probe) ||
+			lower-set.begin()!=std::distance(expect.begin(), expect.lower_bound(probe)) ||
+			upper-set.begin()!=std::distance(expect.begin(), expect.upper_bound(probe)) ||
+			set.equal_range(probe)!=std::make_pair(lower, upper)) {
+			printf("Problem: shuffled_set lookup %lld\n", probe);
+			success = 0;
+		}
+	}
+	if (set.data()!=data) {
+		printf("Problem: shuffled_set reallocated below the reserved size\n");
+		success = 0;
+	}
+
+	// the same layout as ShuffleSortedArray, for ints the C functions do the shuffle
+	std::vector<int> sorted;
+	for (long long value : set)
+		sorted.push_back((int)value);
+	shuffle::shuffled_set<int> ints(sorted.rbegin(), sorted.rend());
+	ShuffleSortedArray(sorted.data(), (int)sorted.size());
+	for (std::size_t i = 0; i<sorted.size(); i++) {
+		if (sorted[i]!=set.data()[i] || sorted[i]!=ints.data()[i]) {
+			printf("Problem: shuffled_set is not shuffled like ShuffleSortedArray at %d\n", (int)i);
+			success = 0;
+			break;
+		}
+	}
+	if (std::vector<int>(ints.rbegin(), ints.rend()).front()!=*std::max_element(sorted.begin(), sorted.end())) {
+		printf("Problem: shuffled_set reverse iterator\n");
+		success = 0;
+	}
+
+	// ranges merge with the values already there
+	shuffle::shuffled_set<std::string> names = { "b", "d", "a" };
+	names.insert({ "c", "a", "e", "c" });
+	shuffle::shuffled_set<std::string> moved(std::move(names));
+	if (moved.size()!=5 || *moved.begin()!="a" || *(moved.end()-1)!="e" || moved.begin()[2]!="c" || !names.empty()) {
+		printf("Problem: shuffled_set of strings\n");
+		success = 0;
+	}
+	moved.erase(moved.find("b"), moved.find("e"));
+	if (moved.size()!=2 || moved.contains("c") || !moved.contains("e")) {
+		printf("Problem: shuffled_set erase range\n");
+		success = 0;
+	}
+	return success;
+}
+
+// a key whose copies throw once s_copies_left runs out
+struct ThrowingKey {
+	static int s_copies_left;
+	int id;
+	ThrowingKey(int i) : id(i) {}
+	ThrowingKey(const ThrowingKey &other) : id(other.id)
+	{
+		if (!s_copies_left--)
+			throw std::runtime_error("copy");
+	}
+	ThrowingKey(ThrowingKey &&other) noexcept : id(other.id) {}
+	ThrowingKey &operator=(const ThrowingKey &other) = default;
+	ThrowingKey &operator=(ThrowingKey &&other) noexcept = default;
+	bool operator<(const ThrowingKey &other) const { return id<other.id; }
+};
+int ThrowingKey::s_copies_left = 1000;
+
+// ++ and -- from every position against the sorted values, and an insert of a range that throws
+int TestSortedIterator()
+{
+	int success = 1;
+	for (int count = 0; count<300 && success; count++) {
+		std::vector<int> sorted;
+		for (int i = 0; i<count; i++)
+			sorted.push_back(i*3);
+		shuffle::shuffled_set<int> set(sorted.begin(), sorted.end());
+		if (!std::equal(set.begin(), set.end(), sorted.begin(), sorted.end()) ||
+			!std::equal(set.rbegin(), set.rend(), sorted.rbegin(), sorted.rend())) {
+			printf("Problem: sorted iterator over %d values\n", count);
+			success = 0;
+		}
+		for (int i = 0; i<count && success; i++) {
+			auto found = set.find(i*3), stepped = set.begin()+i;
+			int forward = i, backward = i;
+			for (auto it = found; it!=set.end() && success; ++it, forward++) {
+				if (*it!=forward*3 || it.index()!=ShuffleIndex(forward, count))
+					success = 0;
+			}
+			for (auto it = stepped; success; --it, backward--) {
+				if (*it!=backward*3 || it.linear()!=backward)
+					success = 0;
+				if (it==set.begin())
+					break;
+			}
+			if (!success || forward!=count || backward!=0 || (found++, *--found)!=i*3 || *--set.end()!=(count-1)*3) {
+				printf("Problem: sorted iterator steps from %d of %d values\n", i, count);
+				success = 0;
+			}
+		}
+	}
+
+	shuffle::shuffled_set<ThrowingKey> keys = { 5, 1, 3 };
+	std::vector<ThrowingKey> more = { 4, 2, 6, 0 };
+	bool threw = false;
+	try {
+		ThrowingKey::s_copies_left = 2;
+		keys.insert(more.begin(), more.end());
+	} catch (const std::runtime_error &) {
+		threw = true;
+	}
+	ThrowingKey::s_copies_left = 1000;
+	if (!threw || keys.size()!=3 || !keys.contains(1) || !keys.contains(3) || !keys.contains(5) || keys.contains(4)) {
+		printf("Problem: shuffled_set insert of a range that throws changed the set\n");
+		success = 0;
+	}
+	keys.insert(more.begin(), more.end());
+	if (keys.size()!=7 || keys.begin()->id!=0 || (--keys.end())->id!=6) {
+		printf("Problem: shuffled_set insert of a range\n");
+		success = 0;
+	}
+	return success;
+}
+
+// counts how many keys are made so a lookup can be checked for temporaries
+struct CountedKey {
+	static int s_made;
+	int id;
+	CountedKey(int i) : id(i) { s_made++; }
+	CountedKey(const CountedKey &other) : id(other.id) { s_made++; }
+	CountedKey &operator=(const CountedKey &other) = default;
+};
+int CountedKey::s_made = 0;
+struct CountedLess {
+	using is_transparent = void;
+	bool operator()(const CountedKey &a, const CountedKey &b) const { return a.id<b.id; }
+	bool operator()(const CountedKey &a, int b) const { return a.id<b; }
+	bool operator()(int a, const CountedKey &b) const { return a<b.id; }
+};
+
+int TestShuffledMap()
+{
+	int success = 1;
+	std::map<int, int> expect;
+	shuffle::shuffled_map<int, int> map;
+	for (int i = 0; i<1500; i++) {
+		int key = rand() % 500;
+		if (rand() % 4) {
+			map[key] += i;
+			expect[key] += i;
+		} else {
+			map.erase(key);
+			expect.erase(key);
+		}
+	}
+	if (map.size()!=expect.size() || !std::equal(map.begin(), map.end(), expect.begin(), expect.end(),
+		[](const std::pair<int, int> &a, const std::pair<const int, int> &b) { return a.first==b.first && a.second==b.second; })) {
+		printf("Problem: shuffled_map has different values than std::map\n");
+		success = 0;
+	}
+	for (auto &item : map)
+		item.second = -item.second;
+	for (auto &item : expect) {
+		if (map.at(item.first)!=-item.second) {
+			printf("Problem: shuffled_map value of %d\n", item.first);
+			success = 0;
+		}
+	}
+	int missing = 0;
+	while (expect.count(missing))
+		missing++;
+	bool threw = false;
+	try {
+		map.at(missing);
+	} catch (const std::out_of_range &) {
+		threw = true;
+	}
+	if (!threw || map.contains(missing) || map.insert_or_assign(missing, 7).second!=true || map.insert_or_assign(missing, 8).second!=false || map.at(missing)!=8) {
+		printf("Problem: shuffled_map missing key\n");
+		success = 0;
+	}
+
+	// move only values and heterogeneous lookup
+	shuffle::shuffled_map<std::string, std::unique_ptr<int>, std::less<>> owners;
+	owners.try_emplace("one", new int(1));
+	owners.emplace("three", std::unique_ptr<int>(new int(3)));
+	owners.try_emplace(std::string("two"), new int(2));
+	shuffle::shuffled_map<std::string, std::unique_ptr<int>, std::less<>> moved;
+	moved = std::move(owners);
+	std::string_view two("two");
+	if (moved.size()!=3 || *moved.find(two)->second!=2 || *moved.find("one")->second!=1 || moved.find("four")!=moved.end() ||
+		moved.lower_bound("p")->first!="three" || moved.count(two)!=1) {
+		printf("Problem: shuffled_map with move only values\n");
+		success = 0;
+	}
+
+	shuffle::shuffled_map<CountedKey, int, CountedLess> counted = { { 5, 50 }, { 1, 10 }, { 3, 30 } };
+	int made = CountedKey::s_made;
+	if (counted.find(3)->second!=30 || counted.contains(4) || counted.equal_range(1).first->second!=10 || CountedKey::s_made!=made) {
+		printf("Problem: shuffled_map heterogeneous lookup made a key\n");
+		success = 0;
+	}
+	return success;
+}
+
+#ifdef TEST_COROUTINES
+// a request that looks up several values, one after the other, between the searches of other requests
+static shuffle::task<void> CoroutineRequest(shuffle::round_robin_executor &executor, const int *shuffled, int count, const int *values, int nvalues, int *out)
+{
+	for (int i = 0; i<nvalues; i++)
+		out[i] = co_await shuffle::shuffled_search(executor, values[i], shuffled, count);
+}
+
+static shuffle::task<int> CoroutineThrows(shuffle::round_robin_executor &executor)
+{
+	co_await executor.yield();
+	throw std::runtime_error("search failed");
+}
+
+static shuffle::task<void> CoroutineCatches(shuffle::round_robin_executor &executor, int *caught)
+{
+	try {
+		co_await CoroutineThrows(executor);
+	} catch (const std::runtime_error &) {
+		*caught = 1;
+	}
+}
+
+int TestCoroutineSearch()
+{
+	const int count = 100003, nvalues = 4000, requests = 37;
+	std::vector<int> shuffled(count), values(nvalues), found(nvalues, -2);
+	for (int i = 0; i<count; i++)
+		shuffled[i] = i*2;
+	ShuffleSortedArray(shuffled.data(), count);
+	for (int i = 0; i<nvalues; i++)
+		values[i] = rand() % (2*count+4) - 2;	// odd values and the ends miss
+
+	int success = 1;
+	shuffle::round_robin_executor executor;
+	int per = (nvalues+requests-1)/requests;
+	for (int r = 0; r<requests; r++) {
+		int first = r*per, n = std::min(per, nvalues-first);
+		executor.spawn(CoroutineRequest(executor, shuffled.data(), count, values.data()+first, n, found.data()+first));
+	}
+	std::size_t resumes = executor.run();
+	for (int i = 0; i<nvalues; i++) {
+		if (found[i]!=ShuffledBinarySearch(values[i], shuffled.data(), count)) {
+			printf("Problem: coroutine search of %d found %d\n", values[i], found[i]);
+			success = 0;
+			break;
+		}
+	}
+	if (resumes<(std::size_t)nvalues || !executor.empty()) {
+		printf("Problem: coroutine searches did not interleave (%d resumes)\n", (int)resumes);
+		success = 0;
+	}
+
+	// strings with their own compare, and an exception in an awaited task reaches the awaiting one
+	std::vector<std::string> words = { "ant", "bee", "cat", "dog", "eel" };
+	shuffle::detail::ShuffleSorted(words.begin(), (std::ptrdiff_t)words.size());
+	int word = -2, caught = 0;
+	executor.spawn([](shuffle::round_robin_executor &executor, const std::vector<std::string> &words, int *word) -> shuffle::task<void> {
+		*word = co_await shuffle::shuffled_search(executor, std::string("dog"), words.data(), (int)words.size());
+	}(executor, words, &word));
+	executor.spawn(CoroutineCatches(executor, &caught));
+	executor.run();
+	if (word<0 || words[word]!="dog" || !caught) {
+		printf("Problem: coroutine search of strings or exception\n");
+		success = 0;
+	}
+	return success;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	if (!TestShuffledTable())
+		return 1;
+	if (!TestShuffledSet())
+		return 1;
+	if (!TestSortedIterator())
+		return 1;
+	if (!TestShuffledMap())
+		return 1;
+#ifdef TEST_COROUTINES
+	if (!TestCoroutineSearch())
+		return 1;
+#endif
+	return 0;
+}